@@ -0,0 +1,313 @@
+/* absorptance.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* With an absorptance A(E) the absorbed photon flux is int A(E) N_sun(E) dE and, by
+ * detailed balance, the same A(E) weights the blackbody emission that sets RR0:
+ *   RR0 = 2 pi / (c^2 h^3) int A(E) E^2 / (exp(E / kB T) - 1) dE
+ * The solar integral is taken over the measured grid with A and the intensity both linear
+ * in wavelength on every segment, which with A = 1 is exactly what spectrum_table sums.
+ * On a segment [a, b] of width h the weights of A at its ends are
+ *   w_a = h (I_a a / 3 + I_a h / 12 + I_b a / 6 + I_b h / 12) / (h c)
+ *   w_b = h (I_a a / 6 + I_a h / 12 + I_b a / 3 + I_b h / 4) / (h c)
+ * The emission integral uses Simpson's rule on a grid of excess energies around the gap,
+ * from -40 Eu (Urbach tail) or 0 up to 40 kB T, where the blackbody factor has died out;
+ * x = 0 is always a node, since A may have a kink there. */
+
+#include <stdlib.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_interp.h>
+
+#include "sqlimit.h"
+#include "absorptance.h"
+
+/* Absorption coefficient at an excess energy, linear between the points of the table */
+static double
+absorptance_alpha (const struct absorptance_params *params,
+                   double                           x)  /* J */
+{
+  const size_t n = params->alpha_length;
+  if (!n || x < params->alpha_excess[0])
+    return 0;
+  if (x >= params->alpha_excess[n - 1])
+    return params->alpha[n - 1];
+  const size_t k = gsl_interp_bsearch (params->alpha_excess, x, 0, n - 1);
+  const double t = (x - params->alpha_excess[k]) / (params->alpha_excess[k + 1] - params->alpha_excess[k]);
+  return (1 - t) * params->alpha[k] + t * params->alpha[k + 1];
+}
+
+static double
+absorptance_eval (const struct absorptance_params *params,
+                  double                           x,          /* J */
+                  double                           alpha,      /* 1/m */
+                  double                           thickness)  /* m */
+{
+  switch (params->model)
+    {
+    case ABSORPTANCE_URBACH:
+      return x >= 0 ? 1 : exp (x / params->urbach_energy);
+    case ABSORPTANCE_BEER_LAMBERT:
+      return -expm1 (-alpha * thickness);
+    case ABSORPTANCE_YABLONOVITCH:
+      return alpha > 0 ? alpha / (alpha + 1 / (4 * params->refractive_index * params->refractive_index * thickness)) : 0;
+    case ABSORPTANCE_CUSTOM:
+      return params->function (x, thickness, params->data);
+    case ABSORPTANCE_STEP:
+    default:
+      return x >= 0 ? 1 : 0;
+    }
+}
+
+static bool
+absorptance_uses_alpha (const struct absorptance_params *params)
+{
+  return params->model == ABSORPTANCE_BEER_LAMBERT || params->model == ABSORPTANCE_YABLONOVITCH;
+}
+
+static int
+absorptance_params_check (const struct absorptance_params *params)
+{
+  switch (params->model)
+    {
+    case ABSORPTANCE_STEP:
+      return GSL_SUCCESS;
+    case ABSORPTANCE_URBACH:
+      if (!(params->urbach_energy > 0))
+        {
+          fprintf (stderr, "ERROR: The Urbach energy must be positive.\n");
+          return GSL_EINVAL;
+        }
+      return GSL_SUCCESS;
+    case ABSORPTANCE_YABLONOVITCH:
+      if (!(params->refractive_index >= 1))
+        {
+          fprintf (stderr, "ERROR: The refractive index of a light-trapping absorber must be at least 1.\n");
+          return GSL_EINVAL;
+        }
+      // fall through
+    case ABSORPTANCE_BEER_LAMBERT:
+      if (!params->alpha_length || !params->alpha_excess || !params->alpha)
+        {
+          fprintf (stderr, "ERROR: A finite-thickness absorber needs an absorption coefficient table.\n");
+          return GSL_EINVAL;
+        }
+      for (size_t k = 1; k < params->alpha_length; k++)
+        {
+          if (!(params->alpha_excess[k] > params->alpha_excess[k - 1]))
+            {
+              fprintf (stderr, "ERROR: Absorption coefficient energies must be strictly ascending.\n");
+              return GSL_EINVAL;
+            }
+        }
+      return GSL_SUCCESS;
+    case ABSORPTANCE_CUSTOM:
+      return params->function ? GSL_SUCCESS : GSL_EINVAL;
+    default:
+      return GSL_EINVAL;
+    }
+}
+
+/* Simpson weights of [a, b] with spacing of at most h, written from node first on;
+ * the first node is added to, so that consecutive pieces share their common node */
+static size_t
+simpson_piece (double  a,
+               double  b,
+               double  h,
+               double *excess,
+               double *weight,
+               size_t  first)
+{
+  size_t n = (size_t)ceil ((b - a) / h);
+  n += n % 2;
+  const double step = (b - a) / n;
+  for (size_t i = 0; i <= n; i++)
+    {
+      excess[first + i] = a + i * step;
+      const double w = (i == 0 || i == n ? 1 : (i % 2 ? 4 : 2)) * step / 3;
+      if (i == 0)
+        weight[first] += w;
+      else
+        weight[first + i] = w;
+    }
+  return first + n;
+}
+
+static size_t
+simpson_nodes (double a,
+               double b,
+               double h)
+{
+  size_t n = (size_t)ceil ((b - a) / h);
+  return n + n % 2;
+}
+
+struct absorptance_kernel *
+absorptance_kernel_alloc (const struct absorptance_params *params,
+                          const double                    *wavelengths,  /* nm, strictly ascending */
+                          const double                    *intensities,  /* W/(m^2 nm) */
+                          size_t                           length,
+                          double                           temperature)  /* K */
+{
+  if (length < 2 || !(temperature > 0) || absorptance_params_check (params))
+    return NULL;
+
+  struct absorptance_kernel *kernel = (struct absorptance_kernel *)calloc (1, sizeof (struct absorptance_kernel));
+  if (!kernel)
+    return NULL;
+  kernel->params = *params;
+  kernel->temperature = temperature;
+  kernel->length = length;
+  kernel->Egap = GSL_NAN;
+  kernel->thickness = GSL_NAN;
+
+  const double kT = kB * temperature;
+  const double h = params->model == ABSORPTANCE_URBACH ? GSL_MIN (kT, params->urbach_energy) / 8 : kT / 8;  /* J */
+  const double x_min = params->model == ABSORPTANCE_URBACH ? -40 * params->urbach_energy : 0, x_max = 40 * kT;  /* J */
+  kernel->n_excess = (x_min < 0 ? simpson_nodes (x_min, 0, h) : 0) + simpson_nodes (0, x_max, h) + 1;
+
+  kernel->energy = (double *)malloc (length * sizeof (double));
+  kernel->photon_weight = (double *)calloc (length, sizeof (double));
+  kernel->solar_alpha = (double *)calloc (length, sizeof (double));
+  kernel->solar_A = (double *)calloc (length, sizeof (double));
+  kernel->excess = (double *)malloc (kernel->n_excess * sizeof (double));
+  kernel->excess_weight = (double *)calloc (kernel->n_excess, sizeof (double));
+  kernel->emission_alpha = (double *)calloc (kernel->n_excess, sizeof (double));
+  kernel->emission_A = (double *)calloc (kernel->n_excess, sizeof (double));
+  if (!kernel->energy || !kernel->photon_weight || !kernel->solar_alpha || !kernel->solar_A
+      || !kernel->excess || !kernel->excess_weight || !kernel->emission_alpha || !kernel->emission_A)
+    {
+      absorptance_kernel_free (kernel);
+      return NULL;
+    }
+
+  /* nm * 1E-9 -> m and divided by the photon energy h c / lambda, as in spectrum_table */
+  const double photon_scale = 1E-9 / (hPlanck * c0);
+  for (size_t k = 0; k < length; k++)
+    kernel->energy[k] = hPlanck * c0 / (wavelengths[k] * 1E-9);
+  for (size_t k = 1; k < length; k++)
+    {
+      const double a = wavelengths[k - 1], w = wavelengths[k] - a;
+      const double ya = intensities[k - 1], yb = intensities[k];
+      if (!(w > 0))
+        {
+          fprintf (stderr, "ERROR: Wavelengths must be strictly ascending, got %.17g nm after %.17g nm.\n", wavelengths[k], a);
+          absorptance_kernel_free (kernel);
+          return NULL;
+        }
+      kernel->photon_weight[k - 1] += w * (ya * a / 3 + ya * w / 12 + yb * a / 6 + yb * w / 12) * photon_scale;
+      kernel->photon_weight[k] += w * (ya * a / 6 + ya * w / 12 + yb * a / 3 + yb * w / 4) * photon_scale;
+      kernel->radiation += w / 2 * (ya + yb);
+    }
+
+  size_t last = 0;
+  if (x_min < 0)
+    last = simpson_piece (x_min, 0, h, kernel->excess, kernel->excess_weight, last);
+  simpson_piece (0, x_max, h, kernel->excess, kernel->excess_weight, last);
+  if (absorptance_uses_alpha (params))
+    {
+      for (size_t i = 0; i < kernel->n_excess; i++)
+        kernel->emission_alpha[i] = absorptance_alpha (params, kernel->excess[i]);
+    }
+  return kernel;
+}
+
+void
+absorptance_kernel_free (struct absorptance_kernel *kernel)
+{
+  if (!kernel)
+    return;
+  free (kernel->energy);
+  free (kernel->photon_weight);
+  free (kernel->solar_alpha);
+  free (kernel->solar_A);
+  free (kernel->excess);
+  free (kernel->excess_weight);
+  free (kernel->emission_alpha);
+  free (kernel->emission_A);
+  free (kernel);
+}
+
+/* Tabulates A for a bandgap (J) and thickness (m), recomputing only what depends on
+ * the parameter that changed. The thickness is ignored by the step and Urbach models. */
+int
+absorptance_kernel_set (struct absorptance_kernel *kernel,
+                        double                     Egap,
+                        double                     thickness)
+{
+  const struct absorptance_params *params = &kernel->params;
+  const bool uses_alpha = absorptance_uses_alpha (params);
+  if (uses_alpha && !(thickness > 0))
+    {
+      fprintf (stderr, "ERROR: Absorber thickness %g m is not positive.\n", thickness);
+      return GSL_EDOM;
+    }
+  if (!(Egap > 0))
+    return GSL_EDOM;
+
+  bool solar_changed = false;
+  if (Egap != kernel->Egap)
+    {
+      if (uses_alpha)
+        {
+          for (size_t k = 0; k < kernel->length; k++)
+            kernel->solar_alpha[k] = absorptance_alpha (params, kernel->energy[k] - Egap);
+        }
+      kernel->Egap = Egap;
+      solar_changed = true;
+    }
+  if (thickness != kernel->thickness)
+    {
+      for (size_t i = 0; i < kernel->n_excess; i++)
+        kernel->emission_A[i] = absorptance_eval (params, kernel->excess[i], kernel->emission_alpha[i], thickness);
+      kernel->thickness = thickness;
+      solar_changed = true;
+    }
+  if (solar_changed)
+    {
+      for (size_t k = 0; k < kernel->length; k++)
+        kernel->solar_A[k] = absorptance_eval (params, kernel->energy[k] - Egap, kernel->solar_alpha[k], thickness);
+    }
+  return GSL_SUCCESS;
+}
+
+/* 1/(m^2 s), absorbed from the whole spectrum */
+double
+absorptance_kernel_photons (const struct absorptance_kernel *kernel)
+{
+  double photons = 0;
+  for (size_t k = 0; k < kernel->length; k++)
+    photons += kernel->photon_weight[k] * kernel->solar_A[k];
+  return photons;
+}
+
+/* 1/(m^2 s), the dark radiative recombination weighted by the same absorptance */
+double
+absorptance_kernel_rr0 (const struct absorptance_kernel *kernel)
+{
+  const double kT = kB * kernel->temperature;
+  double integral = 0;
+  for (size_t i = 0; i < kernel->n_excess; i++)
+    {
+      const double E = kernel->Egap + kernel->excess[i];
+      if (E > 0 && kernel->emission_A[i] > 0)
+        integral += kernel->excess_weight[i] * kernel->emission_A[i] * E * E / expm1 (E / kT);
+    }
+  return 2 * M_PI / (c0 * c0 * gsl_pow_3 (hPlanck)) * integral;
+}
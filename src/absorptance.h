@@ -0,0 +1,97 @@
+/* absorptance.h
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stddef.h>
+
+#ifndef ABSORPTANCE_H
+#define ABSORPTANCE_H
+
+/* Absorptance A(E) of the cell, a function of the excess energy x = E - Egap */
+enum absorptance_model
+{
+  ABSORPTANCE_STEP,          // A = 1 above the gap, 0 below; the ideal Shockley-Queisser absorber
+  ABSORPTANCE_URBACH,        // A = 1 above the gap, exp(x / Eu) below
+  ABSORPTANCE_BEER_LAMBERT,  // A = 1 - exp(-alpha d), single pass
+  ABSORPTANCE_YABLONOVITCH,  // A = alpha / (alpha + 1 / (4 n^2 d)), ideal Lambertian light trapping
+  ABSORPTANCE_CUSTOM         // A = function (x, d, data)
+};
+
+struct absorptance_params
+{
+  enum absorptance_model   model;
+  double                   urbach_energy;     /* J */
+  double                   refractive_index;  // Yablonovitch only
+  /* Absorption coefficient, shifted rigidly with the gap: alpha is 0 below alpha_excess[0]
+   * and alpha[alpha_length - 1] above the last point. Borrowed, not copied. */
+  const double            *alpha_excess;      /* J above the gap, strictly ascending */
+  const double            *alpha;             /* 1/m */
+  size_t                   alpha_length;
+  double                 (*function) (double  excess,     /* J */
+                                      double  thickness,  /* m */
+                                      void   *data);
+  void                    *data;
+};
+
+/* A(E) of one parameter set tabulated on two fixed grids: the nodes of a measured spectrum,
+ * for the absorbed photon flux, and excess energies around the gap, for the blackbody
+ * emission behind RR0. Both integrals are then dot products with weights computed once.
+ * The absorption coefficient on the spectrum grid is cached per bandgap, so changing only
+ * the thickness is a vector update of A. The spectrum arrays are borrowed, not copied. */
+struct absorptance_kernel
+{
+  struct absorptance_params  params;
+  double                     temperature;     /* K */
+  double                     radiation;       /* W/m^2 */
+  size_t                     length;          // spectrum nodes
+  double                    *energy;          /* J, per spectrum node */
+  double                    *photon_weight;   /* 1/(m^2 s) per unit A, per spectrum node */
+  double                    *solar_alpha;     /* 1/m, at energy - Egap */
+  double                    *solar_A;
+  size_t                     n_excess;        // emission nodes
+  double                    *excess;          /* J */
+  double                    *excess_weight;   /* J, Simpson weights */
+  double                    *emission_alpha;  /* 1/m, at excess */
+  double                    *emission_A;
+  double                     Egap;            /* J, of solar_alpha and solar_A */
+  double                     thickness;       /* m, of solar_A and emission_A */
+};
+
+extern
+struct absorptance_kernel *absorptance_kernel_alloc   (const struct absorptance_params *params,
+                                                       const double                    *wavelengths,
+                                                       const double                    *intensities,
+                                                       size_t                           length,
+                                                       double                           temperature);
+
+extern
+void                       absorptance_kernel_free    (struct absorptance_kernel       *kernel);
+
+extern
+int                        absorptance_kernel_set     (struct absorptance_kernel       *kernel,
+                                                       double                           Egap,
+                                                       double                           thickness);
+
+extern
+double                     absorptance_kernel_photons (const struct absorptance_kernel *kernel);
+
+extern
+double                     absorptance_kernel_rr0     (const struct absorptance_kernel *kernel);
+
+#endif  /* ABSORPTANCE_H */
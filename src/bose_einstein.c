@@ -0,0 +1,88 @@
+/* bose_einstein.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Integrals of t^n / (exp(t) - 1), the Bose-Einstein (blackbody) kernel in reduced energy t = E / (kB T).
+ * Expanding 1 / (exp(t) - 1) = sum_k exp(-k t) and integrating term by term gives the upper tail
+ *   int_x^inf t^n / (exp(t) - 1) dt = sum_{k >= 1} exp(-k x) sum_{j = 0}^{n} n! / (n - j)! x^(n - j) / k^(j + 1),
+ * i.e. the polylogarithms Li_{j+1}(exp(-x)). For x >= 2 the terms shrink at least by exp(-2) each,
+ * so a few dozen terms reach double precision; a bandgap of 0.5 eV at 300 K is already x ~ 19.
+ * Closer to 0 the complement n! zeta(n + 1) - x^n / n * D_n(x) with GSL's Debye functions is used.
+ * Differences of two tails are taken only for the (small) upper tails, which avoids the
+ * cancellation of subtracting two integrals from 0 that are both close to n! zeta(n + 1). */
+
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_sf_debye.h>
+#include <gsl/gsl_sf_exp.h>
+#include <gsl/gsl_sf_zeta.h>
+
+#include "bose_einstein.h"
+
+/* int_x^inf t^order / (exp(t) - 1) dt for order 1 to 6 */
+double
+bose_einstein_tail (unsigned int order,
+                    double       x)
+{
+  double factorial = 1;
+  for (unsigned int j = 2; j <= order; j++)
+    factorial *= j;
+
+  if (x < 2)
+    {
+      double head;
+      switch (order)
+        {
+        case 1: head = x * gsl_sf_debye_1 (x); break;
+        case 2: head = x * x / 2 * gsl_sf_debye_2 (x); break;
+        case 3: head = gsl_pow_3 (x) / 3 * gsl_sf_debye_3 (x); break;
+        case 4: head = gsl_pow_4 (x) / 4 * gsl_sf_debye_4 (x); break;
+        case 5: head = gsl_pow_5 (x) / 5 * gsl_sf_debye_5 (x); break;
+        case 6: head = gsl_pow_6 (x) / 6 * gsl_sf_debye_6 (x); break;
+        default: return GSL_NAN;
+        }
+      return factorial * gsl_sf_zeta_int (order + 1) - head;
+    }
+
+  double sum = 0;
+  for (unsigned int k = 1; k < 1000; k++)
+    {
+      /* Horner form of sum_j n! / (n - j)! x^(n - j) / k^(j + 1) */
+      double poly = 0, falling = 1, k_pow = k;
+      for (unsigned int j = 0; j <= order; j++)
+        {
+          poly = poly * x + falling / k_pow;
+          falling *= order - j;
+          k_pow *= k;
+        }
+      double term = gsl_sf_exp (-(double)k * x) * poly;
+      sum += term;
+      if (term <= sum * GSL_DBL_EPSILON)
+        break;
+    }
+  return sum;
+}
+
+/* int_{x_lo}^{x_hi} t^order / (exp(t) - 1) dt */
+double
+bose_einstein_integral (unsigned int order,
+                        double       x_lo,
+                        double       x_hi)
+{
+  return bose_einstein_tail (order, x_lo) - bose_einstein_tail (order, x_hi);
+}
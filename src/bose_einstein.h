@@ -0,0 +1,33 @@
+/* bose_einstein.h
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef BOSE_EINSTEIN_H
+#define BOSE_EINSTEIN_H
+
+extern
+double bose_einstein_tail     (unsigned int order,
+                               double       x);
+
+extern
+double bose_einstein_integral (unsigned int order,
+                               double       x_lo,
+                               double       x_hi);
+
+#endif  /* BOSE_EINSTEIN_H */
@@ -0,0 +1,667 @@
+/* csv_mmap.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* A reader for numeric CSV files that scans the mapped file in place instead of pushing it
+ * through libcsv: numbers are converted straight from the mapping by sl_strtod () into
+ * column arrays sized from a newline count, so no cell is copied or reallocated.
+ * It accepts what read_csv () does with CSV_STRICT: quoted fields, LF, CRLF or CR line
+ * ends, blank-padded cells and empty lines, and an empty cell reads as 0.
+ * Large files are split at line ends outside quotes into chunks, which threads parse into
+ * their own row ranges of the same columns. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "data_io.h"
+#include "sl_strtod.h"
+#include "sl_pool.h"
+
+#define CSV_MMAP_RELEASE_SIZE  (4 << 20)   /* bytes */
+#define CSV_MMAP_PARALLEL_SIZE (16 << 20)  /* bytes of records, below which one thread parses */
+#define CSV_MMAP_CHUNK_SIZE    (4 << 20)   /* bytes, the least a chunk gets */
+#define CSV_MMAP_CHUNKS        4           /* per worker, to even out chunks of unequal cost */
+
+struct csv_cursor
+{
+  const char *begin;  // of the file, for error messages
+  const char *p;
+  const char *end;
+};
+
+static bool
+csv_is_blank (char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+static unsigned long
+csv_cursor_line (const struct csv_cursor *c,
+                 const char              *at)
+{
+  unsigned long line = 1;
+  for (const char *p = c->begin; p < at; p++)
+    line += *p == '\n';
+  return line;
+}
+
+static void
+csv_skip_empty_lines (struct csv_cursor *c)
+{
+  while (c->p < c->end && (*c->p == '\n' || *c->p == '\r'))
+    c->p++;
+}
+
+/* Consumes the delimiter after a field: returns ',' or '\n' for the end of the record or
+ * of the file, or -1 if anything else follows the field */
+static int
+csv_delimiter (struct csv_cursor *c,
+               const char        *p)
+{
+  while (p < c->end && csv_is_blank (*p))
+    p++;
+  if (p >= c->end)
+    {
+      c->p = c->end;
+      return '\n';
+    }
+  switch (*p)
+    {
+    case ',':
+      c->p = p + 1;
+      return ',';
+    case '\r':
+      c->p = p + 1 < c->end && p[1] == '\n' ? p + 2 : p + 1;
+      return '\n';
+    case '\n':
+      c->p = p + 1;
+      return '\n';
+    default:
+      c->p = p;
+      return -1;
+    }
+}
+
+/* The next field as [*begin, *end), without its quotes; "" inside quotes stays doubled */
+static int
+csv_field (struct csv_cursor  *c,
+           const char        **begin,
+           const char        **end)
+{
+  const char *p = c->p;
+  while (p < c->end && csv_is_blank (*p))
+    p++;
+  if (p < c->end && *p == '"')
+    {
+      const char *q = ++p;
+      for (;;)
+        {
+          q = (const char *)memchr (q, '"', c->end - q);
+          if (!q)
+            {
+              fprintf (stderr, "ERROR: Unterminated quoted field from line %lu.\n", csv_cursor_line (c, p));
+              return -1;
+            }
+          if (q + 1 < c->end && q[1] == '"')
+            {
+              q += 2;
+              continue;
+            }
+          break;
+        }
+      *begin = p;
+      *end = q;
+      return csv_delimiter (c, q + 1);
+    }
+
+  *begin = p;
+  while (p < c->end && *p != ',' && *p != '\n' && *p != '\r')
+    p++;
+  *end = p;
+  while (*end > *begin && csv_is_blank ((*end)[-1]))
+    (*end)--;
+  return csv_delimiter (c, p);
+}
+
+/* The next field as a number, converted in place unless it is quoted */
+static int
+csv_number (struct csv_cursor *c,
+            double            *value)
+{
+  const char *begin = c->p, *end;
+  while (begin < c->end && csv_is_blank (*begin))
+    begin++;
+  if (begin < c->end && *begin == '"')
+    {
+      int delimiter = csv_field (c, &begin, &end);
+      if (delimiter < 0)
+        return delimiter;
+      *value = begin == end ? 0 : sl_strtod (begin, end, &begin);
+      if (begin != end)
+        {
+          fprintf (stderr, "ERROR: Found non-double data on line %lu of the csv file.\n", csv_cursor_line (c, begin));
+          return -1;
+        }
+      return delimiter;
+    }
+
+  if (begin == c->end || *begin == ',' || *begin == '\n' || *begin == '\r')
+    {
+      *value = 0;
+      return csv_delimiter (c, begin);
+    }
+  *value = sl_strtod (begin, c->end, &end);
+  int delimiter = csv_delimiter (c, end);
+  if (delimiter < 0 || end == begin)
+    {
+      fprintf (stderr, "ERROR: Found non-double data on line %lu of the csv file.\n", csv_cursor_line (c, begin));
+      return -1;
+    }
+  return delimiter;
+}
+
+/* The header record as NUL-terminated, unquoted strings */
+static char **
+csv_header (struct csv_cursor *c,
+            unsigned int      *num_fields)
+{
+  char **fields = NULL;
+  unsigned int size = 0, buffer_size = 0;
+  int delimiter;
+  do
+    {
+      const char *begin, *end;
+      delimiter = csv_field (c, &begin, &end);
+      if (delimiter < 0)
+        break;
+      if (size == buffer_size)
+        {
+          buffer_size = buffer_size ? 2 * buffer_size : 16;
+          char **grown = (char **)realloc (fields, buffer_size * sizeof (char *));
+          if (!grown)
+            {
+              delimiter = -1;
+              break;
+            }
+          fields = grown;
+        }
+      char *field = (char *)malloc (end - begin + 1), *q = field;
+      if (!field)
+        {
+          delimiter = -1;
+          break;
+        }
+      for (const char *p = begin; p < end; p++)
+        {
+          *q++ = *p;
+          if (*p == '"' && p + 1 < end && p[1] == '"')
+            p++;
+        }
+      *q = '\0';
+      fields[size++] = field;
+    } while (delimiter == ',');
+
+  if (delimiter < 0)
+    {
+      for (unsigned int i = 0; i < size; i++)
+        free (fields[i]);
+      free (fields);
+      return NULL;
+    }
+  *num_fields = size;
+  return fields;
+}
+
+/* Drops the pages of [*released, p) from the resident set; they stay in the page cache,
+ * so touching them again only costs a minor fault */
+static void
+csv_release (const char **released,
+             const char  *p)
+{
+  if ((size_t)(p - *released) < CSV_MMAP_RELEASE_SIZE)
+    return;
+  const size_t page_size = sysconf (_SC_PAGESIZE);
+  const size_t length = (p - *released) / page_size * page_size;
+  madvise ((void *)*released, length, MADV_DONTNEED);
+  *released += length;
+}
+
+static size_t
+csv_count_char (const char *p,
+                const char *end,
+                char        c)
+{
+  size_t n = 0;
+  for (; (p = (const char *)memchr (p, c, end - p)); p++)
+    n++;
+  return n;
+}
+
+/* Drops the whole pages inside [begin, end) */
+static void
+csv_drop_pages (const char *mapping,
+                const char *begin,
+                const char *end)
+{
+  const size_t page_size = sysconf (_SC_PAGESIZE);
+  const size_t first = (begin - mapping + page_size - 1) / page_size * page_size;
+  const size_t last = (end - mapping) / page_size * page_size;
+  if (last > first)
+    madvise ((void *)(mapping + first), last - first, MADV_DONTNEED);
+}
+
+/* Line ends in [p, end): every LF, and every CR that no LF follows, so that CR line ends
+ * count in an LF file as well; file_end bounds the look-ahead past end */
+static size_t
+csv_count_line_ends (const char *p,
+                     const char *end,
+                     const char *file_end)
+{
+  size_t n = csv_count_char (p, end, '\n');
+  for (const char *q = p; (q = (const char *)memchr (q, '\r', end - q)); q++)
+    n += q + 1 == file_end || q[1] != '\n';
+  return n;
+}
+
+/* Upper bound of the records left, from the line ends */
+static size_t
+csv_count_lines (const char *mapping,
+                 const char *p,
+                 const char *end)
+{
+  size_t n = 0;
+  for (const char *block = p; block < end; block += CSV_MMAP_RELEASE_SIZE)
+    {
+      const char *block_end = end - block > CSV_MMAP_RELEASE_SIZE ? block + CSV_MMAP_RELEASE_SIZE : end;
+      n += csv_count_line_ends (block, block_end, end);
+      csv_drop_pages (mapping, block, block_end);
+    }
+  madvise ((void *)mapping, end - mapping, MADV_DONTNEED);
+  return n + 1;
+}
+
+/* Number of fields of the record at the cursor, which stays where it is */
+static int
+csv_count_fields (struct csv_cursor  c,
+                  unsigned int      *num_fields)
+{
+  unsigned int n = 0;
+  int delimiter;
+  do
+    {
+      const char *begin, *end;
+      delimiter = csv_field (&c, &begin, &end);
+      if (delimiter < 0)
+        return -1;
+      n++;
+    } while (delimiter == ',');
+  *num_fields = n;
+  return 0;
+}
+
+/* Parses the records from the cursor to its end into rows [first_row, first_row + capacity)
+ * of the kept columns, dropping the pages behind it; every record must have num_fields fields */
+static int
+csv_parse_records (struct csv_cursor  *c,
+                   double            **columns,
+                   unsigned int        num_kept,
+                   unsigned int        num_fields,
+                   size_t              first_row,
+                   size_t              capacity,
+                   size_t             *num_rows)
+{
+  const size_t page_size = sysconf (_SC_PAGESIZE);
+  const char *released = c->begin + (c->p - c->begin) / page_size * page_size;
+  size_t row = 0;
+
+  csv_skip_empty_lines (c);
+  while (c->p < c->end)
+    {
+      const char *record = c->p;
+      unsigned int col = 0;
+      int delimiter;
+      if (row == capacity)
+        {
+          fprintf (stderr, "ERROR: More records than lines from line %lu.\n", csv_cursor_line (c, record));
+          return -1;
+        }
+      do
+        {
+          double value;
+          delimiter = csv_number (c, &value);
+          if (delimiter < 0)
+            return -1;
+          if (col < num_kept)
+            columns[col][first_row + row] = value;
+          col++;
+        } while (delimiter == ',');
+      if (col != num_fields)
+        {
+          fprintf (stderr, "ERROR: Did not find data for all fields on line %lu.\n", csv_cursor_line (c, record));
+          return -1;
+        }
+      row++;
+      csv_skip_empty_lines (c);
+      csv_release (&released, c->p);
+    }
+  *num_rows = row;
+  return 0;
+}
+
+static int
+csv_columns_alloc (struct csv_columns *table,
+                   size_t              capacity)
+{
+  for (unsigned int i = 0; i < table->num_kept; i++)
+    {
+      table->columns[i] = (double *)malloc (capacity * sizeof (double));
+      if (!table->columns[i])
+        return -1;
+    }
+  return 0;
+}
+
+/* Counts the line ends, sizes the columns and parses on this thread */
+static int
+csv_parse_serial (struct csv_cursor  *c,
+                  struct csv_columns *table)
+{
+  /* Pages are dropped behind the count and the parser, so that the mapping does not add the
+   * size of the file to the resident set on top of the arrays */
+  const size_t capacity = csv_count_lines (c->begin, c->p, c->end);
+  if (csv_columns_alloc (table, capacity))
+    return -1;
+  return csv_parse_records (c, table->columns, table->num_kept, table->num_fields, 0, capacity, &table->num_rows);
+}
+
+struct csv_chunk
+{
+  const char *begin;
+  const char *end;
+  size_t      num_quotes;
+  size_t      num_lines;    // line ends, which every record but the last of the file ends with
+  size_t      first_row;
+  size_t      capacity;
+  size_t      num_rows;
+  int         status;
+};
+
+struct csv_parallel
+{
+  const char        *mapping;
+  const char        *end;
+  struct csv_chunk  *chunks;
+  double           **columns;
+  unsigned int       num_kept;
+  unsigned int       num_fields;
+};
+
+static void
+csv_count_chunks (size_t        begin,
+                  size_t        end,
+                  unsigned int  worker,
+                  void         *user_data)
+{
+  struct csv_parallel *parallel = (struct csv_parallel *)user_data;
+  for (size_t k = begin; k < end; k++)
+    {
+      struct csv_chunk *chunk = &parallel->chunks[k];
+      for (const char *block = chunk->begin; block < chunk->end; block += CSV_MMAP_RELEASE_SIZE)
+        {
+          const char *block_end = chunk->end - block > CSV_MMAP_RELEASE_SIZE ? block + CSV_MMAP_RELEASE_SIZE : chunk->end;
+          chunk->num_quotes += csv_count_char (block, block_end, '"');
+          chunk->num_lines += csv_count_line_ends (block, block_end, parallel->end);
+          csv_drop_pages (parallel->mapping, block, block_end);
+        }
+    }
+}
+
+static void
+csv_parse_chunks (size_t        begin,
+                  size_t        end,
+                  unsigned int  worker,
+                  void         *user_data)
+{
+  struct csv_parallel *parallel = (struct csv_parallel *)user_data;
+  for (size_t k = begin; k < end; k++)
+    {
+      struct csv_chunk *chunk = &parallel->chunks[k];
+      struct csv_cursor c = { parallel->mapping, chunk->begin, chunk->end };
+      chunk->status = csv_parse_records (&c, parallel->columns, parallel->num_kept, parallel->num_fields,
+                                         chunk->first_row, chunk->capacity, &chunk->num_rows);
+      /* csv_parse_records () leaves up to CSV_MMAP_RELEASE_SIZE behind it, for each chunk */
+      csv_drop_pages (parallel->mapping, chunk->begin, chunk->end);
+    }
+}
+
+/* The first LF outside quotes in [p, end) given the quote parity at p, or NULL; the line
+ * ends it passes are added to num_lines as csv_count_line_ends () counts them. Doubled
+ * quotes inside a quoted field flip the parity twice. */
+static const char *
+csv_find_split (const char *p,
+                const char *end,
+                const char *file_end,
+                bool        quoted,
+                size_t     *num_lines)
+{
+  for (; p < end; p++)
+    if (*p == '"')
+      quoted = !quoted;
+    else if (*p == '\r')
+      *num_lines += p + 1 == file_end || p[1] != '\n';
+    else if (*p == '\n')
+      {
+        ++*num_lines;
+        if (!quoted)
+          return p + 1;
+      }
+  return NULL;
+}
+
+/* Parses the records from the cursor on n_workers threads. The records are cut into equal
+ * chunks, whose quotes and line ends are counted in parallel; every cut then moves on to the
+ * first LF outside quotes, as the quote count before it tells, so that a quoted line end or
+ * the CR of a CRLF never splits a record. The line ends before each chunk give its row
+ * range, which its thread fills; rows a range does not use, for empty lines or line ends
+ * inside quotes, are closed up in order afterwards. Returns 1 before parsing anything if
+ * the records do not split, as for CR line ends only. */
+static int
+csv_parse_parallel (struct csv_cursor  *c,
+                    struct csv_columns *table,
+                    unsigned int        n_workers)
+{
+  const size_t size = c->end - c->p;
+  size_t n_chunks = size / CSV_MMAP_CHUNK_SIZE;
+  if (n_chunks > CSV_MMAP_CHUNKS * n_workers)
+    n_chunks = CSV_MMAP_CHUNKS * n_workers;
+  if (n_chunks < 2)
+    return 1;
+  struct csv_chunk *chunks = (struct csv_chunk *)calloc (n_chunks, sizeof (struct csv_chunk));
+  if (!chunks)
+    return 1;
+  for (size_t k = 0; k < n_chunks; k++)
+    {
+      chunks[k].begin = c->p + size / n_chunks * k;
+      chunks[k].end = k + 1 < n_chunks ? c->p + size / n_chunks * (k + 1) : c->end;
+    }
+  struct csv_parallel parallel = { c->begin, c->end, chunks, table->columns, table->num_kept, table->num_fields };
+  sl_parallel_for (n_chunks, 1, n_workers, csv_count_chunks, &parallel);
+
+  /* Cuts without a line end outside quotes up to the next cut are dropped, merging chunks */
+  size_t quotes = chunks[0].num_quotes, lines = chunks[0].num_lines, n_splits = 1;
+  for (size_t k = 1; k < n_chunks; k++)
+    {
+      size_t lines_before = lines;
+      const char *split = csv_find_split (chunks[k].begin, chunks[k].end, c->end, quotes % 2, &lines_before);
+      quotes += chunks[k].num_quotes;
+      if (split)
+        {
+          /* The previous chunk now takes the line ends this one skipped */
+          chunks[n_splits - 1].end = split;
+          chunks[n_splits - 1].capacity = lines_before - chunks[n_splits - 1].first_row;
+          chunks[n_splits].begin = split;
+          chunks[n_splits].first_row = lines_before;
+          n_splits++;
+        }
+      lines += chunks[k].num_lines;
+    }
+  chunks[n_splits - 1].end = c->end;
+  chunks[n_splits - 1].capacity = lines + 1 - chunks[n_splits - 1].first_row;  // the last record may lack its LF
+  if (n_splits < 2 || csv_columns_alloc (table, lines + 1))
+    {
+      free (chunks);
+      return n_splits < 2 ? 1 : -1;
+    }
+
+  sl_parallel_for (n_splits, 1, n_workers, csv_parse_chunks, &parallel);
+  int status = 0;
+  size_t num_rows = 0;
+  for (size_t k = 0; !status && k < n_splits; k++)
+    {
+      status = chunks[k].status;
+      if (!status && chunks[k].first_row != num_rows)
+        for (unsigned int i = 0; i < table->num_kept; i++)
+          memmove (table->columns[i] + num_rows, table->columns[i] + chunks[k].first_row,
+                   chunks[k].num_rows * sizeof (double));
+      num_rows += chunks[k].num_rows;
+    }
+  table->num_rows = num_rows;
+  free (chunks);
+  return status;
+}
+
+void
+csv_columns_clear (struct csv_columns *table)
+{
+  for (unsigned int i = 0; table->fields && i < table->num_fields; i++)
+    free (table->fields[i]);
+  for (unsigned int i = 0; table->columns && i < table->num_kept; i++)
+    free (table->columns[i]);
+  free (table->fields);
+  free (table->columns);
+  *table = (struct csv_columns) {0};
+}
+
+/* Reads a numeric CSV file like read_csv (fp, with_header, VERTICAL, 1), but keeps the first
+ * max_columns columns, or all of them when it is 0; the others are checked but not kept.
+ * Files of more than CSV_MMAP_PARALLEL_SIZE are parsed on n_threads threads, 0 for one per
+ * CPU. Returns 0, or -1 after printing why. */
+int
+read_csv_columns (const char         *path,
+                  bool                with_header,
+                  unsigned int        max_columns,
+                  unsigned int        n_threads,
+                  struct csv_columns *table)
+{
+  struct stat st;
+  int status = 0;
+  *table = (struct csv_columns) {0};
+  int fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      fprintf (stderr, "ERROR: Failed to open %s.\n", path);
+      return -1;
+    }
+  if (fstat (fd, &st) || st.st_size == 0)
+    {
+      fprintf (stderr, "ERROR: %s is empty or cannot be read.\n", path);
+      close (fd);
+      return -1;
+    }
+  void *mapping = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (mapping == MAP_FAILED)
+    {
+      fprintf (stderr, "ERROR: Failed to map %s.\n", path);
+      return -1;
+    }
+  madvise (mapping, st.st_size, MADV_SEQUENTIAL);
+
+  struct csv_cursor c = { (const char *)mapping, (const char *)mapping, (const char *)mapping + st.st_size };
+  /* strtod () would stop at a UTF-8 byte order mark, see cb1_double_double () */
+  if (c.end - c.p >= 3 && !memcmp (c.p, "\xEF\xBB\xBF", 3))
+    c.p += 3;
+  csv_skip_empty_lines (&c);
+
+  if (with_header)
+    {
+      table->fields = csv_header (&c, &table->num_fields);
+      if (!table->fields)
+        {
+          fprintf (stderr, "ERROR: Failed to read csv fields.\n");
+          status = -1;
+        }
+      csv_skip_empty_lines (&c);
+    }
+  else if (c.p < c.end)
+    status = csv_count_fields (c, &table->num_fields);
+
+  table->num_kept = max_columns && max_columns < table->num_fields ? max_columns : table->num_fields;
+  table->columns = (double **)calloc (table->num_kept ? table->num_kept : 1, sizeof (double *));
+  if (!table->columns)
+    status = -1;
+  const unsigned int n_workers = sl_pool_resolve_workers (n_threads);
+  if (!status)
+    {
+      status = n_workers > 1 && c.end - c.p >= CSV_MMAP_PARALLEL_SIZE ? csv_parse_parallel (&c, table, n_workers) : 1;
+      if (status == 1)
+        status = csv_parse_serial (&c, table);
+    }
+  munmap (mapping, st.st_size);
+
+  if (status)
+    {
+      fprintf (stderr, "ERROR: Failed to read %s.\n", path);
+      csv_columns_clear (table);
+    }
+  return status;
+}
+
+/* The first column goes to wavelengths and the second to intensities */
+struct csv_data *
+read_csv_mmap (const char *path,
+               bool        with_header)
+{
+  struct csv_columns table;
+  if (read_csv_columns (path, with_header, 2, 0, &table))
+    return NULL;
+  if (table.num_fields < 2)
+    {
+      fprintf (stderr, "ERROR: A spectrum needs at least 2 columns, got %u.\n", table.num_fields);
+      csv_columns_clear (&table);
+      return NULL;
+    }
+  struct csv_data *spectrum = (struct csv_data *)calloc (1, sizeof (struct csv_data));
+  if (!spectrum)
+    {
+      csv_columns_clear (&table);
+      return NULL;
+    }
+  spectrum->fields = table.fields;
+  spectrum->wavelengths = table.columns[0];
+  spectrum->intensities = table.columns[1];
+  spectrum->num_fields = table.num_fields;
+  spectrum->num_datarows = table.num_rows;
+  free (table.columns);
+  return spectrum;
+}
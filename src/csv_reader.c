@@ -20,10 +20,12 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <csv.h>
 
 #include "utils.h"
 #include "data_io.h"
+#include "sl_strtod.h"
 
 struct csv_count
 {
@@ -52,16 +54,38 @@ struct csv_body_uint_double
   bool          buf_reallocated;
 };
 
+/* For dim 1 the cells go straight into the two series of the spectrum, wavelengths and
+ * intensities, which are the first two columns (vertical) or rows (horizontal); further ones
+ * are only checked. For dim 2 they are appended to data in row-major order. */
 struct csv_body_double_double
 {
-  double       *data;
+  double        *data;
+  char         **fields;       // header cells of dim 1
+  double        *series[2];
+  unsigned int   series_size[2];
+  unsigned int   size;
+  unsigned int   buffer_size;
+  unsigned int   num_rows;
+  unsigned int   curr_num_cols;
+  unsigned int   num_cols;
+  unsigned int   dim;
+  bool           axis;
+  bool           error;
+  bool           with_header;
+};
+
+/* One row at a time for read_csv_rows (); the buffer only grows to the widest row */
+struct csv_row_stream
+{
+  double       *values;
   unsigned int  size;
   unsigned int  buffer_size;
   unsigned int  num_rows;
-  unsigned int  curr_num_cols;
-  unsigned int  num_cols;
+  unsigned int  num_cols;  // of the first row
+  csv_row_func  func;
+  void         *user_data;
   bool          error;
-  bool          with_header;
+  bool          stopped;
 };
 
 typedef void (*CB1_UINT_DOUBLE)(void *, size_t, struct csv_body_uint_double *);
@@ -250,31 +274,69 @@ cb1_uint_double (void   *s,
     }
 }
 
+static void
+body_add_field (struct csv_body_double_double *body,
+                const char                    *s)
+{
+  if (body->curr_num_cols > body->buffer_size)
+    {
+      body->buffer_size = body->buffer_size ? 2 * body->buffer_size : 16;
+      char **fields = (char **)realloc (body->fields, sizeof (char *) * body->buffer_size);
+      if (!fields)
+        {
+          body->error = true;
+          return;
+        }
+      body->fields = fields;
+    }
+  body->fields[body->curr_num_cols - 1] = strdup (s ? s : "");
+}
+
+static void
+body_store (struct csv_body_double_double *body,
+            unsigned int                   series,
+            unsigned int                   index,
+            double                         value)
+{
+  if (series >= 2)
+    return;
+  if (index >= body->series_size[series])
+    {
+      unsigned int size = body->series_size[series] ? 2 * body->series_size[series] : 1024;
+      double *values = (double *)realloc (body->series[series], sizeof (double) * size);
+      if (!values)
+        {
+          body->error = true;
+          return;
+        }
+      body->series[series] = values;
+      body->series_size[series] = size;
+    }
+  body->series[series][index] = value;
+}
+
 void
 cb1_double_double (void   *s,
                    size_t  len,
                    void   *data)
 {
   struct csv_body_double_double *body = (struct csv_body_double_double *)data;
-  char *endptr = NULL;
+  const char *endptr;
   if (body->error)
     return;
+  body->curr_num_cols++;
   // When scanning the first row, determine the number of columns
   if (!body->num_rows)
     {
-      body->curr_num_cols++;
       body->num_cols++;
       /* If the table has a header, then skip the header row;
        * otherwise, continue to read in the first row as the wavelength row. */
       if (body->with_header)
-        return;
-    }
-  if (body->size + 1 >= body->buffer_size)
-    {
-      body->buffer_size = body->data ? 2 * body->buffer_size : body->num_cols * 1024;
-      body->buffer_size = body->buffer_size > 0 ? body->buffer_size : 1024;
-      body->data = body->data ? (double *)realloc (body->data, sizeof (double) * body->buffer_size)
-                              : (double *)calloc (body->buffer_size, sizeof (double));
+        {
+          if (body->dim == 1)
+            body_add_field (body, (const char *)s);
+          return;
+        }
     }
   /* strtod () cannot properly convert strings with UTF-8 BOM to double, *endptr = -17 '\357'
    * It is difficult to guess file encoding when opening the file
@@ -282,19 +344,42 @@ cb1_double_double (void   *s,
    * Use g_strtod() instead of g_ascii_strtod() to convert UTF-8 string to double
    * The UTF-8 byte order mark (BOM) is -17 '\357', -69 '\273', -65 '\277' */
   const char *str = s;
-  if (str[0] == '\xEF' && str[1] == '\xBB' && str[2] == '\xBF')
+  if (len >= 3 && str[0] == '\xEF' && str[1] == '\xBB' && str[2] == '\xBF')
     {
       // memmove(str, str + 3, strlen(str) - 2);
       fprintf (stderr, "ERROR: Found UTF-8 encoded string.\n");
       body->error = true;
       return;
     }
-  body->data[body->size++] = s ? strtod (str, &endptr) : 0;
-  if (*endptr)
+  const double value = len ? sl_strtod (str, str + len, &endptr) : 0;
+  if (len && endptr != str + len)
     {
       fprintf (stderr, "ERROR: Found non-double data in the csv result-file: %s\n", str);
       body->error = true;
+      return;
     }
+  if (body->dim == 1)
+    {
+      const unsigned int row = body->num_rows - body->with_header, col = body->curr_num_cols - 1;
+      if (body->axis == VERTICAL)
+        body_store (body, col, row, value);
+      else
+        body_store (body, row, col, value);
+      return;
+    }
+  if (body->size + 1 >= body->buffer_size)
+    {
+      body->buffer_size = body->data ? 2 * body->buffer_size : body->num_cols * 1024;
+      body->buffer_size = body->buffer_size > 0 ? body->buffer_size : 1024;
+      double *values = (double *)realloc (body->data, sizeof (double) * body->buffer_size);
+      if (!values)
+        {
+          body->error = true;
+          return;
+        }
+      body->data = values;
+    }
+  body->data[body->size++] = value;
 }
 
 /* add rows */
@@ -322,8 +407,37 @@ cb2_double_double (int   c,
       fprintf(stderr, "ERROR: Did not find data for all fields for row: %d\n", body->num_rows);
       body->error = true;
     }
+  body->curr_num_cols = 0;
+}
+
+static void
+csv_body_free (struct csv_body_double_double *body)
+{
+  for (unsigned int i = 0; body->fields && i < body->num_cols; i++)
+    free (body->fields[i]);
+  free (body->fields);
+  free (body->series[0]);
+  free (body->series[1]);
+  free (body->data);
 }
 
+/* Trims a series to its length, or gives a zero one if the file had no such column */
+static double *
+csv_body_take_series (struct csv_body_double_double *body,
+                      unsigned int                   series,
+                      unsigned int                   length)
+{
+  double *values = body->series[series];
+  body->series[series] = NULL;
+  if (!values)
+    return (double *)calloc (length ? length : 1, sizeof (double));
+  double *trimmed = (double *)realloc (values, sizeof (double) * (length ? length : 1));
+  return trimmed ? trimmed : values;
+}
+
+/* Reads the whole file in one pass: the header row of dim 1 becomes the fields, and the
+ * cells of dim 1 are stored by series as they are parsed, so nothing is re-read, transposed
+ * or copied afterwards. fp need not be seekable. */
 void *
 read_csv (FILE         *fp,
           bool          with_header,
@@ -332,22 +446,18 @@ read_csv (FILE         *fp,
 {
   const unsigned int buf_size = 4096;
   char buf[4096];
-  char **fields;
-  int dummy;
   void *result;
   size_t bytes_read;
   struct csv_parser p;
   struct csv_body_double_double body = {0};
   body.with_header = with_header;
+  body.axis = axis;
+  body.dim = dim;
 
-  if (with_header && dim == 1)
+  if (dim != 1 && dim != 2)
     {
-      fields = read_csv_fields (fp, &dummy);
-      if (!fields)
-        {
-          fprintf (stderr, "ERROR: Failed to read csv fields.\n");
-          return NULL;
-        }
+      fprintf (stderr, "Dimension is not 1 or 2.\n");
+      return NULL;
     }
 
   /* CSV_EMPTY_IS_NULL will cause NULL to be passed as the first argument to cb1 for empty, unquoted, fields.
@@ -362,7 +472,6 @@ read_csv (FILE         *fp,
       fprintf (stderr, "ERROR: csv_init() in read_csv() failed.\n");
       return NULL;
     }
-  rewind (fp);  // equivalent to fseek (fp, 0, SEEK_SET);
 
   csv_set_realloc_func (&p, realloc);
   csv_set_free_func (&p, free);
@@ -371,61 +480,59 @@ read_csv (FILE         *fp,
       bytes_read = sl_fread (buf, 1, buf_size, fp, true);
       if (bytes_read != buf_size && !feof (fp))
         {
-          csv_free (&p);
-          return NULL;
+          body.error = true;
+          break;
         }
       if (csv_parse_generic (&p, buf, bytes_read, &body) != bytes_read)
         {
           fprintf (stderr, "ERROR: failed to parse file: %s\n", csv_strerror (csv_error (&p)));
-          return NULL;
+          body.error = true;
+          break;
         }
     } while (!body.error && !feof (fp));
 
-  csv_fini_generic (&p, &body);
+  if (!body.error)
+    csv_fini_generic (&p, &body);
   csv_free (&p);
   if (body.error)
     {
       fprintf (stderr, "ERROR: csv_body error\n");
+      csv_body_free (&body);
       return NULL;
     }
   if (dim == 1)
     {
-      result = (struct csv_data *)malloc (sizeof (struct csv_data));
-    }
-  else if (dim == 2)
-    {
-      result = (struct csv_data_2d *)malloc (sizeof (struct csv_data_2d));
+      result = (struct csv_data *)calloc (1, sizeof (struct csv_data));
     }
   else
     {
-      fprintf (stderr, "Dimension is not 1 or 2.\n");
-      return NULL;
+      result = (struct csv_data_2d *)calloc (1, sizeof (struct csv_data_2d));
     }
   if (!result)
     {
       fprintf (stderr, "ERROR: malloc csv_data failed.\n");
+      csv_body_free (&body);
       return NULL;
     }
   double *data = body.data;
   if (dim == 1)
     {
       struct csv_data *data_1d = (struct csv_data *)result;
-      if (with_header)
+      const unsigned int num_series = body.num_rows - with_header;
+      data_1d->fields = body.fields;
+      body.fields = NULL;
+      if (axis == VERTICAL)  // vertical
         {
-          data_1d->fields = fields;
+          data_1d->num_fields = body.num_cols;
+          data_1d->num_datarows = num_series;
         }
-      data_1d->num_fields = body.num_cols;
-      data_1d->num_datarows = body.size / body.num_cols;
-      if (axis == VERTICAL)  // vertical
+      else
         {
-          matrix_transpose (data, data_1d->num_fields, data_1d->num_datarows);
-          // https://stackoverflow.com/questions/5850000/how-to-split-array-into-two-arrays-in-c
-          // Use calloc() to initialize all bytes in the allocated storage to zero
-          data_1d->wavelengths = (double *)calloc (body.buffer_size, sizeof (double));
-          data_1d->intensities = (double *)calloc (body.buffer_size, sizeof (double));
-          memcpy (data_1d->wavelengths, data, data_1d->num_datarows * sizeof (double));
-          memcpy (data_1d->intensities, data + data_1d->num_datarows, data_1d->num_datarows * sizeof (double));
+          data_1d->num_fields = num_series;
+          data_1d->num_datarows = body.num_cols;
         }
+      data_1d->wavelengths = csv_body_take_series (&body, 0, data_1d->num_datarows);
+      data_1d->intensities = csv_body_take_series (&body, 1, data_1d->num_datarows);
     }
   else if (dim == 2)
     {
@@ -443,7 +550,295 @@ read_csv (FILE         *fp,
               memcpy (data_2d->intensities[i], data + (i + 1) * data_2d->num_fields, data_2d->num_fields * sizeof (double));
             }
         }
+      free (data);
     }
   return result;
 }
 
+static void
+row_stream_cell (void   *s,
+                 size_t  len,
+                 void   *data)
+{
+  struct csv_row_stream *stream = (struct csv_row_stream *)data;
+  const char *endptr = NULL;
+  if (stream->error || stream->stopped)
+    return;
+  if (stream->size == stream->buffer_size)
+    {
+      stream->buffer_size = stream->buffer_size ? 2 * stream->buffer_size : 1024;
+      double *values = (double *)realloc (stream->values, sizeof (double) * stream->buffer_size);
+      if (!values)
+        {
+          stream->error = true;
+          return;
+        }
+      stream->values = values;
+    }
+  /* Locale-independent like read_csv (), and an empty cell is not a number */
+  const char *str = (const char *)s;
+  if (!str || !len)
+    {
+      fprintf (stderr, "ERROR: Found an empty field in row %u of the csv file.\n", stream->num_rows);
+      stream->error = true;
+      return;
+    }
+  stream->values[stream->size++] = sl_strtod (str, str + len, &endptr);
+  if (endptr != str + len)
+    {
+      fprintf (stderr, "ERROR: Found non-double data in row %u of the csv file: %s\n", stream->num_rows, str);
+      stream->error = true;
+    }
+}
+
+static void
+row_stream_row (int   c,
+                void *data)
+{
+  struct csv_row_stream *stream = (struct csv_row_stream *)data;
+  if (stream->error || stream->stopped)
+    return;
+  if (!stream->num_rows)
+    stream->num_cols = stream->size;
+  else if (stream->size != stream->num_cols)
+    {
+      fprintf (stderr, "ERROR: Row %u has %u fields, the first row has %u.\n", stream->num_rows, stream->size, stream->num_cols);
+      stream->error = true;
+      return;
+    }
+  if (stream->func (stream->num_rows, stream->values, stream->size, stream->user_data))
+    stream->stopped = true;
+  stream->num_rows++;
+  stream->size = 0;
+}
+
+/* Streams a horizontal CSV file like poly_spectrum.csv without holding more than one row:
+ * func sees the wavelength row as row 0 and then every spectrum. Returns 0 when the whole
+ * file was read, 1 when func stopped it and -1 on a parse or data error. */
+int
+read_csv_rows (FILE         *fp,
+               csv_row_func  func,
+               void         *user_data)
+{
+  const unsigned int buf_size = 4096;
+  char buf[4096];
+  size_t bytes_read;
+  struct csv_parser p;
+  struct csv_row_stream stream = {0};
+  stream.func = func;
+  stream.user_data = user_data;
+
+  if (csv_init (&p, CSV_STRICT | CSV_STRICT_FINI | CSV_APPEND_NULL) != 0)
+    {
+      fprintf (stderr, "ERROR: csv_init() in read_csv_rows() failed.\n");
+      return -1;
+    }
+  csv_set_realloc_func (&p, realloc);
+  csv_set_free_func (&p, free);
+  do
+    {
+      bytes_read = sl_fread (buf, 1, buf_size, fp, true);
+      if (bytes_read != buf_size && !feof (fp))
+        {
+          stream.error = true;
+          break;
+        }
+      if (csv_parse (&p, buf, bytes_read, row_stream_cell, row_stream_row, &stream) != bytes_read)
+        {
+          fprintf (stderr, "ERROR: failed to parse file: %s\n", csv_strerror (csv_error (&p)));
+          stream.error = true;
+          break;
+        }
+    } while (!stream.error && !stream.stopped && !feof (fp));
+
+  if (!stream.error && !stream.stopped)
+    csv_fini (&p, row_stream_cell, row_stream_row, &stream);
+  csv_free (&p);
+  free (stream.values);
+  return stream.error ? -1 : (stream.stopped ? 1 : 0);
+}
+
+/* A parser thread runs read_csv_rows () into a fixed set of row buffers: a buffer is
+ * queued as soon as its row is parsed and comes back to the parser when the consumer
+ * releases it, in any order, so the parser stays at most n_buffers rows ahead. */
+struct csv_row_ring_entry
+{
+  unsigned int buffer;
+  unsigned int row;
+  unsigned int n_values;
+};
+
+struct csv_row_ring
+{
+  FILE                      *fp;
+  pthread_t                  thread;
+  double                   **buffers;
+  unsigned int               n_buffers;
+  unsigned int              *free_buffers;  // stack
+  unsigned int               n_free;
+  struct csv_row_ring_entry *queue;         // FIFO of parsed rows
+  unsigned int               head;
+  unsigned int               n_queued;
+  int                        status;        // of read_csv_rows (), once done
+  bool                       done;
+  bool                       closing;
+
+  pthread_mutex_t            lock;
+  pthread_cond_t             cond;          // any of the above changed
+};
+
+static int
+row_ring_push (unsigned int  row,
+               const double *values,
+               unsigned int  n_values,
+               void         *user_data)
+{
+  struct csv_row_ring *ring = (struct csv_row_ring *)user_data;
+  /* The first row fixes the width of all, as read_csv_rows () checks */
+  if (!row)
+    for (unsigned int i = 0; i < ring->n_buffers; i++)
+      {
+        ring->buffers[i] = (double *)malloc (sizeof (double) * (n_values ? n_values : 1));
+        if (!ring->buffers[i])
+          return 1;
+      }
+
+  pthread_mutex_lock (&ring->lock);
+  while (!ring->n_free && !ring->closing)
+    pthread_cond_wait (&ring->cond, &ring->lock);
+  if (ring->closing)
+    {
+      pthread_mutex_unlock (&ring->lock);
+      return 1;
+    }
+  const unsigned int buffer = ring->free_buffers[--ring->n_free];
+  pthread_mutex_unlock (&ring->lock);
+
+  memcpy (ring->buffers[buffer], values, sizeof (double) * n_values);
+
+  pthread_mutex_lock (&ring->lock);
+  ring->queue[(ring->head + ring->n_queued++) % ring->n_buffers] = (struct csv_row_ring_entry) { buffer, row, n_values };
+  pthread_cond_broadcast (&ring->cond);
+  pthread_mutex_unlock (&ring->lock);
+  return 0;
+}
+
+static void *
+row_ring_parse (void *data)
+{
+  struct csv_row_ring *ring = (struct csv_row_ring *)data;
+  const int status = read_csv_rows (ring->fp, row_ring_push, ring);
+  pthread_mutex_lock (&ring->lock);
+  /* Stopping for lack of memory is an error; stopping because the ring closes is not */
+  ring->status = status == 1 && !ring->closing ? -1 : status;
+  ring->done = true;
+  pthread_cond_broadcast (&ring->cond);
+  pthread_mutex_unlock (&ring->lock);
+  return NULL;
+}
+
+/* Starts streaming the rows of a horizontal CSV file through n_buffers row buffers
+ * (at least 2); returns NULL if the ring cannot be set up. */
+struct csv_row_ring *
+csv_row_ring_new (FILE         *fp,
+                  unsigned int  n_buffers)
+{
+  struct csv_row_ring *ring = (struct csv_row_ring *)calloc (1, sizeof (struct csv_row_ring));
+  if (!ring)
+    return NULL;
+  ring->fp = fp;
+  ring->n_buffers = n_buffers < 2 ? 2 : n_buffers;
+  ring->buffers = (double **)calloc (ring->n_buffers, sizeof (double *));
+  ring->free_buffers = (unsigned int *)calloc (ring->n_buffers, sizeof (unsigned int));
+  ring->queue = (struct csv_row_ring_entry *)calloc (ring->n_buffers, sizeof (struct csv_row_ring_entry));
+  if (!ring->buffers || !ring->free_buffers || !ring->queue)
+    {
+      free (ring->buffers);
+      free (ring->free_buffers);
+      free (ring->queue);
+      free (ring);
+      return NULL;
+    }
+  for (unsigned int i = 0; i < ring->n_buffers; i++)
+    ring->free_buffers[i] = i;
+  ring->n_free = ring->n_buffers;
+  pthread_mutex_init (&ring->lock, NULL);
+  pthread_cond_init (&ring->cond, NULL);
+  if (pthread_create (&ring->thread, NULL, row_ring_parse, ring))
+    {
+      fprintf (stderr, "ERROR: Failed to start the csv parser thread.\n");
+      pthread_mutex_destroy (&ring->lock);
+      pthread_cond_destroy (&ring->cond);
+      free (ring->buffers);
+      free (ring->free_buffers);
+      free (ring->queue);
+      free (ring);
+      return NULL;
+    }
+  return ring;
+}
+
+/* Waits for the next row, the wavelength row first; returns NULL at the end of the file or
+ * on an error. The values stay valid until they are given to csv_row_ring_release (). */
+const double *
+csv_row_ring_next (struct csv_row_ring *ring,
+                   unsigned int        *row,
+                   unsigned int        *n_values)
+{
+  pthread_mutex_lock (&ring->lock);
+  while (!ring->n_queued && !ring->done)
+    pthread_cond_wait (&ring->cond, &ring->lock);
+  if (!ring->n_queued)
+    {
+      pthread_mutex_unlock (&ring->lock);
+      return NULL;
+    }
+  const struct csv_row_ring_entry entry = ring->queue[ring->head];
+  ring->head = (ring->head + 1) % ring->n_buffers;
+  ring->n_queued--;
+  pthread_mutex_unlock (&ring->lock);
+
+  *row = entry.row;
+  *n_values = entry.n_values;
+  return ring->buffers[entry.buffer];
+}
+
+/* Hands a row buffer back to the parser; any thread may release any row */
+void
+csv_row_ring_release (struct csv_row_ring *ring,
+                      const double        *values)
+{
+  unsigned int buffer = 0;
+  while (buffer < ring->n_buffers && ring->buffers[buffer] != values)
+    buffer++;
+  if (buffer == ring->n_buffers)
+    return;
+  pthread_mutex_lock (&ring->lock);
+  ring->free_buffers[ring->n_free++] = buffer;
+  pthread_cond_broadcast (&ring->cond);
+  pthread_mutex_unlock (&ring->lock);
+}
+
+/* Stops the parser if it has not reached the end and frees the ring; rows not yet
+ * released are freed with it. Returns 0 when the whole file was read, 1 when the ring
+ * was closed before that and -1 on a parse or data error, like read_csv_rows (). */
+int
+csv_row_ring_free (struct csv_row_ring *ring)
+{
+  pthread_mutex_lock (&ring->lock);
+  ring->closing = true;
+  pthread_cond_broadcast (&ring->cond);
+  pthread_mutex_unlock (&ring->lock);
+  pthread_join (ring->thread, NULL);
+
+  const int status = ring->status;
+  for (unsigned int i = 0; i < ring->n_buffers; i++)
+    free (ring->buffers[i]);
+  free (ring->buffers);
+  free (ring->free_buffers);
+  free (ring->queue);
+  pthread_mutex_destroy (&ring->lock);
+  pthread_cond_destroy (&ring->cond);
+  free (ring);
+  return status;
+}
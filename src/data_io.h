@@ -20,6 +20,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifndef CSV_READER_H
 #define CSV_READER_H
@@ -74,6 +75,50 @@ struct var_csv_data
     } value;
 };
 
+enum envi_interleave
+{
+  ENVI_BSQ,  // band sequential: one whole image per band
+  ENVI_BIL,  // band interleaved by line
+  ENVI_BIP   // band interleaved by pixel: one whole spectrum per pixel
+};
+
+/* Hyperspectral cube of an ENVI header and its raw data file. The samples stay in the
+ * read-only mapping of the data file and are converted to double a tile at a time. */
+struct envi_cube
+{
+  double               *wavelengths;   /* nm, per band, strictly ascending */
+  const unsigned char  *data;          // first sample, after the header offset
+  void                 *mapping;
+  size_t                mapping_size;
+  size_t                samples;       // pixels per line
+  size_t                lines;
+  size_t                bands;
+  size_t                element_size;  /* bytes */
+  int                   data_type;     // ENVI code: 1, 2, 3, 4, 5, 12, 13, 14 or 15
+  bool                  swap_bytes;    // byte order of the file differs from the host
+  enum envi_interleave  interleave;
+};
+
+/* Called by read_csv_rows () for every row of a horizontal CSV file, the first (wavelength)
+ * row included. values only lives until the callback returns; nonzero stops the stream. */
+typedef int (*csv_row_func) (unsigned int  row,
+                             const double *values,
+                             unsigned int  n_values,
+                             void         *user_data);
+
+/* Every column of a vertical CSV file, or the first num_kept of them */
+struct csv_columns
+{
+  char         **fields;     // num_fields names, NULL without a header
+  double       **columns;    // num_kept arrays of num_rows values
+  unsigned int   num_fields;
+  unsigned int   num_kept;
+  size_t         num_rows;
+};
+
+/* Rows of a horizontal CSV file parsed ahead on a thread of their own, see csv_reader.c */
+struct csv_row_ring;
+
 extern
 char           **read_csv_fields   (FILE *fp,
                                     int  *length);
@@ -102,8 +147,56 @@ void            *read_csv          (FILE         *fp,
                                     bool          axis,
                                     unsigned int  dim);
 
+extern
+int              read_csv_rows     (FILE         *fp,
+                                    csv_row_func  func,
+                                    void         *user_data);
+
+extern
+struct csv_row_ring *csv_row_ring_new     (FILE                *fp,
+                                           unsigned int         n_buffers);
+
+extern
+const double        *csv_row_ring_next    (struct csv_row_ring *ring,
+                                           unsigned int        *row,
+                                           unsigned int        *n_values);
+
+extern
+void                 csv_row_ring_release (struct csv_row_ring *ring,
+                                           const double        *values);
+
+extern
+int                  csv_row_ring_free    (struct csv_row_ring *ring);
+
+extern
+struct csv_data *read_csv_mmap     (const char   *path,
+                                    bool          with_header);
+
+extern
+int              read_csv_columns  (const char         *path,
+                                    bool                with_header,
+                                    unsigned int        max_columns,
+                                    unsigned int        n_threads,
+                                    struct csv_columns *table);
+
+extern
+void             csv_columns_clear (struct csv_columns *table);
+
 extern
 struct csv_data *read_spe          (FILE         *fp);
 
+extern
+struct envi_cube *read_envi        (const char   *hdr_path,
+                                    const char   *data_path);
+
+extern
+void             envi_cube_free    (struct envi_cube *cube);
+
+extern
+void             envi_cube_read    (const struct envi_cube *cube,
+                                    size_t                  first_pixel,
+                                    size_t                  n_pixels,
+                                    double                 *tile);
+
 #endif /* CSV_HEADER_H */
 
@@ -0,0 +1,438 @@
+/* envi_reader.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The ENVI reader is used to read hyperspectral cubes (*.hdr + raw data file)
+ * The header is a text file starting with "ENVI" followed by `key = value' lines;
+ * a value in braces is a comma-separated list and may span several lines.
+ * The data file is headerless binary (apart from `header offset' bytes), with
+ * samples × lines × bands elements in one of the BSQ, BIL or BIP interleaves.
+ * Band values are taken as spectral irradiance in W/(m^2 nm) at `wavelength'. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "data_io.h"
+
+struct envi_header
+{
+  size_t               samples;
+  size_t               lines;
+  size_t               bands;
+  size_t               header_offset;
+  int                  data_type;
+  int                  byte_order;
+  enum envi_interleave interleave;
+  double               wavelength_scale;  // to nm
+  double              *wavelengths;
+  size_t               n_wavelengths;
+};
+
+static char *
+envi_trim (char *s)
+{
+  while (isspace ((unsigned char)*s))
+    s++;
+  char *end = s + strlen (s);
+  while (end > s && isspace ((unsigned char)end[-1]))
+    *--end = '\0';
+  return s;
+}
+
+static double *
+envi_parse_list (const char *value,
+                 size_t     *length)
+{
+  size_t capacity = 256, n = 0;
+  double *list = (double *)malloc (capacity * sizeof (double));
+  const char *p = value;
+  while (list && *p)
+    {
+      char *end;
+      while (*p == '{' || *p == ',' || isspace ((unsigned char)*p))
+        p++;
+      if (!*p || *p == '}')
+        break;
+      const double x = strtod (p, &end);
+      if (end == p)
+        {
+          free (list);
+          return NULL;
+        }
+      if (n == capacity)
+        {
+          capacity *= 2;
+          double *grown = (double *)realloc (list, capacity * sizeof (double));
+          if (!grown)
+            {
+              free (list);
+              return NULL;
+            }
+          list = grown;
+        }
+      list[n++] = x;
+      p = end;
+    }
+  *length = n;
+  return list;
+}
+
+static void
+envi_header_set (struct envi_header *header,
+                 char               *key,
+                 char               *value)
+{
+  for (char *c = key; *c; c++)
+    *c = tolower ((unsigned char)*c);
+  if (!strcmp (key, "samples"))
+    header->samples = strtoul (value, NULL, 10);
+  else if (!strcmp (key, "lines"))
+    header->lines = strtoul (value, NULL, 10);
+  else if (!strcmp (key, "bands"))
+    header->bands = strtoul (value, NULL, 10);
+  else if (!strcmp (key, "header offset"))
+    header->header_offset = strtoul (value, NULL, 10);
+  else if (!strcmp (key, "data type"))
+    header->data_type = atoi (value);
+  else if (!strcmp (key, "byte order"))
+    header->byte_order = atoi (value);
+  else if (!strcmp (key, "interleave"))
+    {
+      if (!strcasecmp (value, "bil"))
+        header->interleave = ENVI_BIL;
+      else if (!strcasecmp (value, "bip"))
+        header->interleave = ENVI_BIP;
+      else
+        header->interleave = ENVI_BSQ;
+    }
+  else if (!strcmp (key, "wavelength units"))
+    {
+      if (!strncasecmp (value, "micro", 5) || !strcasecmp (value, "um") || !strcasecmp (value, "µm"))
+        header->wavelength_scale = 1E3;
+      else if (!strncasecmp (value, "milli", 5) || !strcasecmp (value, "mm"))
+        header->wavelength_scale = 1E6;
+      else
+        header->wavelength_scale = 1;
+    }
+  else if (!strcmp (key, "wavelength"))
+    {
+      free (header->wavelengths);
+      header->n_wavelengths = 0;  // a list that fails to parse leaves none
+      header->wavelengths = envi_parse_list (value, &header->n_wavelengths);
+    }
+}
+
+static int
+envi_parse_header (FILE               *fp,
+                   struct envi_header *header)
+{
+  const size_t MAX_LINE_LEN = 4096;
+  char line[MAX_LINE_LEN];
+  if (!fgets (line, MAX_LINE_LEN, fp) || strncmp (envi_trim (line), "ENVI", 4))
+    return -1;
+
+  size_t capacity = MAX_LINE_LEN;
+  char *entry = (char *)malloc (capacity);
+  if (!entry)
+    return -1;
+  while (fgets (line, MAX_LINE_LEN, fp))
+    {
+      char *eq = strchr (line, '=');
+      if (!eq)
+        continue;
+      *eq = '\0';
+      strcpy (entry, eq + 1);
+      /* A list continues until its closing brace */
+      if (strchr (entry, '{') && !strchr (entry, '}'))
+        {
+          size_t used = strlen (entry);
+          char more[MAX_LINE_LEN];
+          while (fgets (more, MAX_LINE_LEN, fp))
+            {
+              const size_t n = strlen (more);
+              if (used + n + 1 > capacity)
+                {
+                  capacity = 2 * (used + n + 1);
+                  char *grown = (char *)realloc (entry, capacity);
+                  if (!grown)
+                    {
+                      free (entry);
+                      return -1;
+                    }
+                  entry = grown;
+                }
+              memcpy (entry + used, more, n + 1);
+              used += n;
+              if (strchr (more, '}'))
+                break;
+            }
+        }
+      envi_header_set (header, envi_trim (line), envi_trim (entry));
+    }
+  free (entry);
+  return 0;
+}
+
+static size_t
+envi_element_size (int data_type)
+{
+  switch (data_type)
+    {
+    case 1:
+      return 1;
+    case 2:
+    case 12:
+      return 2;
+    case 3:
+    case 4:
+    case 13:
+      return 4;
+    case 5:
+    case 14:
+    case 15:
+      return 8;
+    default:  // complex types are not spectra
+      return 0;
+    }
+}
+
+void
+envi_cube_free (struct envi_cube *cube)
+{
+  if (!cube)
+    return;
+  if (cube->mapping)
+    munmap (cube->mapping, cube->mapping_size);
+  free (cube->wavelengths);
+  free (cube);
+}
+
+/* data_path may be NULL: the data file is then the header path without ".hdr",
+ * or with ".img", ".dat" or ".raw" in its place */
+struct envi_cube *
+read_envi (const char *hdr_path,
+           const char *data_path)
+{
+  struct envi_header header = { .wavelength_scale = 1 };
+  FILE *fp = fopen (hdr_path, "r");
+  if (!fp)
+    {
+      perror (hdr_path);
+      return NULL;
+    }
+  int err = envi_parse_header (fp, &header);
+  fclose (fp);
+  if (err || !header.samples || !header.lines || !header.bands || !envi_element_size (header.data_type))
+    {
+      fprintf (stderr, "ERROR: %s is not a supported ENVI header.\n", hdr_path);
+      free (header.wavelengths);
+      return NULL;
+    }
+  if (header.n_wavelengths != header.bands)
+    {
+      fprintf (stderr, "ERROR: %s has %zu bands but %zu wavelengths.\n", hdr_path, header.bands, header.n_wavelengths);
+      free (header.wavelengths);
+      return NULL;
+    }
+  for (size_t b = 0; b < header.bands; b++)
+    {
+      header.wavelengths[b] *= header.wavelength_scale;
+      if (b && !(header.wavelengths[b] > header.wavelengths[b - 1]))
+        {
+          fprintf (stderr, "ERROR: Wavelengths of %s must be strictly ascending.\n", hdr_path);
+          free (header.wavelengths);
+          return NULL;
+        }
+    }
+
+  int fd = -1;
+  if (data_path)
+    fd = open (data_path, O_RDONLY | O_CLOEXEC);
+  else
+    {
+      const size_t n = strlen (hdr_path);
+      const size_t stem = n > 4 && !strcasecmp (hdr_path + n - 4, ".hdr") ? n - 4 : n;
+      const char *suffixes[] = { "", ".img", ".dat", ".raw" };
+      char *path = (char *)malloc (stem + 5);
+      for (size_t s = 0; path && fd < 0 && s < sizeof (suffixes) / sizeof (suffixes[0]); s++)
+        {
+          memcpy (path, hdr_path, stem);
+          strcpy (path + stem, suffixes[s]);
+          if (strcmp (path, hdr_path))
+            fd = open (path, O_RDONLY | O_CLOEXEC);
+        }
+      free (path);
+    }
+  if (fd < 0)
+    {
+      fprintf (stderr, "ERROR: Failed to open the data file of %s.\n", hdr_path);
+      free (header.wavelengths);
+      return NULL;
+    }
+
+  struct envi_cube *cube = (struct envi_cube *)calloc (1, sizeof (struct envi_cube));
+  struct stat st;
+  const size_t element_size = envi_element_size (header.data_type);
+  size_t data_size, file_size;
+  if (__builtin_mul_overflow (header.samples, header.lines, &data_size)
+      || __builtin_mul_overflow (data_size, header.bands, &data_size)
+      || __builtin_mul_overflow (data_size, element_size, &data_size)
+      || __builtin_add_overflow (header.header_offset, data_size, &file_size))
+    {
+      fprintf (stderr, "ERROR: The dimensions in %s are too large.\n", hdr_path);
+      close (fd);
+      free (cube);
+      free (header.wavelengths);
+      return NULL;
+    }
+  if (!cube || fstat (fd, &st) || (size_t)st.st_size < file_size)
+    {
+      fprintf (stderr, "ERROR: The data file of %s is shorter than its header says.\n", hdr_path);
+      close (fd);
+      free (cube);
+      free (header.wavelengths);
+      return NULL;
+    }
+  cube->mapping_size = st.st_size;
+  cube->mapping = mmap (NULL, cube->mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (cube->mapping == MAP_FAILED)
+    {
+      perror ("mmap");
+      free (cube);
+      free (header.wavelengths);
+      return NULL;
+    }
+  /* A BIP tile is one contiguous run of whole spectra, so the tiles walk through the file
+   * in order even when several run in parallel. A BSQ or BIL tile takes a short run from
+   * every band plane or line, so any readahead past it would load data that later tiles
+   * only need much later; those keep the default advice. */
+  if (header.interleave == ENVI_BIP)
+    madvise (cube->mapping, cube->mapping_size, MADV_SEQUENTIAL);
+
+  cube->wavelengths = header.wavelengths;
+  cube->data = (const unsigned char *)cube->mapping + header.header_offset;
+  cube->samples = header.samples;
+  cube->lines = header.lines;
+  cube->bands = header.bands;
+  cube->element_size = element_size;
+  cube->data_type = header.data_type;
+  cube->interleave = header.interleave;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  cube->swap_bytes = header.byte_order == 0;
+#else
+  cube->swap_bytes = header.byte_order == 1;
+#endif
+  printf ("INFO: Read ENVI cube %s: %zu × %zu pixels, %zu bands.\n", hdr_path, cube->samples, cube->lines, cube->bands);
+  return cube;
+}
+
+static double
+envi_decode (const unsigned char *p,
+             int                  data_type,
+             bool                 swap_bytes)
+{
+  uint64_t bits = 0;
+  switch (data_type)
+    {
+    case 1:
+      return p[0];
+    case 2:
+    case 12:
+      {
+        uint16_t u;
+        memcpy (&u, p, sizeof (u));
+        if (swap_bytes)
+          u = __builtin_bswap16 (u);
+        return data_type == 2 ? (double)(int16_t)u : (double)u;
+      }
+    case 3:
+    case 4:
+    case 13:
+      {
+        uint32_t u;
+        memcpy (&u, p, sizeof (u));
+        if (swap_bytes)
+          u = __builtin_bswap32 (u);
+        if (data_type == 4)
+          {
+            float f;
+            memcpy (&f, &u, sizeof (f));
+            return f;
+          }
+        return data_type == 3 ? (double)(int32_t)u : (double)u;
+      }
+    default:
+      memcpy (&bits, p, sizeof (bits));
+      if (swap_bytes)
+        bits = __builtin_bswap64 (bits);
+      if (data_type == 5)
+        {
+          double d;
+          memcpy (&d, &bits, sizeof (d));
+          return d;
+        }
+      return data_type == 14 ? (double)(int64_t)bits : (double)bits;
+    }
+}
+
+/* Converts the spectra of pixels [first_pixel, first_pixel + n_pixels), counted line by line,
+ * into tile (n_pixels × bands, pixel-major). The loops follow the file layout. */
+void
+envi_cube_read (const struct envi_cube *cube,
+                size_t                  first_pixel,
+                size_t                  n_pixels,
+                double                 *tile)
+{
+  const size_t bands = cube->bands, samples = cube->samples, pixels = cube->samples * cube->lines;
+  const size_t size = cube->element_size;
+
+  switch (cube->interleave)
+    {
+    case ENVI_BIP:
+      for (size_t p = 0; p < n_pixels; p++)
+        for (size_t b = 0; b < bands; b++)
+          tile[p * bands + b] = envi_decode (cube->data + ((first_pixel + p) * bands + b) * size, cube->data_type, cube->swap_bytes);
+      break;
+    case ENVI_BIL:
+      for (size_t p = 0; p < n_pixels; )
+        {
+          const size_t line = (first_pixel + p) / samples, sample = (first_pixel + p) % samples;
+          const size_t run = samples - sample < n_pixels - p ? samples - sample : n_pixels - p;  // pixels left on this line
+          for (size_t b = 0; b < bands; b++)
+            for (size_t q = 0; q < run; q++)
+              tile[(p + q) * bands + b] = envi_decode (cube->data + ((line * bands + b) * samples + sample + q) * size, cube->data_type, cube->swap_bytes);
+          p += run;
+        }
+      break;
+    case ENVI_BSQ:
+    default:
+      for (size_t b = 0; b < bands; b++)
+        for (size_t p = 0; p < n_pixels; p++)
+          tile[p * bands + b] = envi_decode (cube->data + (b * pixels + first_pixel + p) * size, cube->data_type, cube->swap_bytes);
+      break;
+    }
+}
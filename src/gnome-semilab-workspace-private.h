@@ -22,6 +22,8 @@
 
 #include "gnome-semilab-workspace.h"
 #include "sqlimit.h"
+#include "sqlimit_cache.h"
+#include "spectrum_bin.h"
 
 G_BEGIN_DECLS
 
@@ -31,7 +33,8 @@ struct _GnomeSemilabWorkspace
 
   gchar                *ws_type;
   GFile                *table;
-  struct csv_data      *spectrum;
+  struct csv_data      *spectrum;         // the data of spectrum_bin
+  struct spectrum_bin  *spectrum_bin;
   struct eff_bg         eff_bg_data;
 
   GtkBox               *ws_main_box;
@@ -41,21 +41,20 @@ static GParamSpec *properties[N_PROPS];
 static void
 open_file_as_spectrum (GnomeSemilabWorkspace *self)
 {
+  /* Mapped once for the table of the workspace; the spectrum plot keeps pointing into it */
+  if (self->spectrum_bin)
+    return;
   const char *path = g_file_get_path (self->table);
   if (path)
     {
       // /run/user/1000/doc/9b9ece0/Tungsten-Halogen 3300K.csv
-      FILE *fp = fopen (path, "r");
-      if (fp)
-        {
-          self->spectrum = read_csv (fp, true, true, 1);
-          printf ("INFO: Read spectrum CSV data file %s\n", path);
-          fclose (fp);
-        }
+      /* Converted to .slspec on the first open; every later open only maps the cache */
+      self->spectrum_bin = spectrum_bin_open_cached (path);
+      self->spectrum = self->spectrum_bin ? &self->spectrum_bin->data : NULL;
+      if (self->spectrum)
+        printf ("INFO: Read spectrum data file %s\n", path);
       else
-        {
-          g_warning ("Failed to open file %s", path);
-        }
+        g_warning ("Failed to read file %s", path);
       g_free ((gpointer) path);
     }
   else
@@ -235,10 +234,13 @@ gnome_semilab_workspace_sim_action (GtkWidget   *widget,
                                     GVariant    *param)
 {
   GnomeSemilabWorkspace *self = (GnomeSemilabWorkspace *)widget;
+  struct sqlimit_options options = { .n_threads = 0, .grid = SQLIMIT_GRID_ADAPTIVE };  // one sweep worker per CPU, 1 meV peak
   open_file_as_spectrum (self);
   g_assert (self->spectrum != NULL);
 
-  self->eff_bg_data = sqlimit_main (self->spectrum, VERTICAL);
+  /* Reopening a spectrum that was simulated before, in any session or workspace, only hashes and maps */
+  eff_bg_clear (&self->eff_bg_data);
+  self->eff_bg_data = sqlimit_main_cached (self->spectrum, VERTICAL, &options);
 
   gtk_drawing_area_set_draw_func (GTK_DRAWING_AREA (self->eff_bg_plot), draw_eff_bg_function, &self->eff_bg_data, NULL);
 }
@@ -312,16 +314,9 @@ gnome_semilab_workspace_dispose (GObject *object)
   GnomeSemilabWorkspace *self = (GnomeSemilabWorkspace *)object;
 
   g_clear_pointer (&self->ws_type, g_free);
-  if (self->spectrum)
-    {
-      free (self->spectrum->wavelengths);
-      free (self->spectrum->intensities);
-    }
-  free (self->spectrum);
-  free (self->eff_bg_data.bandgap);
-  free (self->eff_bg_data.efficiency);
-  if (self->eff_bg_data.fill_factor)
-    free (self->eff_bg_data.fill_factor);
+  self->spectrum = NULL;
+  g_clear_pointer (&self->spectrum_bin, spectrum_bin_free);
+  eff_bg_clear (&self->eff_bg_data);
 
   G_OBJECT_CLASS (gnome_semilab_workspace_parent_class)->dispose (object);
 }
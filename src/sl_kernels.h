@@ -0,0 +1,232 @@
+/* sl_kernels.h
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stddef.h>
+#include <math.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_interp.h>
+
+#include "spectrum_quad.h"
+
+#ifndef SL_KERNELS_H
+#define SL_KERNELS_H
+
+/* The integrands of sqlimit.c as static inline kernels for the native quadrature path.
+ * The callbacks behind gsl_function read hPlanck, c0 and kB from consts.c, which the
+ * compiler cannot fold; these literals are the same exact SI values, so that every
+ * product of them below is a compile-time constant. Keep them in step with consts.c. */
+#define SL_HPLANCK   6.62607015E-34                   /* J s */
+#define SL_C0        299792458.0                      /* m/s */
+#define SL_KB        1.380649E-23                     /* J/K */
+#define SL_HC        (SL_HPLANCK * SL_C0)             /* J m */
+#define SL_HC_NM     (SL_HPLANCK * SL_C0 * 1E9)       /* J nm */
+/* 2 pi / (c^2 h^3), the prefactor of RR0 */
+#define SL_RR0_SCALE (2 * M_PI / (SL_C0 * SL_C0 * SL_HPLANCK * SL_HPLANCK * SL_HPLANCK))
+
+/* Intervals of one adaptive integral, on the stack; QAGS in sqlimit.c stops at 50.
+ * The range is cut into SL_ADAPTIVE_START equal intervals first, so that a narrow peak
+ * at one end, like that of RR0_integrand, is not missed by every node of the first rule. */
+#define SL_ADAPTIVE_LIMIT 256
+#define SL_ADAPTIVE_START 8
+
+/* A linearly interpolated spectrum like the gsl_interp_linear spline, with the lookup
+ * of the last interval cached like gsl_interp_accel. The arrays are borrowed. */
+struct sl_linear_cursor
+{
+  const double *x;      /* nm, strictly ascending */
+  const double *y;      /* W/(m^2 nm) */
+  size_t        size;
+  size_t        index;  // lower end of the last interval
+};
+
+struct sl_adaptive_interval
+{
+  double a;
+  double b;
+  double left;   // rule over [a, (a + b) / 2]
+  double right;  // rule over [(a + b) / 2, b]
+  double error;  // |left + right - rule over [a, b]|
+};
+
+static inline void
+sl_linear_cursor_bind (struct sl_linear_cursor *cursor,
+                       const double            *x,
+                       const double            *y,
+                       size_t                   size)
+{
+  cursor->x = x;
+  cursor->y = y;
+  cursor->size = size;
+  cursor->index = 0;
+}
+
+/* Same interval and formula as gsl_interp_linear, so the values agree bit for bit;
+ * outside the grid the end segments are extrapolated instead of failing */
+static inline double
+sl_linear_eval (struct sl_linear_cursor *cursor,
+                double                   x)
+{
+  const double *xa = cursor->x;
+  size_t i = cursor->index;
+  if (x < xa[i] || x >= xa[i + 1])
+    {
+      i = x < xa[0] ? 0 : gsl_interp_bsearch (xa, x, 0, cursor->size - 1);
+      if (i + 1 >= cursor->size)
+        i = cursor->size - 2;
+      cursor->index = i;
+    }
+  const double dx = xa[i + 1] - xa[i];
+  return cursor->y[i] + (cursor->y[i + 1] - cursor->y[i]) / dx * (x - xa[i]);
+}
+
+/* s_photons_per_tea (): photons per unit time, energy and area at photon energy E (J) */
+static inline double
+sl_kernel_photons (struct sl_linear_cursor *cursor,
+                   double                   E)
+{
+  return sl_linear_eval (cursor, SL_HC_NM / E) * SL_HC_NM / (E * E * E);
+}
+
+/* power_per_tea () */
+static inline double
+sl_kernel_power (struct sl_linear_cursor *cursor,
+                 double                   E)
+{
+  return sl_linear_eval (cursor, SL_HC_NM / E) * SL_HC_NM / (E * E);
+}
+
+/* interp_eval (): W/m^3 at lambda (m) */
+static inline double
+sl_kernel_interp (struct sl_linear_cursor *cursor,
+                  double                   lambda)
+{
+  return sl_linear_eval (cursor, lambda * 1E9) * 1E9;
+}
+
+/* RR0_integrand () with beta = 1 / (kB T) */
+static inline double
+sl_kernel_rr0 (double beta,
+               double E)
+{
+  return E * E / expm1 (E * beta);
+}
+
+/* rad_integrand () with beta = 1 / (kB T) */
+static inline double
+sl_kernel_rad (double beta,
+               double lambda)
+{
+  const double E_over_kT = SL_HC * beta / lambda;
+  return E_over_kT < 20 ? 1 / (gsl_pow_5 (lambda) * expm1 (E_over_kT)) : 0;
+}
+
+/* Defines name (), a globally adaptive integral of kernel (ctx, x) over [a, b] with the
+ * given rule, and name##_rule (), one application of the rule. Every interval is bisected
+ * once ahead: the difference between the rule over it and over its halves estimates the
+ * error, and the interval with the largest one is split next, until the total meets the
+ * tolerance like QAGS or SL_ADAPTIVE_LIMIT intervals are used. Every grid point of a measured
+ * spectrum is a kink, so on those it usually stops at the limit, as QAGS does at 50; abserr
+ * then tells how far off it is. kernel is expanded inline, so every kernel gets its own copy
+ * of the loop. */
+#define SL_DEFINE_ADAPTIVE(name, ctx_type, kernel)                                              \
+static inline double                                                                            \
+name##_rule (ctx_type                ctx,                                                       \
+             const struct quad_rule *rule,                                                      \
+             double                  a,                                                         \
+             double                  b)                                                         \
+{                                                                                               \
+  const double center = (a + b) / 2, half = (b - a) / 2;                                        \
+  double sum = 0;                                                                               \
+  for (size_t i = 0; i < rule->n; i++)                                                          \
+    sum += rule->w[i] * kernel (ctx, center + half * rule->x[i]);                               \
+  return half * sum;                                                                            \
+}                                                                                               \
+                                                                                                \
+static inline struct sl_adaptive_interval                                                       \
+name##_interval (ctx_type                ctx,                                                   \
+                 const struct quad_rule *rule,                                                  \
+                 double                  a,                                                     \
+                 double                  b,                                                     \
+                 double                  whole)                                                 \
+{                                                                                               \
+  const double mid = (a + b) / 2;                                                               \
+  struct sl_adaptive_interval interval = { a, b, name##_rule (ctx, rule, a, mid),               \
+                                           name##_rule (ctx, rule, mid, b), 0 };                \
+  interval.error = fabs (interval.left + interval.right - whole);                               \
+  return interval;                                                                              \
+}                                                                                               \
+                                                                                                \
+static inline double                                                                            \
+name (ctx_type                ctx,                                                              \
+      const struct quad_rule *rule,                                                             \
+      double                  a,                                                                \
+      double                  b,                                                                \
+      double                  epsabs,                                                           \
+      double                  epsrel,                                                           \
+      double                 *abserr)                                                           \
+{                                                                                               \
+  struct sl_adaptive_interval intervals[SL_ADAPTIVE_LIMIT];                                     \
+  const size_t n_start = SL_ADAPTIVE_START;                                                     \
+  double result = 0, error = 0;                                                                 \
+  for (size_t i = 0; i < n_start; i++)                                                          \
+    {                                                                                           \
+      const double lo = a + (b - a) * i / n_start;                                              \
+      const double hi = i + 1 == n_start ? b : a + (b - a) * (i + 1) / n_start;                 \
+      intervals[i] = name##_interval (ctx, rule, lo, hi, name##_rule (ctx, rule, lo, hi));      \
+      result += intervals[i].left + intervals[i].right;                                         \
+      error += intervals[i].error;                                                              \
+    }                                                                                           \
+  size_t n = n_start;                                                                           \
+  while (error > GSL_MAX (epsabs, epsrel * fabs (result)) && n < SL_ADAPTIVE_LIMIT)             \
+    {                                                                                           \
+      size_t worst = 0;                                                                         \
+      for (size_t i = 1; i < n; i++)                                                            \
+        if (intervals[i].error > intervals[worst].error)                                        \
+          worst = i;                                                                            \
+      const struct sl_adaptive_interval parent = intervals[worst];                              \
+      const double mid = (parent.a + parent.b) / 2;                                             \
+      if (!(mid > parent.a && mid < parent.b) || parent.error == 0)                             \
+        break;  /* roundoff: the interval cannot be split any further */                        \
+      intervals[worst] = name##_interval (ctx, rule, parent.a, mid, parent.left);               \
+      intervals[n] = name##_interval (ctx, rule, mid, parent.b, parent.right);                  \
+      result += intervals[worst].left + intervals[worst].right + intervals[n].left              \
+                + intervals[n].right - parent.left - parent.right;                              \
+      error += intervals[worst].error + intervals[n].error - parent.error;                      \
+      n++;                                                                                      \
+    }                                                                                           \
+  /* The running sums drift; add up the final intervals once */                                 \
+  result = error = 0;                                                                           \
+  for (size_t i = 0; i < n; i++)                                                                \
+    {                                                                                           \
+      result += intervals[i].left + intervals[i].right;                                         \
+      error += intervals[i].error;                                                              \
+    }                                                                                           \
+  if (abserr)                                                                                   \
+    *abserr = error;                                                                            \
+  return result;                                                                                \
+}
+
+SL_DEFINE_ADAPTIVE (sl_native_photons, struct sl_linear_cursor *, sl_kernel_photons)
+SL_DEFINE_ADAPTIVE (sl_native_power, struct sl_linear_cursor *, sl_kernel_power)
+SL_DEFINE_ADAPTIVE (sl_native_interp, struct sl_linear_cursor *, sl_kernel_interp)
+SL_DEFINE_ADAPTIVE (sl_native_rr0, double, sl_kernel_rr0)
+SL_DEFINE_ADAPTIVE (sl_native_rad, double, sl_kernel_rad)
+
+#endif  /* SL_KERNELS_H */
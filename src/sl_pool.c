@@ -0,0 +1,415 @@
+/* sl_pool.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "sl_pool.h"
+
+/* Per-worker double-ended queue. The owner pushes and pops at the bottom (LIFO, so
+ * the blocks of the spectrum it just prepared stay hot in its cache), thieves take
+ * from the top (FIFO, the oldest and usually largest pending work).
+ * A mutex per deque is plenty here: tasks are whole bandgap blocks, not single points. */
+struct sl_deque
+{
+  pthread_mutex_t   lock;
+  void            **tasks;
+  size_t            head;  // index of the top (oldest) task
+  size_t            size;
+  size_t            capacity;
+};
+
+struct sl_pool_worker
+{
+  struct sl_pool *pool;
+  unsigned int    index;
+  pthread_t       thread;
+  bool            started;
+};
+
+struct sl_pool
+{
+  unsigned int           n_workers;
+  sl_task_func           func;
+  void                  *user_data;
+  struct sl_deque       *deques;
+  struct sl_pool_worker *workers;
+
+  pthread_mutex_t        lock;
+  pthread_cond_t         work_cond;  // signalled when a task is queued or on shutdown
+  pthread_cond_t         done_cond;  // signalled when outstanding drops to 0
+  long                   queued;     // tasks sitting in deques; briefly -1 while a push races a take
+  size_t                 outstanding;  // tasks pushed and not finished yet
+  unsigned int           next_deque;  // round robin for pushes from outside the pool
+  bool                   shutdown;
+};
+
+static _Thread_local struct sl_pool_worker *current_worker = NULL;
+
+struct parallel_for_ctx
+{
+  atomic_size_t  next;
+  size_t         n_items;
+  size_t         grain;
+  sl_range_func  func;
+  void          *user_data;
+};
+
+struct parallel_for_worker
+{
+  struct parallel_for_ctx *ctx;
+  unsigned int             index;
+};
+
+/* 0 means "one worker per online CPU" */
+unsigned int
+sl_pool_resolve_workers (unsigned int n_workers)
+{
+  if (n_workers)
+    return n_workers;
+  long n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  return n_cpus > 0 ? (unsigned int)n_cpus : 1;
+}
+
+static void *
+parallel_for_run (void *data)
+{
+  struct parallel_for_worker *worker = (struct parallel_for_worker *)data;
+  struct parallel_for_ctx *ctx = worker->ctx;
+  size_t begin, end;
+
+  /* Items are handed out dynamically in chunks of `grain`, so that a slow chunk
+   * (e.g. a bandgap close to E_max) does not leave the other workers idle. */
+  while ((begin = atomic_fetch_add (&ctx->next, ctx->grain)) < ctx->n_items)
+    {
+      end = begin + ctx->grain < ctx->n_items ? begin + ctx->grain : ctx->n_items;
+      ctx->func (begin, end, worker->index, ctx->user_data);
+    }
+  return NULL;
+}
+
+/* Run func over [0, n_items) on n_workers threads, the calling thread being worker 0.
+ * n_workers must already be resolved by sl_pool_resolve_workers ().
+ * Always returns 0: if threads cannot be created, a warning is printed and the work is
+ * done by the threads that are running, so the result is still complete. */
+int
+sl_parallel_for (size_t         n_items,
+                 size_t         grain,
+                 unsigned int   n_workers,
+                 sl_range_func  func,
+                 void          *user_data)
+{
+  struct parallel_for_ctx ctx;
+
+  if (!n_items)
+    return 0;
+  if (!grain)
+    grain = 1;
+  if (n_workers <= 1 || n_items <= grain)
+    {
+      func (0, n_items, 0, user_data);
+      return 0;
+    }
+
+  atomic_init (&ctx.next, 0);
+  ctx.n_items = n_items;
+  ctx.grain = grain;
+  ctx.func = func;
+  ctx.user_data = user_data;
+
+  pthread_t *threads = (pthread_t *)calloc (n_workers, sizeof (pthread_t));
+  struct parallel_for_worker *workers = (struct parallel_for_worker *)calloc (n_workers, sizeof (struct parallel_for_worker));
+  bool *started = (bool *)calloc (n_workers, sizeof (bool));
+  if (!threads || !workers || !started)
+    {
+      free (threads);
+      free (workers);
+      free (started);
+      func (0, n_items, 0, user_data);
+      return 0;
+    }
+
+  for (unsigned int i = 0; i < n_workers; i++)
+    {
+      workers[i].ctx = &ctx;
+      workers[i].index = i;
+    }
+  for (unsigned int i = 1; i < n_workers; i++)
+    {
+      if (pthread_create (&threads[i], NULL, parallel_for_run, &workers[i]) == 0)
+        {
+          started[i] = true;
+        }
+      else
+        {
+          fprintf (stderr, "WARNING: Failed to create worker thread %u.\n", i);
+        }
+    }
+  parallel_for_run (&workers[0]);
+  for (unsigned int i = 1; i < n_workers; i++)
+    {
+      if (started[i])
+        pthread_join (threads[i], NULL);
+    }
+
+  free (threads);
+  free (workers);
+  free (started);
+  return 0;
+}
+
+static bool
+sl_deque_push (struct sl_deque *deque,
+               void            *task)
+{
+  pthread_mutex_lock (&deque->lock);
+  if (deque->size == deque->capacity)
+    {
+      size_t capacity = deque->capacity ? 2 * deque->capacity : 64;
+      void **tasks = (void **)malloc (capacity * sizeof (void *));
+      if (!tasks)
+        {
+          pthread_mutex_unlock (&deque->lock);
+          return false;
+        }
+      for (size_t i = 0; i < deque->size; i++)
+        tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+      free (deque->tasks);
+      deque->tasks = tasks;
+      deque->head = 0;
+      deque->capacity = capacity;
+    }
+  deque->tasks[(deque->head + deque->size++) % deque->capacity] = task;
+  pthread_mutex_unlock (&deque->lock);
+  return true;
+}
+
+static void *
+sl_deque_pop_bottom (struct sl_deque *deque)
+{
+  void *task = NULL;
+  pthread_mutex_lock (&deque->lock);
+  if (deque->size)
+    task = deque->tasks[(deque->head + --deque->size) % deque->capacity];
+  pthread_mutex_unlock (&deque->lock);
+  return task;
+}
+
+static void *
+sl_deque_steal_top (struct sl_deque *deque)
+{
+  void *task = NULL;
+  pthread_mutex_lock (&deque->lock);
+  if (deque->size)
+    {
+      task = deque->tasks[deque->head];
+      deque->head = (deque->head + 1) % deque->capacity;
+      deque->size--;
+    }
+  pthread_mutex_unlock (&deque->lock);
+  return task;
+}
+
+static void *
+sl_pool_take (struct sl_pool *pool,
+              unsigned int    index)
+{
+  void *task = sl_deque_pop_bottom (&pool->deques[index]);
+  for (unsigned int i = 1; !task && i < pool->n_workers; i++)
+    task = sl_deque_steal_top (&pool->deques[(index + i) % pool->n_workers]);
+  return task;
+}
+
+static void *
+sl_pool_run (void *data)
+{
+  struct sl_pool_worker *worker = (struct sl_pool_worker *)data;
+  struct sl_pool *pool = worker->pool;
+  void *task;
+
+  current_worker = worker;
+  for (;;)
+    {
+      task = sl_pool_take (pool, worker->index);
+      if (task)
+        {
+          pthread_mutex_lock (&pool->lock);
+          pool->queued--;
+          pthread_mutex_unlock (&pool->lock);
+
+          pool->func (task, worker->index, pool, pool->user_data);
+
+          pthread_mutex_lock (&pool->lock);
+          if (--pool->outstanding == 0)
+            pthread_cond_broadcast (&pool->done_cond);
+          pthread_mutex_unlock (&pool->lock);
+          continue;
+        }
+      pthread_mutex_lock (&pool->lock);
+      while (pool->queued <= 0 && !pool->shutdown)
+        pthread_cond_wait (&pool->work_cond, &pool->lock);
+      if (pool->shutdown && pool->queued <= 0)
+        {
+          pthread_mutex_unlock (&pool->lock);
+          break;
+        }
+      pthread_mutex_unlock (&pool->lock);
+    }
+  current_worker = NULL;
+  return NULL;
+}
+
+/* Start n_workers threads (resolved by sl_pool_resolve_workers ()) that run func on
+ * every pushed task until sl_pool_free (). Returns NULL if no thread could be started. */
+struct sl_pool *
+sl_pool_new (unsigned int  n_workers,
+             sl_task_func  func,
+             void         *user_data)
+{
+  struct sl_pool *pool = (struct sl_pool *)calloc (1, sizeof (struct sl_pool));
+  if (!pool)
+    return NULL;
+  pool->n_workers = n_workers ? n_workers : 1;
+  pool->func = func;
+  pool->user_data = user_data;
+  pool->deques = (struct sl_deque *)calloc (pool->n_workers, sizeof (struct sl_deque));
+  pool->workers = (struct sl_pool_worker *)calloc (pool->n_workers, sizeof (struct sl_pool_worker));
+  if (!pool->deques || !pool->workers)
+    {
+      free (pool->deques);
+      free (pool->workers);
+      free (pool);
+      return NULL;
+    }
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->work_cond, NULL);
+  pthread_cond_init (&pool->done_cond, NULL);
+  for (unsigned int i = 0; i < pool->n_workers; i++)
+    {
+      pthread_mutex_init (&pool->deques[i].lock, NULL);
+      pool->workers[i].pool = pool;
+      pool->workers[i].index = i;
+    }
+
+  unsigned int n_started = 0;
+  for (unsigned int i = 0; i < pool->n_workers; i++)
+    {
+      if (pthread_create (&pool->workers[i].thread, NULL, sl_pool_run, &pool->workers[i]) == 0)
+        {
+          pool->workers[i].started = true;
+          n_started++;
+        }
+      else
+        {
+          fprintf (stderr, "WARNING: Failed to create pool worker thread %u.\n", i);
+        }
+    }
+  if (!n_started)
+    {
+      sl_pool_free (pool);
+      return NULL;
+    }
+  /* Deques of workers that failed to start are still drained by stealing. */
+  return pool;
+}
+
+/* Called from inside a task, the task goes to the running worker's own deque;
+ * from any other thread, deques are filled round robin. */
+void
+sl_pool_push (struct sl_pool *pool,
+              void           *task)
+{
+  unsigned int index;
+
+  if (current_worker && current_worker->pool == pool)
+    {
+      index = current_worker->index;
+    }
+  else
+    {
+      pthread_mutex_lock (&pool->lock);
+      index = pool->next_deque++ % pool->n_workers;
+      pthread_mutex_unlock (&pool->lock);
+    }
+
+  pthread_mutex_lock (&pool->lock);
+  pool->outstanding++;
+  pthread_mutex_unlock (&pool->lock);
+
+  if (!sl_deque_push (&pool->deques[index], task))
+    {
+      /* Out of memory for the deque: run the task right here instead of dropping it. */
+      pool->func (task, index, pool, pool->user_data);
+      pthread_mutex_lock (&pool->lock);
+      if (--pool->outstanding == 0)
+        pthread_cond_broadcast (&pool->done_cond);
+      pthread_mutex_unlock (&pool->lock);
+      return;
+    }
+
+  pthread_mutex_lock (&pool->lock);
+  pool->queued++;
+  pthread_cond_signal (&pool->work_cond);
+  pthread_mutex_unlock (&pool->lock);
+}
+
+/* Block until every task pushed so far, and every task those pushed, has finished.
+ * Must not be called from inside a task. */
+void
+sl_pool_wait (struct sl_pool *pool)
+{
+  pthread_mutex_lock (&pool->lock);
+  while (pool->outstanding)
+    pthread_cond_wait (&pool->done_cond, &pool->lock);
+  pthread_mutex_unlock (&pool->lock);
+}
+
+void
+sl_pool_free (struct sl_pool *pool)
+{
+  if (!pool)
+    return;
+  sl_pool_wait (pool);
+  pthread_mutex_lock (&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast (&pool->work_cond);
+  pthread_mutex_unlock (&pool->lock);
+  for (unsigned int i = 0; i < pool->n_workers; i++)
+    {
+      if (pool->workers[i].started)
+        pthread_join (pool->workers[i].thread, NULL);
+    }
+  /* Only after every worker is gone: a worker still running may try to steal from any deque. */
+  for (unsigned int i = 0; i < pool->n_workers; i++)
+    {
+      pthread_mutex_destroy (&pool->deques[i].lock);
+      free (pool->deques[i].tasks);
+    }
+  pthread_mutex_destroy (&pool->lock);
+  pthread_cond_destroy (&pool->work_cond);
+  pthread_cond_destroy (&pool->done_cond);
+  free (pool->deques);
+  free (pool->workers);
+  free (pool);
+}
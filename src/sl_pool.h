@@ -0,0 +1,68 @@
+/* sl_pool.h
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stddef.h>
+
+#ifndef SL_POOL_H
+#define SL_POOL_H
+
+/* Called with a half-open range [begin, end) of item indices and the index of the
+ * worker running it (0 <= worker < number of workers), so that the callee can pick
+ * its own per-worker scratch state without locking. */
+typedef void (*sl_range_func) (size_t        begin,
+                               size_t        end,
+                               unsigned int  worker,
+                               void         *user_data);
+
+struct sl_pool;
+
+/* A task is an opaque pointer owned by the caller. It may push further tasks onto
+ * the pool; those go to the running worker's own deque, from which idle workers steal. */
+typedef void (*sl_task_func) (void           *task,
+                              unsigned int    worker,
+                              struct sl_pool *pool,
+                              void           *user_data);
+
+extern
+unsigned int  sl_pool_resolve_workers (unsigned int   n_workers);
+
+extern
+int           sl_parallel_for         (size_t         n_items,
+                                       size_t         grain,
+                                       unsigned int   n_workers,
+                                       sl_range_func  func,
+                                       void          *user_data);
+
+extern
+struct sl_pool *sl_pool_new  (unsigned int    n_workers,
+                              sl_task_func    func,
+                              void           *user_data);
+
+extern
+void            sl_pool_push (struct sl_pool *pool,
+                              void           *task);
+
+extern
+void            sl_pool_wait (struct sl_pool *pool);
+
+extern
+void            sl_pool_free (struct sl_pool *pool);
+
+#endif  /* SL_POOL_H */
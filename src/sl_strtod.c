@@ -0,0 +1,191 @@
+/* sl_strtod.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Almost every number in a spectrometer export has at most 15 significant digits and a small
+ * exponent, which Clinger's fast path converts exactly: the digits fit a double and so does
+ * the power of ten, so one correctly rounded IEEE multiplication or division is the correctly
+ * rounded result (W. D. Clinger, How to read floating point numbers accurately, PLDI 1990).
+ * Everything else goes to strtod_l () in the C locale, which glibc also rounds correctly,
+ * so the result never depends on LC_NUMERIC of the desktop session. */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <string.h>
+#include <float.h>
+#include <locale.h>
+#include <pthread.h>
+
+#include "sl_strtod.h"
+
+#define SL_STRTOD_MAX_DIGITS 19     // that always fit a uint64_t
+#define SL_STRTOD_MAX_EXACT  (UINT64_C(1) << 53)
+
+static const double exact_powers_of_ten[] =
+{
+  1E0, 1E1, 1E2, 1E3, 1E4, 1E5, 1E6, 1E7, 1E8, 1E9, 1E10,
+  1E11, 1E12, 1E13, 1E14, 1E15, 1E16, 1E17, 1E18, 1E19, 1E20, 1E21, 1E22
+};
+
+static locale_t c_locale;
+static pthread_once_t c_locale_once = PTHREAD_ONCE_INIT;
+
+static void
+c_locale_init (void)
+{
+  c_locale = newlocale (LC_ALL_MASK, "C", (locale_t)0);
+}
+
+static double
+sl_strtod_slow (const char  *str,
+                const char  *end,
+                const char **endptr)
+{
+  char buf[128];
+  const size_t len = end - str;
+  char *copy = len < sizeof (buf) ? buf : (char *)malloc (len + 1);
+  char *copy_end;
+  double value;
+
+  pthread_once (&c_locale_once, c_locale_init);
+  if (!copy || !c_locale)
+    {
+      free (copy == buf ? NULL : copy);
+      *endptr = str;
+      return 0;
+    }
+  memcpy (copy, str, len);
+  copy[len] = '\0';
+  value = strtod_l (copy, &copy_end, c_locale);
+  /* strtod skips blanks, which the caller has to see as an error */
+  *endptr = copy_end == copy || copy[0] == ' ' || copy[0] == '\t' ? str : str + (copy_end - copy);
+  if (copy != buf)
+    free (copy);
+  return value;
+}
+
+double
+sl_strtod (const char  *str,
+           const char  *end,
+           const char **endptr)
+{
+  const char *p = str;
+  bool negative = false;
+  uint64_t mantissa = 0;
+  int n_digits = 0, exponent = 0;
+  bool any_digit = false, truncated = false;
+
+  if (p < end && (*p == '+' || *p == '-'))
+    negative = *p++ == '-';
+  /* Leading zeros are not significant */
+  while (p < end && *p == '0')
+    {
+      any_digit = true;
+      p++;
+    }
+  for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+      any_digit = true;
+      if (n_digits < SL_STRTOD_MAX_DIGITS)
+        mantissa = 10 * mantissa + (*p - '0');
+      else
+        {
+          exponent++;
+          truncated |= *p != '0';
+        }
+      n_digits++;
+    }
+  if (p < end && *p == '.')
+    {
+      p++;
+      if (!n_digits)
+        for (; p < end && *p == '0'; p++)
+          {
+            any_digit = true;
+            exponent--;
+          }
+      for (; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+          any_digit = true;
+          if (n_digits < SL_STRTOD_MAX_DIGITS)
+            {
+              mantissa = 10 * mantissa + (*p - '0');
+              exponent--;
+            }
+          else
+            truncated |= *p != '0';
+          n_digits++;
+        }
+    }
+  /* inf, nan(...) and the like; only the word is copied, not the rest of a mapped file */
+  if (!any_digit)
+    {
+      const char *q = p;
+      while (q < end && q - p < 64 && (isalnum ((unsigned char)*q) || *q == '(' || *q == ')' || *q == '_'))
+        q++;
+      return sl_strtod_slow (str, q, endptr);
+    }
+
+  if (p < end && (*p == 'e' || *p == 'E'))
+    {
+      const char *q = p + 1;
+      bool negative_exponent = false;
+      if (q < end && (*q == '+' || *q == '-'))
+        negative_exponent = *q++ == '-';
+      if (q < end && *q >= '0' && *q <= '9')
+        {
+          int e = 0;
+          for (; q < end && *q >= '0' && *q <= '9'; q++)
+            if (e < 100000)
+              e = 10 * e + (*q - '0');
+          exponent += negative_exponent ? -e : e;
+          p = q;
+        }
+      /* otherwise the 'e' is not part of the number, as for strtod () */
+    }
+
+#if FLT_EVAL_METHOD == 0
+  if (!truncated && mantissa <= SL_STRTOD_MAX_EXACT)
+    {
+      double value = (double)mantissa;
+      bool exact = true;
+      if (mantissa == 0 || exponent == 0)
+        ;
+      else if (exponent > 0 && exponent <= 22)
+        value *= exact_powers_of_ten[exponent];
+      else if (exponent < 0 && exponent >= -22)
+        value /= exact_powers_of_ten[-exponent];
+      /* 1.5E25: move the excess of the exponent into the digits while they stay exact */
+      else if (exponent > 22 && exponent <= 22 + 15
+               && mantissa <= SL_STRTOD_MAX_EXACT / (uint64_t)exact_powers_of_ten[exponent - 22])
+        value = (double)(mantissa * (uint64_t)exact_powers_of_ten[exponent - 22]) * 1E22;
+      else
+        exact = false;
+      if (exact)
+        {
+          *endptr = p;
+          return negative ? -value : value;
+        }
+    }
+#endif
+  return sl_strtod_slow (str, p, endptr);
+}
@@ -0,0 +1,32 @@
+/* sl_strtod.h
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SL_STRTOD_H
+#define SL_STRTOD_H
+
+/* Decimal to double like strtod () in the C locale, correctly rounded, for a string that
+ * need not be NUL-terminated: it never reads at or past end. *endptr is set past the
+ * last character used, or to str if there is no number. Leading blanks are not skipped. */
+extern
+double sl_strtod (const char  *str,
+                  const char  *end,
+                  const char **endptr);
+
+#endif  /* SL_STRTOD_H */
@@ -40,6 +40,7 @@ read_spe (FILE *fp)
   const size_t MAX_COMMENT_LEN = 256;
   char line[MAX_COMMENT_LEN];
   struct csv_data *spectrum = (struct csv_data *)malloc (sizeof (struct csv_data));
+  spectrum->fields = NULL;
   spectrum->num_fields = 2;
   spectrum->wavelengths = (double *)calloc (MAX_NUM_ROWS, sizeof (double));
   spectrum->intensities = (double *)calloc (MAX_NUM_ROWS, sizeof (double));
@@ -56,7 +57,7 @@ read_spe (FILE *fp)
    * fscanf() returns the number of matches; for this formatted string, the expected number of matches is 2. */
   while (fscanf (fp, "%lf%lf", &spectrum->wavelengths[i], &spectrum->intensities[i]) == 2)
     {
-      if (++i > MAX_NUM_ROWS)
+      if (++i >= MAX_NUM_ROWS)
         {
           MAX_NUM_ROWS *= 2;
           spectrum->wavelengths = (double *)realloc (spectrum->wavelengths, MAX_NUM_ROWS * sizeof (double));
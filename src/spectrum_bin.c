@@ -0,0 +1,403 @@
+/* spectrum_bin.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "spectrum_bin.h"
+#include "utils.h"
+
+#define SPECTRUM_BIN_FORMAT     1
+#define SPECTRUM_BIN_ALIGN      64
+#define SPECTRUM_BIN_BYTE_ORDER 0x01020304U
+#define FNV_OFFSET_BASIS        0xcbf29ce484222325ULL
+
+/* Followed by the field names, NUL-terminated one after the other, then zeros up to
+ * data_offset, where the columns start, column_stride bytes apart. */
+struct spectrum_bin_header
+{
+  char     magic[8];
+  uint32_t format;
+  uint32_t byte_order;         // SPECTRUM_BIN_BYTE_ORDER as the writer saw it
+  uint32_t num_columns;        // the wavelengths and every intensity column
+  uint32_t names_size;         /* bytes */
+  uint64_t num_rows;
+  uint64_t data_offset;        /* bytes, a multiple of SPECTRUM_BIN_ALIGN */
+  uint64_t column_stride;      /* bytes, a multiple of SPECTRUM_BIN_ALIGN */
+  uint64_t source_size;        /* bytes, of the file it was converted from; 0 if none */
+  int64_t  source_mtime_sec;
+  int64_t  source_mtime_nsec;
+  char     wavelength_unit[16];
+  char     intensity_unit[32];
+};
+
+static const char spectrum_bin_magic[8] = "SLSPEC";
+static const char spectrum_bin_zeros[SPECTRUM_BIN_ALIGN];
+
+static size_t
+spectrum_bin_align (size_t size)
+{
+  return (size + SPECTRUM_BIN_ALIGN - 1) / SPECTRUM_BIN_ALIGN * SPECTRUM_BIN_ALIGN;
+}
+
+static int
+spectrum_bin_fwrite (FILE                *fp,
+                     const double *const *columns,
+                     unsigned int         num_columns,
+                     size_t               num_rows,
+                     const char *const   *fields,
+                     const char          *wavelength_unit,
+                     const char          *intensity_unit,
+                     const struct stat   *source)
+{
+  struct spectrum_bin_header header = {0};
+  const char *default_fields[] = { "Wavelength", "Intensity" };
+  size_t names_size = 0;
+  for (unsigned int i = 0; i < num_columns; i++)
+    {
+      const char *name = fields ? fields[i] : (i < 2 ? default_fields[i] : "");
+      names_size += strlen (name) + 1;
+    }
+
+  memcpy (header.magic, spectrum_bin_magic, sizeof (header.magic));
+  header.format = SPECTRUM_BIN_FORMAT;
+  header.byte_order = SPECTRUM_BIN_BYTE_ORDER;
+  header.num_columns = num_columns;
+  header.names_size = names_size;
+  header.num_rows = num_rows;
+  header.data_offset = spectrum_bin_align (sizeof (header) + names_size);
+  header.column_stride = spectrum_bin_align (num_rows * sizeof (double));
+  if (source)
+    {
+      header.source_size = source->st_size;
+      header.source_mtime_sec = source->st_mtim.tv_sec;
+      header.source_mtime_nsec = source->st_mtim.tv_nsec;
+    }
+  strncpy (header.wavelength_unit, wavelength_unit ? wavelength_unit : "nm", sizeof (header.wavelength_unit) - 1);
+  strncpy (header.intensity_unit, intensity_unit ? intensity_unit : "W/(m^2 nm)", sizeof (header.intensity_unit) - 1);
+
+  bool error = fwrite (&header, sizeof (header), 1, fp) != 1;
+  for (unsigned int i = 0; !error && i < num_columns; i++)
+    {
+      const char *name = fields ? fields[i] : (i < 2 ? default_fields[i] : "");
+      error = fwrite (name, strlen (name) + 1, 1, fp) != 1;
+    }
+  const size_t names_padding = header.data_offset - sizeof (header) - names_size;
+  if (!error && names_padding)
+    error = fwrite (spectrum_bin_zeros, names_padding, 1, fp) != 1;
+  for (unsigned int i = 0; !error && i < num_columns; i++)
+    {
+      const size_t padding = header.column_stride - num_rows * sizeof (double);
+      error = (num_rows && fwrite (columns[i], sizeof (double), num_rows, fp) != num_rows)
+              || (padding && i + 1 < num_columns && fwrite (spectrum_bin_zeros, padding, 1, fp) != 1);
+    }
+  if (!error)
+    error = fflush (fp) != 0;
+  return error ? -1 : 0;
+}
+
+/* Writes a .slspec file aside and renames it into place, so that a concurrent reader never
+ * maps half a file. fields, the units and source may be NULL; source is the stat of the
+ * file converted, which spectrum_bin_open_cached () compares. Returns 0 or -1. */
+int
+spectrum_bin_write (const char          *path,
+                    const double *const *columns,
+                    unsigned int         num_columns,
+                    size_t               num_rows,
+                    const char *const   *fields,
+                    const char          *wavelength_unit,
+                    const char          *intensity_unit,
+                    const struct stat   *source)
+{
+  char tmp_path[PATH_MAX];
+  if (snprintf (tmp_path, PATH_MAX, "%s.XXXXXX", path) >= PATH_MAX)
+    return -1;
+  int fd = mkstemp (tmp_path);
+  if (fd < 0)
+    return -1;
+  fchmod (fd, 0644);  // mkstemp () leaves it private
+  FILE *fp = fdopen (fd, "wb");
+  if (!fp)
+    {
+      close (fd);
+      unlink (tmp_path);
+      return -1;
+    }
+  int status = spectrum_bin_fwrite (fp, columns, num_columns, num_rows, fields, wavelength_unit, intensity_unit, source);
+  if (fclose (fp) && !status)
+    status = -1;
+  if (!status && rename (tmp_path, path))
+    status = -1;
+  if (status)
+    unlink (tmp_path);
+  return status;
+}
+
+/* Maps fd; with source, a file converted from anything else is stale and rejected quietly */
+static struct spectrum_bin *
+spectrum_bin_map (int                fd,
+                  const char        *path,
+                  const struct stat *source)
+{
+  struct stat st;
+  if (fstat (fd, &st) || (size_t)st.st_size < sizeof (struct spectrum_bin_header))
+    return NULL;
+  /* Private and writable: callers may scribble on the arrays without touching the file */
+  void *mapping = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED)
+    return NULL;
+
+  const struct spectrum_bin_header *header = (const struct spectrum_bin_header *)mapping;
+  const size_t size = st.st_size;
+  const char *names = (const char *)(header + 1);
+  bool valid = !memcmp (header->magic, spectrum_bin_magic, sizeof (header->magic))
+               && header->format == SPECTRUM_BIN_FORMAT
+               && header->byte_order == SPECTRUM_BIN_BYTE_ORDER
+               && header->num_columns >= 2
+               && header->names_size >= header->num_columns
+               && header->data_offset % SPECTRUM_BIN_ALIGN == 0
+               && header->column_stride % SPECTRUM_BIN_ALIGN == 0
+               && header->data_offset >= sizeof (*header) + header->names_size
+               && header->data_offset <= size
+               && header->num_rows <= header->column_stride / sizeof (double)
+               && header->column_stride <= (size - header->data_offset) / (header->num_columns - 1)
+               && header->data_offset + (header->num_columns - 1) * header->column_stride
+                  + header->num_rows * sizeof (double) <= size
+               && names[header->names_size - 1] == '\0'
+               && memchr (header->wavelength_unit, '\0', sizeof (header->wavelength_unit))
+               && memchr (header->intensity_unit, '\0', sizeof (header->intensity_unit));
+  if (!valid)
+    {
+      fprintf (stderr, "WARNING: Ignoring the invalid spectrum file %s.\n", path);
+      munmap (mapping, size);
+      return NULL;
+    }
+  if (source && (header->source_size != (uint64_t)source->st_size
+                 || header->source_mtime_sec != source->st_mtim.tv_sec
+                 || header->source_mtime_nsec != source->st_mtim.tv_nsec))
+    {
+      munmap (mapping, size);
+      return NULL;
+    }
+
+  struct spectrum_bin *bin = (struct spectrum_bin *)calloc (1, sizeof (struct spectrum_bin));
+  char **fields = (char **)calloc (header->num_columns, sizeof (char *));
+  double **columns = (double **)calloc (header->num_columns, sizeof (double *));
+  if (!bin || !fields || !columns)
+    {
+      free (bin);
+      free (fields);
+      free (columns);
+      munmap (mapping, size);
+      return NULL;
+    }
+  const char *name = names;
+  for (unsigned int i = 0; i < header->num_columns; i++)
+    {
+      fields[i] = (char *)name;
+      name += strlen (name) + 1;
+      if (name >= names + header->names_size)
+        name = names + header->names_size - 1;  // fewer names than columns: the rest are empty
+      columns[i] = (double *)((char *)mapping + header->data_offset + i * header->column_stride);
+    }
+  bin->wavelength_unit = header->wavelength_unit;
+  bin->intensity_unit = header->intensity_unit;
+  bin->columns = columns;
+  bin->num_columns = header->num_columns;
+  bin->num_rows = header->num_rows;
+  bin->mapping = mapping;
+  bin->mapping_size = size;
+  bin->data.fields = fields;
+  bin->data.wavelengths = columns[0];
+  bin->data.intensities = columns[1];
+  bin->data.num_fields = header->num_columns;
+  bin->data.num_datarows = header->num_rows;
+  return bin;
+}
+
+struct spectrum_bin *
+spectrum_bin_open (const char *path)
+{
+  int fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      fprintf (stderr, "ERROR: Failed to open %s.\n", path);
+      return NULL;
+    }
+  struct spectrum_bin *bin = spectrum_bin_map (fd, path, NULL);
+  close (fd);
+  return bin;
+}
+
+void
+spectrum_bin_free (struct spectrum_bin *bin)
+{
+  if (!bin)
+    return;
+  munmap (bin->mapping, bin->mapping_size);
+  free (bin->data.fields);
+  free (bin->columns);
+  free (bin);
+}
+
+static bool
+has_suffix (const char *path,
+            const char *suffix)
+{
+  const size_t length = strlen (path), suffix_length = strlen (suffix);
+  return length >= suffix_length && !strcasecmp (path + length - suffix_length, suffix);
+}
+
+/* Every column of a CSV file with a header row, or both of an SPE file */
+static int
+spectrum_bin_load_source (const char         *source_path,
+                          struct csv_columns *table)
+{
+  if (!has_suffix (source_path, ".spe"))
+    return read_csv_columns (source_path, true, 0, 0, table);
+
+  FILE *fp = fopen (source_path, "r");
+  if (!fp)
+    {
+      fprintf (stderr, "ERROR: Failed to open %s.\n", source_path);
+      return -1;
+    }
+  struct csv_data *spectrum = read_spe (fp);
+  fclose (fp);
+  *table = (struct csv_columns) {0};
+  table->columns = (double **)calloc (2, sizeof (double *));
+  if (!spectrum || !table->columns)
+    {
+      free (table->columns);
+      table->columns = NULL;
+      if (spectrum)
+        {
+          free (spectrum->wavelengths);
+          free (spectrum->intensities);
+        }
+      free (spectrum);
+      return -1;
+    }
+  table->columns[0] = spectrum->wavelengths;
+  table->columns[1] = spectrum->intensities;
+  table->num_fields = table->num_kept = 2;
+  table->num_rows = spectrum->num_datarows;
+  free (spectrum);
+  return 0;
+}
+
+static int
+spectrum_bin_check_source (const struct csv_columns *table,
+                           const char               *source_path)
+{
+  if (table->num_fields < 2 || !table->num_rows)
+    {
+      fprintf (stderr, "ERROR: %s holds no spectrum.\n", source_path);
+      return -1;
+    }
+  return 0;
+}
+
+/* Converts a CSV file with a header row, or an SPE file by its suffix, to path. Returns 0 or -1. */
+int
+spectrum_bin_convert (const char *source_path,
+                      const char *path)
+{
+  struct csv_columns table;
+  struct stat source;
+  if (stat (source_path, &source))
+    {
+      fprintf (stderr, "ERROR: Failed to open %s.\n", source_path);
+      return -1;
+    }
+  if (spectrum_bin_load_source (source_path, &table))
+    return -1;
+  int status = spectrum_bin_check_source (&table, source_path);
+  if (!status)
+    status = spectrum_bin_write (path, (const double *const *)table.columns, table.num_fields, table.num_rows,
+                                 (const char *const *)table.fields, NULL, NULL, &source);
+  if (status)
+    fprintf (stderr, "ERROR: Failed to write %s.\n", path);
+  csv_columns_clear (&table);
+  return status;
+}
+
+/* Opens a .slspec file as it is, or anything spectrum_bin_convert () reads through its
+ * conversion under $XDG_CACHE_HOME/gnome-semilab/spectra, keyed by the path. The conversion
+ * is redone whenever the size or the modification time of the source changes; if the cache
+ * cannot be written, it goes to an unlinked temporary file for this session only. */
+struct spectrum_bin *
+spectrum_bin_open_cached (const char *path)
+{
+  if (has_suffix (path, SPECTRUM_BIN_SUFFIX))
+    return spectrum_bin_open (path);
+
+  struct stat source;
+  if (stat (path, &source))
+    {
+      fprintf (stderr, "ERROR: Failed to open %s.\n", path);
+      return NULL;
+    }
+  char real_path[PATH_MAX], dir[PATH_MAX], cache_path[PATH_MAX];
+  const char *key_path = realpath (path, real_path) ? real_path : path;
+  const uint64_t key = sl_fnv1a (FNV_OFFSET_BASIS, key_path, strlen (key_path));
+  const bool cached = !sl_cache_dir (dir, "spectra", true)
+                      && snprintf (cache_path, PATH_MAX, "%s/%016" PRIx64 SPECTRUM_BIN_SUFFIX, dir, key) < PATH_MAX;
+
+  struct spectrum_bin *bin = NULL;
+  int fd = cached ? open (cache_path, O_RDONLY | O_CLOEXEC) : -1;
+  if (fd >= 0)
+    {
+      bin = spectrum_bin_map (fd, cache_path, &source);
+      close (fd);
+      if (bin)
+        return bin;
+    }
+
+  struct csv_columns table;
+  if (spectrum_bin_load_source (path, &table))
+    return NULL;
+  if (spectrum_bin_check_source (&table, path))
+    {
+      csv_columns_clear (&table);
+      return NULL;
+    }
+  const double *const *columns = (const double *const *)table.columns;
+  const char *const *fields = (const char *const *)table.fields;
+  if (cached && !spectrum_bin_write (cache_path, columns, table.num_fields, table.num_rows, fields, NULL, NULL, &source))
+    bin = spectrum_bin_open (cache_path);
+  if (!bin)
+    {
+      fprintf (stderr, "WARNING: Failed to cache the spectrum %s.\n", path);
+      FILE *fp = tmpfile ();
+      if (fp && !spectrum_bin_fwrite (fp, columns, table.num_fields, table.num_rows, fields, NULL, NULL, &source))
+        bin = spectrum_bin_map (fileno (fp), path, NULL);
+      if (fp)
+        fclose (fp);
+    }
+  csv_columns_clear (&table);
+  return bin;
+}
@@ -0,0 +1,70 @@
+/* spectrum_bin.h
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "data_io.h"
+
+#ifndef SPECTRUM_BIN_H
+#define SPECTRUM_BIN_H
+
+/* Binary columnar spectra, .slspec: a header with the units, the row count and the field
+ * names, then the wavelengths and every intensity column as arrays of doubles aligned to
+ * 64 bytes, in host byte order. Opening one maps it and points into the mapping, so
+ * nothing is parsed or copied. */
+#define SPECTRUM_BIN_SUFFIX ".slspec"
+
+struct spectrum_bin
+{
+  struct csv_data   data;             // the wavelengths and the first intensity column
+  const char       *wavelength_unit;
+  const char       *intensity_unit;
+  double          **columns;          // num_columns arrays, the wavelengths first
+  unsigned int      num_columns;
+  size_t            num_rows;
+  void             *mapping;          // private and writable, like the sqlimit cache
+  size_t            mapping_size;
+};
+
+extern
+int                  spectrum_bin_write        (const char          *path,
+                                                const double *const *columns,
+                                                unsigned int         num_columns,
+                                                size_t               num_rows,
+                                                const char *const   *fields,
+                                                const char          *wavelength_unit,
+                                                const char          *intensity_unit,
+                                                const struct stat   *source);
+
+extern
+int                  spectrum_bin_convert      (const char          *source_path,
+                                                const char          *path);
+
+extern
+struct spectrum_bin *spectrum_bin_open         (const char          *path);
+
+extern
+struct spectrum_bin *spectrum_bin_open_cached  (const char          *path);
+
+extern
+void                 spectrum_bin_free         (struct spectrum_bin *bin);
+
+#endif  /* SPECTRUM_BIN_H */
@@ -0,0 +1,257 @@
+/* spectrum_quad.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Fixed-order alternative to QAGS for the spectrum integrals of sqlimit.c. The integrands are
+ * those of s_photons_per_tea () and power_per_tea (), I(lambda(E)) * 1E9 / E^3 * h c and E times
+ * that, with I linearly interpolated in wavelength like the gsl_interp_linear spline. They are
+ * smooth inside every segment of the measured grid, where an n-point rule converges quickly,
+ * and only kinked at the grid points, which are therefore the segment boundaries. */
+
+#include <stdlib.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_math.h>
+#include <gsl/gsl_interp.h>
+#include <gsl/gsl_integration.h>
+
+#include "sqlimit.h"
+#include "spectrum_quad.h"
+
+/* Clenshaw-Curtis weights for the n = N + 1 Chebyshev extrema cos(j pi / N),
+ * after L. N. Trefethen, Spectral Methods in MATLAB (SIAM, 2000), clencurt.m */
+static void
+clenshaw_curtis_nodes (struct quad_rule *rule)
+{
+  const size_t N = rule->n - 1;
+  for (size_t j = 0; j <= N; j++)
+    {
+      const double theta = M_PI * j / N;
+      rule->x[j] = cos (theta);
+      if (j == 0 || j == N)
+        {
+          rule->w[j] = N % 2 ? 1.0 / (N * N) : 1.0 / (N * N - 1.0);
+          continue;
+        }
+      double v = 1;
+      for (size_t k = 1; 2 * k < N; k++)
+        v -= 2 * cos (2 * k * theta) / (4.0 * k * k - 1);
+      if (N % 2 == 0)
+        v -= cos (N * theta) / (N * N - 1.0);
+      rule->w[j] = 2 * v / N;
+    }
+}
+
+struct quad_rule *
+quad_rule_alloc (enum quad_rule_type type,
+                 size_t              n)
+{
+  if (n < 2)
+    {
+      fprintf (stderr, "ERROR: A quadrature rule needs at least 2 points, got %zu.\n", n);
+      return NULL;
+    }
+  struct quad_rule *rule = (struct quad_rule *)calloc (1, sizeof (struct quad_rule));
+  if (!rule)
+    return NULL;
+  rule->type = type;
+  rule->n = n;
+  rule->x = (double *)calloc (n, sizeof (double));
+  rule->w = (double *)calloc (n, sizeof (double));
+  if (!rule->x || !rule->w)
+    {
+      quad_rule_free (rule);
+      return NULL;
+    }
+
+  if (type == QUAD_RULE_CLENSHAW_CURTIS)
+    clenshaw_curtis_nodes (rule);
+  else
+    {
+      gsl_integration_glfixed_table *table = gsl_integration_glfixed_table_alloc (n);
+      if (!table)
+        {
+          quad_rule_free (rule);
+          return NULL;
+        }
+      for (size_t i = 0; i < n; i++)
+        gsl_integration_glfixed_point (-1, 1, i, &rule->x[i], &rule->w[i], table);
+      gsl_integration_glfixed_table_free (table);
+    }
+  return rule;
+}
+
+void
+quad_rule_free (struct quad_rule *rule)
+{
+  if (!rule)
+    return;
+  free (rule->x);
+  free (rule->w);
+  free (rule);
+}
+
+double
+quad_rule_eval (const struct quad_rule *rule,
+                double                (*f) (double, void *),
+                void                   *params,
+                double                  a,
+                double                  b)
+{
+  const double center = (a + b) / 2, half = (b - a) / 2;
+  double sum = 0;
+  for (size_t i = 0; i < rule->n; i++)
+    sum += rule->w[i] * f (center + half * rule->x[i], params);
+  return half * sum;
+}
+
+struct spectrum_quad *
+spectrum_quad_alloc (size_t                  length,
+                     const struct quad_rule *rule)
+{
+  if (length < 2)
+    {
+      fprintf (stderr, "ERROR: A spectrum quadrature needs at least 2 points, got %zu.\n", length);
+      return NULL;
+    }
+  struct spectrum_quad *quad = (struct spectrum_quad *)calloc (1, sizeof (struct spectrum_quad));
+  if (!quad)
+    return NULL;
+  quad->rule = rule;
+  quad->length = length;
+  quad->cum_power = (double *)calloc (length, sizeof (double));
+  quad->cum_photons = (double *)calloc (length, sizeof (double));
+  if (!quad->cum_power || !quad->cum_photons)
+    {
+      spectrum_quad_free (quad);
+      return NULL;
+    }
+  return quad;
+}
+
+/* Photons and power with photon energy in [E_lo, E_hi], all inside segment k */
+static void
+spectrum_quad_segment (const struct spectrum_quad *quad,
+                       size_t                      k,
+                       double                      E_lo,     /* J */
+                       double                      E_hi,     /* J */
+                       double                     *photons,  /* 1/(m^2 s) */
+                       double                     *power)    /* W/m^2 */
+{
+  const struct quad_rule *rule = quad->rule;
+  const double a = quad->wavelengths[k], b = quad->wavelengths[k + 1];
+  const double ya = quad->intensities[k], slope = (quad->intensities[k + 1] - ya) / (b - a);
+  const double center = (E_lo + E_hi) / 2, half = (E_hi - E_lo) / 2;
+  double sum_photons = 0, sum_power = 0;
+
+  for (size_t i = 0; i < rule->n; i++)
+    {
+      const double E = center + half * rule->x[i];
+      const double lambda = hPlanck * c0 / E * 1E9;  /* nm */
+      /* s_photons_per_tea (): W/(m^2 nm) -> W/m^3, divided by E^3 / (h c) */
+      const double f = (ya + slope * (lambda - a)) * 1E9 / gsl_pow_3 (E) * hPlanck * c0;
+      sum_photons += rule->w[i] * f;
+      sum_power += rule->w[i] * E * f;
+    }
+  *photons = half * sum_photons;
+  *power = half * sum_power;
+}
+
+int
+spectrum_quad_init (struct spectrum_quad *quad,
+                    const double         *wavelengths,
+                    const double         *intensities)
+{
+  quad->wavelengths = wavelengths;
+  quad->intensities = intensities;
+  quad->cum_power[0] = 0;
+  quad->cum_photons[0] = 0;
+  for (size_t k = 1; k < quad->length; k++)
+    {
+      if (!(wavelengths[k] > wavelengths[k - 1]))
+        {
+          fprintf (stderr, "ERROR: Wavelengths must be strictly ascending, got %.17g nm after %.17g nm.\n", wavelengths[k], wavelengths[k - 1]);
+          return GSL_EINVAL;
+        }
+      double photons, power;
+      spectrum_quad_segment (quad, k - 1, hPlanck * c0 / (wavelengths[k] * 1E-9), hPlanck * c0 / (wavelengths[k - 1] * 1E-9), &photons, &power);
+      quad->cum_photons[k] = quad->cum_photons[k - 1] + photons;
+      quad->cum_power[k] = quad->cum_power[k - 1] + power;
+    }
+  return GSL_SUCCESS;
+}
+
+void
+spectrum_quad_free (struct spectrum_quad *quad)
+{
+  if (!quad)
+    return;
+  free (quad->cum_power);
+  free (quad->cum_photons);
+  free (quad);
+}
+
+double
+spectrum_quad_radiation (const struct spectrum_quad *quad)
+{
+  return quad->cum_power[quad->length - 1];
+}
+
+/* Photons and power from wavelengths[0] to lambda (nm) */
+static void
+spectrum_quad_below (const struct spectrum_quad *quad,
+                     double                      lambda,
+                     double                     *photons,
+                     double                     *power)
+{
+  if (!(lambda > quad->wavelengths[0]))
+    {
+      *photons = *power = 0;
+      return;
+    }
+  if (lambda >= quad->wavelengths[quad->length - 1])
+    {
+      *photons = quad->cum_photons[quad->length - 1];
+      *power = quad->cum_power[quad->length - 1];
+      return;
+    }
+  const size_t k = gsl_interp_bsearch (quad->wavelengths, lambda, 0, quad->length - 1);
+  spectrum_quad_segment (quad, k, hPlanck * c0 / (lambda * 1E-9), hPlanck * c0 / (quad->wavelengths[k] * 1E-9), photons, power);
+  *photons += quad->cum_photons[k];
+  *power += quad->cum_power[k];
+}
+
+/* W/m^2 from wavelengths[0] to lambda (nm) */
+double
+spectrum_quad_power_below (const struct spectrum_quad *quad,
+                           double                      lambda)
+{
+  double photons, power;
+  spectrum_quad_below (quad, lambda, &photons, &power);
+  return power;
+}
+
+/* 1/(m^2 s) with photon energy from Egap (J) to the top of the spectrum */
+double
+spectrum_quad_photons_above_gap (const struct spectrum_quad *quad,
+                                 double                      Egap)
+{
+  double photons, power;
+  spectrum_quad_below (quad, hPlanck * c0 / Egap * 1E9, &photons, &power);
+  return photons;
+}
@@ -0,0 +1,92 @@
+/* spectrum_quad.h
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stddef.h>
+
+#ifndef SPECTRUM_QUAD_H
+#define SPECTRUM_QUAD_H
+
+enum quad_rule_type
+{
+  QUAD_RULE_GAUSS_LEGENDRE,
+  QUAD_RULE_CLENSHAW_CURTIS
+};
+
+/* Nodes and weights of a fixed-order rule on [-1, 1] */
+struct quad_rule
+{
+  enum quad_rule_type type;
+  double             *x;
+  double             *w;
+  size_t              n;
+};
+
+/* Photon flux and power of a spectrum integrated over photon energy, segment by segment of the
+ * measured grid, with a fixed-order rule. The sums over whole segments are tabulated once per
+ * spectrum; a bandgap inside a segment costs one more rule over the part of that segment.
+ * The rule, wavelength and intensity arrays are borrowed, not copied. */
+struct spectrum_quad
+{
+  const struct quad_rule *rule;
+  const double           *wavelengths;  /* nm, strictly ascending */
+  const double           *intensities;  /* W/(m^2 nm) */
+  double                 *cum_power;    /* W/m^2, from wavelengths[0] to wavelengths[k] */
+  double                 *cum_photons;  /* 1/(m^2 s), from wavelengths[0] to wavelengths[k] */
+  size_t                  length;
+};
+
+extern
+struct quad_rule     *quad_rule_alloc                 (enum quad_rule_type          type,
+                                                       size_t                       n);
+
+extern
+void                  quad_rule_free                  (struct quad_rule            *rule);
+
+extern
+double                quad_rule_eval                  (const struct quad_rule      *rule,
+                                                       double                     (*f) (double, void *),
+                                                       void                        *params,
+                                                       double                       a,
+                                                       double                       b);
+
+extern
+struct spectrum_quad *spectrum_quad_alloc             (size_t                       length,
+                                                       const struct quad_rule      *rule);
+
+extern
+int                   spectrum_quad_init              (struct spectrum_quad        *quad,
+                                                       const double                *wavelengths,
+                                                       const double                *intensities);
+
+extern
+void                  spectrum_quad_free              (struct spectrum_quad        *quad);
+
+extern
+double                spectrum_quad_radiation         (const struct spectrum_quad  *quad);
+
+extern
+double                spectrum_quad_power_below       (const struct spectrum_quad  *quad,
+                                                       double                       lambda);
+
+extern
+double                spectrum_quad_photons_above_gap (const struct spectrum_quad  *quad,
+                                                       double                       Egap);
+
+#endif  /* SPECTRUM_QUAD_H */
@@ -0,0 +1,164 @@
+/* spectrum_table.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The photon flux above a bandgap is usually written as an integral over photon energy,
+ * int_Egap^Emax I(lambda(E)) * 1E9 / E^3 * h c dE, which is what s_photons_per_tea () feeds to QAGS.
+ * Substituting E = h c / lambda turns it into int_lambda_min^lambda_gap I(lambda) * lambda / (h c) dlambda.
+ * With I linear on every segment of the measured grid, I and I * lambda are polynomials of
+ * degree 1 and 2 there, so both integrals are exact sums of closed-form segment terms:
+ *   int_a^b I dlambda          = (b - a) / 2 * (I_a + I_b)
+ *   int_a^b I lambda dlambda   = (b - a) / 6 * (I_a * (2 a + b) + I_b * (a + 2 b))
+ * Their prefix sums are tabulated once per spectrum, after which "photons above Egap"
+ * is a binary search plus one partial segment. */
+
+#include <stdlib.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_interp.h>
+
+#include "sqlimit.h"
+#include "spectrum_table.h"
+
+struct spectrum_table *
+spectrum_table_alloc (size_t length)
+{
+  if (length < 2)
+    {
+      fprintf (stderr, "ERROR: A spectrum table needs at least 2 points, got %zu.\n", length);
+      return NULL;
+    }
+  struct spectrum_table *table = (struct spectrum_table *)calloc (1, sizeof (struct spectrum_table));
+  if (!table)
+    return NULL;
+  table->length = length;
+  table->cum_power = (double *)calloc (length, sizeof (double));
+  table->cum_photons = (double *)calloc (length, sizeof (double));
+  if (!table->cum_power || !table->cum_photons)
+    {
+      spectrum_table_free (table);
+      return NULL;
+    }
+  return table;
+}
+
+/* length is the one given to spectrum_table_alloc (), like gsl_spline_init () */
+int
+spectrum_table_init (struct spectrum_table *table,
+                     const double          *wavelengths,
+                     const double          *intensities)
+{
+  table->wavelengths = wavelengths;
+  table->intensities = intensities;
+  table->cum_power[0] = 0;
+  table->cum_photons[0] = 0;
+  return spectrum_table_update (table, 0);
+}
+
+/* Re-accumulate the prefix integrals after the intensities from index first on were edited
+ * in place; the entries below first are kept, so the cost is O(length - first). */
+int
+spectrum_table_update (struct spectrum_table *table,
+                       size_t                 first)
+{
+  /* nm * 1E-9 -> m and divided by the photon energy h c / lambda */
+  const double photon_scale = 1E-9 / (hPlanck * c0);
+  const double *wavelengths = table->wavelengths, *intensities = table->intensities;
+
+  /* Point first also bounds the segment that ends at it */
+  for (size_t k = first ? first : 1; k < table->length; k++)
+    {
+      const double a = wavelengths[k - 1], b = wavelengths[k];
+      const double ya = intensities[k - 1], yb = intensities[k];
+      if (!(b > a))
+        {
+          fprintf (stderr, "ERROR: Wavelengths must be strictly ascending, got %.17g nm after %.17g nm.\n", b, a);
+          return GSL_EINVAL;
+        }
+      table->cum_power[k] = table->cum_power[k - 1] + (b - a) / 2 * (ya + yb);
+      table->cum_photons[k] = table->cum_photons[k - 1] + (b - a) / 6 * (ya * (2 * a + b) + yb * (a + 2 * b)) * photon_scale;
+    }
+  return GSL_SUCCESS;
+}
+
+void
+spectrum_table_free (struct spectrum_table *table)
+{
+  if (!table)
+    return;
+  free (table->cum_power);
+  free (table->cum_photons);
+  free (table);
+}
+
+/* W/m^2 over the whole spectrum, the integral of power_per_tea () from E_min to E_max */
+double
+spectrum_table_radiation (const struct spectrum_table *table)
+{
+  return table->cum_power[table->length - 1];
+}
+
+/* Locate lambda: returns the segment k with wavelengths[k] <= lambda < wavelengths[k + 1]
+ * and the interpolated intensity at lambda, or SIZE_MAX if lambda is out of range. */
+static size_t
+spectrum_table_locate (const struct spectrum_table *table,
+                       double                       lambda,
+                       double                      *y)
+{
+  if (!(lambda > table->wavelengths[0]) || lambda >= table->wavelengths[table->length - 1])
+    return (size_t)-1;
+  size_t k = gsl_interp_bsearch (table->wavelengths, lambda, 0, table->length - 1);
+  const double a = table->wavelengths[k], b = table->wavelengths[k + 1];
+  *y = table->intensities[k] + (table->intensities[k + 1] - table->intensities[k]) * (lambda - a) / (b - a);
+  return k;
+}
+
+/* W/m^2 from wavelengths[0] to lambda (nm) */
+double
+spectrum_table_power_below (const struct spectrum_table *table,
+                            double                       lambda)
+{
+  double y;
+  size_t k = spectrum_table_locate (table, lambda, &y);
+  if (k == (size_t)-1)
+    return lambda <= table->wavelengths[0] ? 0 : spectrum_table_radiation (table);
+  const double a = table->wavelengths[k];
+  return table->cum_power[k] + (lambda - a) / 2 * (table->intensities[k] + y);
+}
+
+/* 1/(m^2 s) from wavelengths[0] to lambda (nm) */
+double
+spectrum_table_photons_below (const struct spectrum_table *table,
+                              double                       lambda)
+{
+  double y;
+  size_t k = spectrum_table_locate (table, lambda, &y);
+  if (k == (size_t)-1)
+    return lambda <= table->wavelengths[0] ? 0 : table->cum_photons[table->length - 1];
+  const double a = table->wavelengths[k], ya = table->intensities[k];
+  return table->cum_photons[k] + (lambda - a) / 6 * (ya * (2 * a + lambda) + y * (a + 2 * lambda)) * 1E-9 / (hPlanck * c0);
+}
+
+/* 1/(m^2 s) with photon energy from Egap (J) to the top of the spectrum,
+ * the integral of s_photons_per_tea () from Egap to E_max */
+double
+spectrum_table_photons_above_gap (const struct spectrum_table *table,
+                                  double                       Egap)
+{
+  return spectrum_table_photons_below (table, hPlanck * c0 / Egap * 1E9);
+}
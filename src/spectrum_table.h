@@ -0,0 +1,68 @@
+/* spectrum_table.h
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stddef.h>
+
+#ifndef SPECTRUM_TABLE_H
+#define SPECTRUM_TABLE_H
+
+/* Prefix integrals of a spectrum that is linearly interpolated in wavelength
+ * (the same model as the gsl_interp_linear spline used by the QAGS path).
+ * The wavelength and intensity arrays are borrowed, not copied. */
+struct spectrum_table
+{
+  const double *wavelengths;  /* nm, strictly ascending */
+  const double *intensities;  /* W/(m^2 nm) */
+  double       *cum_power;    /* W/m^2, integral of the intensity from wavelengths[0] to wavelengths[k] */
+  double       *cum_photons;  /* 1/(m^2 s), photon flux from wavelengths[0] to wavelengths[k] */
+  size_t        length;
+};
+
+extern
+struct spectrum_table *spectrum_table_alloc             (size_t                       length);
+
+extern
+int                    spectrum_table_init              (struct spectrum_table       *table,
+                                                         const double                *wavelengths,
+                                                         const double                *intensities);
+
+extern
+int                    spectrum_table_update            (struct spectrum_table       *table,
+                                                         size_t                       first);
+
+extern
+void                   spectrum_table_free              (struct spectrum_table       *table);
+
+extern
+double                 spectrum_table_radiation         (const struct spectrum_table *table);
+
+extern
+double                 spectrum_table_power_below       (const struct spectrum_table *table,
+                                                         double                       lambda);
+
+extern
+double                 spectrum_table_photons_below     (const struct spectrum_table *table,
+                                                         double                       lambda);
+
+extern
+double                 spectrum_table_photons_above_gap (const struct spectrum_table *table,
+                                                         double                       Egap);
+
+#endif  /* SPECTRUM_TABLE_H */
@@ -18,6 +18,8 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_spline.h>
 #include <gsl/gsl_integration.h>
@@ -25,11 +27,24 @@
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_sf_exp.h>
 #include <gsl/gsl_sf_log.h>
+#include <gsl/gsl_min.h>
 #include <gsl/gsl_multimin.h>
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+#include <gsl/gsl_sort.h>
 // #include <progressbar/progressbar.h>
 #include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "sqlimit.h"
+#include "sl_pool.h"
+#include "spectrum_table.h"
+#include "spectrum_quad.h"
+#include "sl_kernels.h"
+#include "bose_einstein.h"
 
 struct spline_params
 {
@@ -39,10 +54,31 @@ struct spline_params
 
 struct min_params
 {
-  double        Egap;
-  double        Emax;
-  gsl_function *F_s;
-  gsl_function *F_RR0;
+  double                       Egap;
+  double                       Emax;
+  gsl_function                *F_s;
+  gsl_function                *F_RR0;
+  gsl_integration_workspace   *int_ws;
+  const struct spectrum_table *table;  // NULL: integrate F_s with QAGS
+  const struct spectrum_quad  *quad;   // fixed-order rule per segment, instead of QAGS
+  const struct quad_rule      *native_rule;  // adaptive rule with inlined kernels, instead of QAGS
+  struct sl_linear_cursor     *cursor;       // the spline of F_s, for the native kernels
+  double                       Tcell;  /* K; also the parameter of F_RR0 */
+  double                       rr0;    // RR0 (Egap, Emax) at Tcell, cached whenever Egap is set
+};
+
+/* Everything a sweep thread mutates while evaluating one bandgap.
+ * The spline itself is only read by gsl_spline_eval (), so it is shared,
+ * but the lookup accelerator caches the last interval and must not be. */
+struct sqlimit_worker
+{
+  gsl_interp_accel          *acc;
+  gsl_integration_workspace *int_ws;
+  struct spline_params       spline_params;
+  gsl_function               F_s;
+  gsl_function               F_RR0;
+  struct sl_linear_cursor    cursor;
+  struct min_params          min_params;
 };
 
 /* Solar Photons per unit Time, per unit photon Energy-range, and per unit Area of the solar cell
@@ -85,16 +121,20 @@ power_per_tea (double  Ephoton,  /* J */
   return Ephoton * s_photons_per_tea (Ephoton, params);
 }
 
+/* Photons from params->Egap to params->Emax, from the prefix table when there is one */
 static double
-solar_photons_above_gap (double        Egap,  /* J */
-                         double        Emax,  /* J */
-                         gsl_function *F_s)
+solar_photons_above_gap (const struct min_params *params)
 {
+  if (params->table)
+    return spectrum_table_photons_above_gap (params->table, params->Egap);
+  if (params->quad)
+    return spectrum_quad_photons_above_gap (params->quad, params->Egap);
+  if (params->native_rule)
+    return sl_native_photons (params->cursor, params->native_rule, params->Egap, params->Emax, 1.49E-08, 1.49E-08, NULL);
+
   double result, error;
   size_t iter_lim = 50;
-  gsl_integration_workspace *s_int_ws = gsl_integration_workspace_alloc (iter_lim);
-  gsl_integration_qags (F_s, Egap, Emax, 1.49E-08, 1.49E-08, iter_lim, s_int_ws, &result, &error);
-  gsl_integration_workspace_free (s_int_ws);
+  gsl_integration_qags (params->F_s, params->Egap, params->Emax, 1.49E-08, 1.49E-08, iter_lim, params->int_ws, &result, &error);
   /* (m^2 s)^(-1) */
   return result;
 }
@@ -103,132 +143,261 @@ static double
 RR0_integrand (double  E,  /* J */
                void   *params)
 {
-  return E * E  / (gsl_sf_exp (E / (kB * Tcell)) - 1);
+  const double temperature = *(double *)params;  /* K */
+  return E * E  / (gsl_sf_exp (E / (kB * temperature)) - 1);
 }
 
 /* Recombination rate when electron QFL and hole QFL are split
  * QFL: Quasi-Fermi Level  */
 static double
-RR0 (double        Egap,  /* J */
-     double        Emax,  /* J */
-     gsl_function *F_RR0)
+RR0 (double                     Egap,  /* J */
+     double                     Emax,  /* J */
+     gsl_function              *F_RR0,
+     gsl_integration_workspace *int_ws)
 {
   double integral, error;
   size_t iter_lim = 50;
-  gsl_integration_workspace *s_int_ws = gsl_integration_workspace_alloc (iter_lim);
-  gsl_integration_qags (F_RR0, Egap, Emax, 1.49E-08, 1.49E-08, iter_lim, s_int_ws, &integral, &error);
-  gsl_integration_workspace_free (s_int_ws);
+  gsl_integration_qags (F_RR0, Egap, Emax, 1.49E-08, 1.49E-08, iter_lim, int_ws, &integral, &error);
   /* (m^2 s)^(-1) */
   return 2 * M_PI / (c0 * c0 * gsl_pow_3 (hPlanck)) * integral;
 }
 
+/* Same as RR0 () without quadrature: with x = E / (kB T) the integral of RR0_integrand
+ * is (kB T)^3 times the Bose-Einstein integral of x^2 / (exp(x) - 1) */
 static double
-current_density (double             voltage,  /* V */
-                 struct min_params *params)
+RR0_series (double Egap,         /* J */
+            double Emax,         /* J */
+            double temperature)  /* K */
 {
-  /* A/m^2 */
-  return eV * (solar_photons_above_gap (params->Egap, params->Emax, params->F_s) - RR0 (params->Egap, params->Emax, params->F_RR0) * gsl_sf_exp (eV * voltage / (kB * Tcell)));
+  const double kT = kB * temperature;
+  return 2 * M_PI / (c0 * c0 * gsl_pow_3 (hPlanck)) * gsl_pow_3 (kT) * bose_einstein_integral (2, Egap / kT, Emax / kT);
 }
 
-/* Short-circuit current density */
+/* Same as RR0 () with a fixed-order rule on panels 2 kB T wide from Egap.
+ * RR0_integrand falls by about exp(-2) per panel, so nothing is left after 30 of them. */
 static double
-JSC (struct min_params *params)
+RR0_fixed (double                  Egap,         /* J */
+           double                  Emax,         /* J */
+           double                  temperature,  /* K */
+           const struct quad_rule *rule)
 {
-  /* A/m^2 */
-  return current_density (0, params);
+  const double width = 2 * kB * temperature;
+  const double E_stop = GSL_MIN (Emax, Egap + 30 * width);
+  double integral = 0;
+  for (double a = Egap; a < E_stop; a += width)
+    integral += quad_rule_eval (rule, &RR0_integrand, &temperature, a, GSL_MIN (a + width, E_stop));
+  return 2 * M_PI / (c0 * c0 * gsl_pow_3 (hPlanck)) * integral;
 }
 
-/* Open-circuit voltage */
+/* Same as RR0 () with the adaptive native path and the kernel inlined */
 static double
-VOC (struct min_params *params)
+RR0_native (double                  Egap,         /* J */
+            double                  Emax,         /* J */
+            double                  temperature,  /* K */
+            const struct quad_rule *rule)
 {
-  /* V */
-  return (kB * Tcell / eV) * gsl_sf_log (solar_photons_above_gap (params->Egap, params->Emax, params->F_s) / RR0 (params->Egap, params->Emax, params->F_RR0));
+  return SL_RR0_SCALE * sl_native_rr0 (1 / (SL_KB * temperature), rule, Egap, Emax, 1.49E-08, 1.49E-08, NULL);
 }
 
+/* RR0 by the method matching a quadrature: QAGS, the fixed rule, or the series for the table */
 static double
-func_to_minimize (const gsl_vector *v,
-                  void             *params)
+RR0_by (enum sqlimit_quadrature    quadrature,
+        double                     Egap,         /* J */
+        double                     Emax,         /* J */
+        double                     temperature,  /* K */
+        gsl_function              *F_RR0,        // parameter: the temperature
+        gsl_integration_workspace *int_ws,
+        const struct quad_rule    *rule)
 {
-  double voltage = gsl_vector_get (v, 0);
-  return -voltage * current_density (voltage, (struct min_params *)params);
+  switch (quadrature)
+    {
+    case SQLIMIT_QUAD_QAGS:
+      *(double *)F_RR0->params = temperature;
+      return RR0 (Egap, Emax, F_RR0, int_ws);
+    case SQLIMIT_QUAD_GAUSS_LEGENDRE:
+    case SQLIMIT_QUAD_CLENSHAW_CURTIS:
+      return RR0_fixed (Egap, Emax, temperature, rule);
+    case SQLIMIT_QUAD_NATIVE:
+      return RR0_native (Egap, Emax, temperature, rule);
+    case SQLIMIT_QUAD_TABLE:
+    default:
+      return RR0_series (Egap, Emax, temperature);
+    }
 }
 
-static double
-V_mpp (gsl_multimin_function *min_func)
+/* RR0 for every bandgap of a sweep. It does not depend on the spectrum, so one table
+ * serves both passes of sqlimit_main () and every row of sqlimit_main_2d (). */
+static double *
+RR0_sweep (const double              *bandgap,  /* J */
+           size_t                     length,
+           double                     Emax,  /* J */
+           double                     temperature,  /* K */
+           enum sqlimit_quadrature    quadrature,
+           gsl_function              *F_RR0,
+           gsl_integration_workspace *int_ws,
+           const struct quad_rule    *rule)
 {
-  const gsl_multimin_fminimizer_type *T = gsl_multimin_fminimizer_nmsimplex2;
-  gsl_multimin_fminimizer *s = NULL;
-  gsl_vector *ss /* step size */, *x;
-  double retval;
-
-  size_t iter = 0;
-  int status;
-  double size;
-
-  x = gsl_vector_alloc (1);
-  // Compare to initial guess x0 = 0
-  gsl_vector_set (x, 0, 0);
-
-  ss = gsl_vector_alloc (1);
-  // Initial step size step_size = 1.0
-  gsl_vector_set (ss, 0, 1.0);
+  double *rr0 = (double *)calloc (length, sizeof (double));
+  if (!rr0)
+    return NULL;
+  for (size_t i = 0; i < length; i++)
+    rr0[i] = RR0_by (quadrature, bandgap[i], Emax, temperature, F_RR0, int_ws, rule);
+  return rr0;
+}
 
-  s = gsl_multimin_fminimizer_alloc (T, 1);
-  gsl_multimin_fminimizer_set (s, min_func, x, ss);
+static bool
+sqlimit_quad_is_fixed (enum sqlimit_quadrature quadrature)
+{
+  return quadrature == SQLIMIT_QUAD_GAUSS_LEGENDRE || quadrature == SQLIMIT_QUAD_CLENSHAW_CURTIS;
+}
 
-  do
+/* The rule of a quadrature, or NULL for those that do not use one */
+static struct quad_rule *
+sqlimit_quad_rule_alloc (enum sqlimit_quadrature quadrature,
+                         size_t                  order)  // 0 uses 8 points
+{
+  if (!order)
+    order = 8;
+  switch (quadrature)
     {
-      iter++;
-      status = gsl_multimin_fminimizer_iterate (s);
-
-      if (status)
-        break;
-
-      size = gsl_multimin_fminimizer_size (s);
-      // Compare to absolute error in xopt between iterations that is acceptable for convergence xtol = 0.0001
-      // Compare to absolute error in func(xopt) between iterations that is acceptable for convergence ftol = 0.0001
-      status = gsl_multimin_test_size (size, 1E-3);
-
-      if (status == GSL_SUCCESS)
-        {
-          retval = gsl_vector_get (s->x, 0);
-          /* printf ("converged to minimum at iter=%lu V=%lf P=%lf size=%lf\n", iter, retval, -s->fval, size); */
-        }
+    case SQLIMIT_QUAD_GAUSS_LEGENDRE:
+    case SQLIMIT_QUAD_NATIVE:
+      return quad_rule_alloc (QUAD_RULE_GAUSS_LEGENDRE, order);
+    case SQLIMIT_QUAD_CLENSHAW_CURTIS:
+      return quad_rule_alloc (QUAD_RULE_CLENSHAW_CURTIS, order);
+    default:
+      return NULL;
     }
-  // Compare to maximum number of iterations to perform maxiter = None
-  while (status == GSL_CONTINUE /* && iter < 100 */);
+}
 
-  gsl_vector_free (x);
-  gsl_multimin_fminimizer_free (s);
+double
+sqlimit_RR0 (double                  Egap,  /* J */
+             double                  Emax,  /* J */
+             enum sqlimit_quadrature quadrature)
+{
+  if (sqlimit_quad_is_fixed (quadrature) || quadrature == SQLIMIT_QUAD_NATIVE)
+    {
+      struct quad_rule *rule = sqlimit_quad_rule_alloc (quadrature, 0);
+      double rr0 = rule ? RR0_by (quadrature, Egap, Emax, Tcell, NULL, NULL, rule) : GSL_NAN;
+      quad_rule_free (rule);
+      return rr0;
+    }
+  if (quadrature != SQLIMIT_QUAD_QAGS)
+    return RR0_series (Egap, Emax, Tcell);
 
-  return retval;
+  const size_t iter_lim = 50;
+  double temperature = Tcell;
+  gsl_function F_RR0;
+  F_RR0.function = &RR0_integrand;
+  F_RR0.params = &temperature;
+  gsl_integration_workspace *int_ws = gsl_integration_workspace_alloc (iter_lim);
+  gsl_error_handler_t *default_handler = gsl_set_error_handler_off ();
+  double rr0 = RR0 (Egap, Emax, &F_RR0, int_ws);
+  gsl_set_error_handler (default_handler);
+  gsl_integration_workspace_free (int_ws);
+  return rr0;
 }
 
 static double
-J_mpp (gsl_multimin_function *min_func)
+current_density (double voltage,      /* V */
+                 double photons,      /* 1/(m^2 s) */
+                 double rr0,          /* 1/(m^2 s) */
+                 double temperature)  /* K */
 {
-  return current_density (V_mpp (min_func), min_func->params);
+  /* A/m^2 */
+  return eV * (photons - rr0 * gsl_sf_exp (eV * voltage / (kB * temperature)));
 }
 
-static double
-max_power (gsl_multimin_function *min_func)
+/* Maximum power point of J(V) = eV (N - RR0 exp(V / Vt)) with Vt = kB T / eV.
+ * dP/dV = 0 gives (1 + v) exp(v) = N / RR0 for v = V / Vt, i.e. 1 + v = W0(e N / RR0)
+ * with the Lambert W function. N / RR0 is about exp(Voc / Vt) and overflows a double
+ * for wide gaps, so the equivalent h(v) = v + ln(1 + v) - L = 0 with L = ln(N / RR0) = Voc / Vt
+ * is solved instead. h is increasing and concave with h(0) = -L < 0 and h(L) > 0, so Newton
+ * steps are kept inside that bracket (bisecting if a step leaves it) and the loop is capped.
+ * Starting from the asymptotic v = L - ln(1 + L) it takes 2 to 4 steps, each of which
+ * costs two logarithms and no integral. */
+static enum sqlimit_status
+V_mpp (double  L,
+       double *v_mpp)  /* in units of Vt */
 {
-  const double voltage = V_mpp (min_func);
-  return voltage * current_density (voltage, min_func->params);
+  const size_t max_iter = 100;
+  double lo = 0, hi = L;
+  double v = L - gsl_sf_log_1plusx (L);
+
+  for (size_t iter = 0; iter < max_iter; iter++)
+    {
+      const double h = v + gsl_sf_log_1plusx (v) - L;
+      if (h == 0)
+        break;
+      if (h < 0)
+        lo = v;
+      else
+        hi = v;
+
+      double v_new = v - h / (1 + 1 / (1 + v));
+      if (!(v_new > lo && v_new < hi))
+        v_new = (lo + hi) / 2;
+      if (fabs (v_new - v) <= 4 * GSL_DBL_EPSILON * (1 + v_new) || hi - lo <= 4 * GSL_DBL_EPSILON * (1 + hi))
+        {
+          *v_mpp = v_new;
+          return SQLIMIT_OK;
+        }
+      v = v_new;
+    }
+  *v_mpp = v;
+  return fabs (v + gsl_sf_log_1plusx (v) - L) < 1E-10 * L ? SQLIMIT_OK : SQLIMIT_NO_CONVERGENCE;
 }
 
-static double
-max_efficiency (double                 radiation,
-                gsl_multimin_function *min_func)
+/* All figures of merit of a bandgap from its photon flux N and RR0 with one V_mpp () solve.
+ * Bandgaps without a maximum power point keep their Jsc (and Voc if any) and get zero for the rest. */
+static void
+operating_point_from_flux (double                          N,            /* 1/(m^2 s) */
+                           double                          rr0,          /* 1/(m^2 s) */
+                           double                          temperature,  /* K */
+                           double                          radiation,    /* W/m^2 */
+                           struct sqlimit_operating_point *op)
 {
-  return max_power (min_func) / radiation;
+  const double Vt = kB * temperature / eV;
+  double v;
+
+  *op = (struct sqlimit_operating_point) { .status = SQLIMIT_OK };
+  if (!(N > 0) || !gsl_finite (N))
+    {
+      op->status = SQLIMIT_NO_PHOTONS;
+      return;
+    }
+  op->jsc = current_density (0, N, rr0, temperature);
+  if (!(rr0 > 0))
+    {
+      op->status = SQLIMIT_NO_CONVERGENCE;
+      return;
+    }
+
+  const double L = gsl_sf_log (N) - gsl_sf_log (rr0);
+  if (!(L > 0))
+    {
+      op->status = SQLIMIT_NO_VOLTAGE;
+      return;
+    }
+  op->voc = Vt * L;
+
+  op->status = V_mpp (L, &v);
+  if (op->status != SQLIMIT_OK)
+    return;
+  op->vmpp = Vt * v;
+  /* exp(v) = (N / RR0) / (1 + v) at the maximum power point, so no exponential is needed */
+  op->jmpp = eV * N * v / (1 + v);
+  op->fill_factor = op->vmpp * op->jmpp / (op->jsc * op->voc);
+  op->efficiency = op->vmpp * op->jmpp / radiation;
 }
 
-static double
-fill_factor (gsl_multimin_function *min_func)
+/* Operating point of params->Egap, integrating the photon flux once */
+static void
+operating_point (double                          radiation,  /* W/m^2 */
+                 const struct min_params        *params,
+                 struct sqlimit_operating_point *op)
 {
-  return max_power (min_func) / (JSC (min_func->params) * VOC (min_func->params));
+  operating_point_from_flux (solar_photons_above_gap (params), params->rr0, params->Tcell, radiation, op);
 }
 
 static double
@@ -281,22 +450,33 @@ emitted_radiation (double                     temperature,  /* T */
   return 2 * M_PI * hPlanck * c0 * c0 * result;
 }
 
+/* Same as emitted_radiation () without quadrature: with x = hc / (lambda kB T) the integral
+ * of rad_integrand is (kB T / hc)^4 times the Bose-Einstein integral of x^3 / (exp(x) - 1).
+ * It is exact where rad_integrand cuts off at x = 20 and tends to sigma_SB T^4 for a far edge. */
+static double
+emitted_radiation_series (double temperature,      /* K */
+                          double absorption_edge)  /* m */
+{
+  const double kT = kB * temperature;
+  const double x_edge = hPlanck * c0 / (absorption_edge * kT);
+  const double x_lo = hPlanck * c0 / (5E-8 /* m */ * kT);
+  return 2 * M_PI * gsl_pow_4 (kT) / (gsl_pow_3 (hPlanck) * c0 * c0) * bose_einstein_integral (3, x_edge, x_lo);
+}
+
+/* Net power of a solar-thermal absorber at T_hot driving a Carnot engine to 300 K,
+ * from its absorption at 1 sun and its emission, both in W/m^2 */
 static double
-power_generation (double                     T_hot,            /* K */
-                  double                     absorption_edge,  /* m */
-                  unsigned int               concentration,
-                  double                     lambda_min,       /* m */
-                  double                     lambda_max,       /* m */
-                  double                     radiation,   /* W/m^2 */
-                  struct spline_params      *params,
-                  gsl_integration_workspace *int_ws)
+power_generation (double T_hot,          /* K */
+                  double concentration,  /* suns */
+                  double absorbed,       /* W/m^2 */
+                  double emitted)        /* W/m^2 */
 {
   const double T_ambient = 300 /* K */;
   if (T_hot < T_ambient)
     return 0;
 
-  const double hot_side_absorption = absorbed_power (absorption_edge, lambda_min, lambda_max, radiation, params, int_ws);
-  const double hot_side_emission = emitted_radiation (T_hot, absorption_edge, int_ws);
+  const double hot_side_absorption = concentration * absorbed;
+  const double hot_side_emission = emitted;
   const double hot_side_net_absorption = hot_side_absorption - hot_side_emission;
   const double carnot_efficiency = 1 - T_ambient / T_hot;
   return (hot_side_net_absorption > 0) ? hot_side_net_absorption * carnot_efficiency : 0;
@@ -315,14 +495,368 @@ double *linspace (double start,
   return arr;
 }
 
+void
+eff_bg_clear (struct eff_bg *eff_bg_data)
+{
+  if (eff_bg_data->mapping)
+    {
+      munmap (eff_bg_data->mapping, eff_bg_data->mapping_size);
+      *eff_bg_data = (struct eff_bg) {0};
+      return;
+    }
+  free (eff_bg_data->bandgap);
+  free (eff_bg_data->efficiency);
+  free (eff_bg_data->fill_factor);
+  free (eff_bg_data->jsc);
+  free (eff_bg_data->voc);
+  free (eff_bg_data->vmpp);
+  free (eff_bg_data->jmpp);
+  free (eff_bg_data->status);
+  *eff_bg_data = (struct eff_bg) {0};
+}
+
+int
+sqlimit_operating_point (struct csv_data                *spectrum,
+                         double                          Egap,  /* J */
+                         struct sqlimit_operating_point *op)
+{
+  struct spectrum_table *table = spectrum_table_alloc (spectrum->num_datarows);
+  if (!table)
+    return GSL_ENOMEM;
+  int status = spectrum_table_init (table, spectrum->wavelengths, spectrum->intensities);
+  if (status)
+    {
+      spectrum_table_free (table);
+      return status;
+    }
+
+  struct min_params params = {0};
+  params.Egap = Egap;
+  params.Emax = hPlanck * c0 / (spectrum->wavelengths[0] * 1E-9);
+  params.table = table;
+  params.Tcell = Tcell;
+  params.rr0 = RR0_series (params.Egap, params.Emax, params.Tcell);
+  operating_point (spectrum_table_radiation (table), &params, op);
+
+  spectrum_table_free (table);
+  return GSL_SUCCESS;
+}
+
+static int
+sqlimit_worker_init (struct sqlimit_worker       *worker,
+                     gsl_spline                  *spline,
+                     const struct spectrum_table *table,
+                     const struct spectrum_quad  *quad,
+                     const struct quad_rule      *native_rule,  // the native quadrature only
+                     double                       Emax,         /* J */
+                     double                       temperature,  /* K */
+                     size_t                       iter_lim)
+{
+  worker->acc = gsl_interp_accel_alloc ();
+  worker->int_ws = gsl_integration_workspace_alloc (iter_lim);
+  if (!worker->acc || !worker->int_ws)
+    return GSL_ENOMEM;
+
+  worker->spline_params.spline = spline;
+  worker->spline_params.acc = worker->acc;
+  worker->F_s.function = &s_photons_per_tea;
+  worker->F_s.params = &worker->spline_params;
+  worker->F_RR0.function = &RR0_integrand;
+  worker->F_RR0.params = &worker->min_params.Tcell;
+
+  worker->min_params.Emax = Emax;
+  worker->min_params.F_s = &worker->F_s;
+  worker->min_params.F_RR0 = &worker->F_RR0;
+  worker->min_params.int_ws = worker->int_ws;
+  worker->min_params.table = table;
+  worker->min_params.quad = quad;
+  worker->min_params.native_rule = native_rule;
+  worker->min_params.cursor = &worker->cursor;
+  if (spline)
+    sl_linear_cursor_bind (&worker->cursor, spline->x, spline->y, spline->size);
+  worker->min_params.Tcell = temperature;
+  return GSL_SUCCESS;
+}
+
+static void
+sqlimit_worker_clear (struct sqlimit_worker *worker)
+{
+  if (worker->acc)
+    gsl_interp_accel_free (worker->acc);
+  if (worker->int_ws)
+    gsl_integration_workspace_free (worker->int_ws);
+  worker->acc = NULL;
+  worker->int_ws = NULL;
+}
+
+struct sqlimit_sweep
+{
+  struct sqlimit_worker *workers;
+  struct eff_bg         *eff_bg_data;
+  const double          *rr0;  // per bandgap
+  double                 radiation;  /* W/m^2 */
+};
+
+/* Every bandgap is evaluated by the same sequence of floating-point operations
+ * whichever worker picks it up, so the parallel sweep matches the serial one bit for bit. */
+static void
+sqlimit_sweep_range (size_t        begin,
+                     size_t        end,
+                     unsigned int  worker_index,
+                     void         *user_data)
+{
+  struct sqlimit_sweep *sweep = (struct sqlimit_sweep *)user_data;
+  struct sqlimit_worker *worker = &sweep->workers[worker_index];
+  struct eff_bg *eff_bg_data = sweep->eff_bg_data;
+
+  struct sqlimit_operating_point op;
+  for (size_t i = begin; i < end; i++)
+    {
+      worker->min_params.Egap = eff_bg_data->bandgap[i];
+      worker->min_params.rr0 = sweep->rr0[i];
+      operating_point (sweep->radiation, &worker->min_params, &op);
+      eff_bg_data->efficiency[i] = op.efficiency;
+      eff_bg_data->fill_factor[i] = op.fill_factor;
+      eff_bg_data->jsc[i] = op.jsc;
+      eff_bg_data->voc[i] = op.voc;
+      eff_bg_data->vmpp[i] = op.vmpp;
+      eff_bg_data->jmpp[i] = op.jmpp;
+      eff_bg_data->status[i] = op.status;
+    }
+}
+
+static int
+eff_bg_alloc_results (struct eff_bg *eff_bg_data)
+{
+  const size_t n = eff_bg_data->length;
+  eff_bg_data->efficiency = (double *)calloc (n, sizeof (double));
+  eff_bg_data->fill_factor = (double *)calloc (n, sizeof (double));
+  eff_bg_data->jsc = (double *)calloc (n, sizeof (double));
+  eff_bg_data->voc = (double *)calloc (n, sizeof (double));
+  eff_bg_data->vmpp = (double *)calloc (n, sizeof (double));
+  eff_bg_data->jmpp = (double *)calloc (n, sizeof (double));
+  eff_bg_data->status = (enum sqlimit_status *)calloc (n, sizeof (enum sqlimit_status));
+  if (!eff_bg_data->bandgap || !eff_bg_data->efficiency || !eff_bg_data->fill_factor || !eff_bg_data->jsc
+      || !eff_bg_data->voc || !eff_bg_data->vmpp || !eff_bg_data->jmpp || !eff_bg_data->status)
+    return GSL_ENOMEM;
+  return GSL_SUCCESS;
+}
+
+static void
+eff_bg_copy_point (struct eff_bg       *dst,
+                   size_t               j,
+                   const struct eff_bg *src,
+                   size_t               i)
+{
+  dst->bandgap[j] = src->bandgap[i];
+  dst->efficiency[j] = src->efficiency[i];
+  dst->fill_factor[j] = src->fill_factor[i];
+  dst->jsc[j] = src->jsc[i];
+  dst->voc[j] = src->voc[i];
+  dst->vmpp[j] = src->vmpp[i];
+  dst->jmpp[j] = src->jmpp[i];
+  dst->status[j] = src->status[i];
+}
+
+/* Evaluates every bandgap of eff_bg_data on the sweep workers */
+static int
+sqlimit_sweep_evaluate (struct sqlimit_sweep    *sweep,
+                        struct eff_bg           *eff_bg_data,
+                        unsigned int             n_workers,
+                        double                   Emax,  /* J */
+                        enum sqlimit_quadrature  quadrature)
+{
+  const struct min_params *params = &sweep->workers[0].min_params;
+  double *rr0 = RR0_sweep (eff_bg_data->bandgap, eff_bg_data->length, Emax, params->Tcell, quadrature, params->F_RR0, params->int_ws,
+                           params->quad ? params->quad->rule : params->native_rule);
+  if (!rr0)
+    return GSL_ENOMEM;
+  sweep->eff_bg_data = eff_bg_data;
+  sweep->rr0 = rr0;
+  sl_parallel_for (eff_bg_data->length, 1, n_workers, sqlimit_sweep_range, sweep);
+  sweep->rr0 = NULL;
+  free (rr0);
+  return GSL_SUCCESS;
+}
+
+/* Bisects the grid intervals around points whose second difference of efficiency exceeds
+ * a thousandth of the maximum efficiency, and the two intervals next to the maximum,
+ * until no interval is wider than min_step or max_levels passes are done.
+ * Only the new midpoints are evaluated; each pass merges them into eff_bg_data in order. */
+static int
+sqlimit_refine_grid (struct sqlimit_sweep    *sweep,
+                     struct eff_bg           *eff_bg_data,
+                     unsigned int             n_workers,
+                     double                   Emax,      /* J */
+                     enum sqlimit_quadrature  quadrature,
+                     double                   min_step)  /* J */
+{
+  const unsigned int max_levels = 8;
+
+  for (unsigned int level = 0; level < max_levels && eff_bg_data->length >= 3; level++)
+    {
+      const size_t n = eff_bg_data->length;
+      const double *efficiency = eff_bg_data->efficiency;
+      size_t i_max = 0;
+      for (size_t i = 1; i < n; i++)
+        if (efficiency[i] > efficiency[i_max])
+          i_max = i;
+      const double threshold = 1E-3 * efficiency[i_max];
+
+      bool *split = (bool *)calloc (n - 1, sizeof (bool));
+      if (!split)
+        return GSL_ENOMEM;
+      for (size_t i = 1; i + 1 < n; i++)
+        {
+          if (fabs (efficiency[i - 1] - 2 * efficiency[i] + efficiency[i + 1]) > threshold)
+            split[i - 1] = split[i] = true;
+        }
+      if (i_max > 0)
+        split[i_max - 1] = true;
+      if (i_max + 1 < n)
+        split[i_max] = true;
+
+      struct eff_bg fresh = {0};
+      for (size_t i = 0; i + 1 < n; i++)
+        {
+          split[i] = split[i] && eff_bg_data->bandgap[i + 1] - eff_bg_data->bandgap[i] > min_step;
+          fresh.length += split[i];
+        }
+      if (!fresh.length)
+        {
+          free (split);
+          break;
+        }
+
+      fresh.bandgap = (double *)calloc (fresh.length, sizeof (double));
+      struct eff_bg merged = {0};
+      merged.length = n + fresh.length;
+      merged.bandgap = (double *)calloc (merged.length, sizeof (double));
+      if (eff_bg_alloc_results (&fresh) || eff_bg_alloc_results (&merged))
+        {
+          free (split);
+          eff_bg_clear (&fresh);
+          eff_bg_clear (&merged);
+          return GSL_ENOMEM;
+        }
+      for (size_t i = 0, k = 0; i + 1 < n; i++)
+        {
+          if (split[i])
+            fresh.bandgap[k++] = (eff_bg_data->bandgap[i] + eff_bg_data->bandgap[i + 1]) / 2;
+        }
+      int status = sqlimit_sweep_evaluate (sweep, &fresh, n_workers, Emax, quadrature);
+      if (status)
+        {
+          free (split);
+          eff_bg_clear (&fresh);
+          eff_bg_clear (&merged);
+          return status;
+        }
+
+      for (size_t i = 0, j = 0, k = 0; i < n; i++)
+        {
+          eff_bg_copy_point (&merged, j++, eff_bg_data, i);
+          if (i + 1 < n && split[i])
+            eff_bg_copy_point (&merged, j++, &fresh, k++);
+        }
+      DEBUG_PRINT ("Grid refinement pass %u added %zu bandgaps.\n", level, fresh.length);
+      free (split);
+      eff_bg_clear (&fresh);
+      eff_bg_clear (eff_bg_data);
+      *eff_bg_data = merged;
+    }
+  return GSL_SUCCESS;
+}
+
+struct sqlimit_peak_params
+{
+  struct min_params       *min_params;
+  double                   radiation;  /* W/m^2 */
+  enum sqlimit_quadrature  quadrature;
+};
+
+static double
+negative_efficiency (double  Egap,  /* J */
+                     void   *p)
+{
+  struct sqlimit_peak_params *params = (struct sqlimit_peak_params *)p;
+  struct min_params *min_params = params->min_params;
+  struct sqlimit_operating_point op;
+  min_params->Egap = Egap;
+  min_params->rr0 = RR0_by (params->quadrature, Egap, min_params->Emax, min_params->Tcell, min_params->F_RR0, min_params->int_ws,
+                            min_params->quad ? min_params->quad->rule : min_params->native_rule);
+  operating_point (params->radiation, min_params, &op);
+  return -op.efficiency;
+}
+
+/* Sets the peak of eff_bg_data to its best grid point, then, if tolerance > 0 and that point
+ * is interior, narrows the bracket formed by its neighbours with Brent's method
+ * (golden-section steps with parabolic interpolation) until it is at most tolerance wide. */
+static void
+sqlimit_find_peak (struct eff_bg           *eff_bg_data,
+                   struct min_params       *min_params,
+                   double                   radiation,   /* W/m^2 */
+                   enum sqlimit_quadrature  quadrature,
+                   double                   tolerance)   /* J */
+{
+  const size_t max_iter = 100;
+  const size_t n = eff_bg_data->length;
+  size_t i_max = 0;
+  for (size_t i = 1; i < n; i++)
+    if (eff_bg_data->efficiency[i] > eff_bg_data->efficiency[i_max])
+      i_max = i;
+  eff_bg_data->peak_bandgap = eff_bg_data->bandgap[i_max];
+  eff_bg_data->peak_efficiency = eff_bg_data->efficiency[i_max];
+  if (!(tolerance > 0) || i_max == 0 || i_max + 1 >= n)
+    return;
+
+  struct sqlimit_peak_params params = { min_params, radiation, quadrature };
+  gsl_function F;
+  F.function = &negative_efficiency;
+  F.params = &params;
+
+  gsl_min_fminimizer *minimizer = gsl_min_fminimizer_alloc (gsl_min_fminimizer_brent);
+  if (!minimizer)
+    return;
+  /* Fails with GSL_EINVAL on a plateau, where the grid point is as good as any */
+  int status = gsl_min_fminimizer_set_with_values (minimizer, &F,
+                                                   eff_bg_data->bandgap[i_max], -eff_bg_data->efficiency[i_max],
+                                                   eff_bg_data->bandgap[i_max - 1], -eff_bg_data->efficiency[i_max - 1],
+                                                   eff_bg_data->bandgap[i_max + 1], -eff_bg_data->efficiency[i_max + 1]);
+  for (size_t iter = 0; status == GSL_SUCCESS && iter < max_iter; iter++)
+    {
+      status = gsl_min_fminimizer_iterate (minimizer);
+      if (status)
+        break;
+      status = gsl_min_test_interval (gsl_min_fminimizer_x_lower (minimizer), gsl_min_fminimizer_x_upper (minimizer), tolerance, 0);
+      if (status == GSL_SUCCESS)
+        {
+          eff_bg_data->peak_bandgap = gsl_min_fminimizer_x_minimum (minimizer);
+          eff_bg_data->peak_efficiency = -gsl_min_fminimizer_f_minimum (minimizer);
+          DEBUG_PRINT ("Peak converged after %zu Brent iterations.\n", iter + 1);
+          break;
+        }
+      status = GSL_SUCCESS;
+    }
+  gsl_min_fminimizer_free (minimizer);
+}
+
 struct eff_bg
 sqlimit_main (struct csv_data *spectrum,
               bool             axis)
+{
+  return sqlimit_main_full (spectrum, axis, NULL);
+}
+
+struct eff_bg
+sqlimit_main_full (struct csv_data              *spectrum,
+                   bool                          axis,
+                   const struct sqlimit_options *options)
 {
   struct eff_bg eff_bg_data = {0};
+  const unsigned int n_workers = sl_pool_resolve_workers (options ? options->n_threads : 1);
+  const double temperature = options && options->temperature > 0 ? options->temperature : Tcell;  /* K */
 
-  gsl_interp_accel *acc = gsl_interp_accel_alloc ();
-  DEBUG_PRINT ("Interpolation lookup accelerator object allocated.\n");
   // scipy.interpolate.interp1d use `linear` by default
   const gsl_interp_type *t = gsl_interp_linear;
   /* gsl_spline workspace provides a higher level interface for the gsl_interp object
@@ -331,58 +865,106 @@ sqlimit_main (struct csv_data *spectrum,
    * GSL_ERROR ("data must match size of spline object", GSL_EINVAL);
    * If the size is less than the total size of data, the data will be truncated */
   int spline_status;
-  gsl_spline *spline = gsl_spline_alloc (t, spectrum->num_datarows);
-  DEBUG_PRINT ("Spline allocated of size %u.\n", spectrum->num_datarows);
-  if (axis == VERTICAL)  // vertical
-    {
-      spline_status = gsl_spline_init (spline, spectrum->wavelengths, spectrum->intensities, spectrum->num_datarows);
-    }
-  else
+  if (axis != VERTICAL)
     {
       fprintf (stderr, "Axis = 0, Dim = 1 is not implemented.\n");
       return eff_bg_data;
     }
+  gsl_spline *spline = gsl_spline_alloc (t, spectrum->num_datarows);
+  DEBUG_PRINT ("Spline allocated of size %u.\n", spectrum->num_datarows);
+  spline_status = gsl_spline_init (spline, spectrum->wavelengths, spectrum->intensities, spectrum->num_datarows);
   if (spline_status)
     {
       fprintf (stderr, "ERROR: %s\n",  gsl_strerror (spline_status));
     }
   DEBUG_PRINT ("Spline initialized with error number %d.\n", spline_status);
 
+  // No need to manually calculate xmin and xmax by gsl_statistics' gsl_stats_minmax()
+  double lambda_min = spline->interp->xmin * 1E-9, lambda_max = spline->interp->xmax * 1E-9;  /* m */
+  double E_min = hPlanck * c0 / lambda_max, E_max = hPlanck * c0 / lambda_min;  /* J */
+  double E_mean = (E_min + E_max) / 2;  /* J */
+  double E_min_eV = E_min / eV, E_max_eV = E_max / eV, E_mean_eV = E_mean / eV;  /* eV */
+  DEBUG_PRINT ("λ_min = %lf nm, λ_max = %lf nm, E_min = %lf eV, E_max = %lf eV.\n", spline->interp->xmin , spline->interp->xmax, E_min_eV, E_max_eV);
+
+  /* The prefix table replaces the QAGS integral of F_s in every current_density () call */
+  const enum sqlimit_quadrature quadrature = options ? options->quadrature : SQLIMIT_QUAD_TABLE;
+  struct spectrum_table *table = NULL;
+  if (quadrature == SQLIMIT_QUAD_TABLE)
+    {
+      table = spectrum_table_alloc (spectrum->num_datarows);
+      if (!table || spectrum_table_init (table, spectrum->wavelengths, spectrum->intensities))
+        {
+          fprintf (stderr, "ERROR: Failed to tabulate the spectrum.\n");
+          spectrum_table_free (table);
+          gsl_spline_free (spline);
+          return eff_bg_data;
+        }
+    }
+  /* The fixed-order rules precompute their nodes once and integrate segment by segment */
+  struct quad_rule *rule = sqlimit_quad_rule_alloc (quadrature, options ? options->quad_order : 0);
+  struct spectrum_quad *quad = NULL;
+  if (sqlimit_quad_is_fixed (quadrature))
+    {
+      quad = spectrum_quad_alloc (spectrum->num_datarows, rule);
+      if (!rule || !quad || spectrum_quad_init (quad, spectrum->wavelengths, spectrum->intensities))
+        {
+          fprintf (stderr, "ERROR: Failed to precompute the spectrum quadrature.\n");
+          spectrum_quad_free (quad);
+          quad_rule_free (rule);
+          gsl_spline_free (spline);
+          return eff_bg_data;
+        }
+    }
+  else if (quadrature == SQLIMIT_QUAD_NATIVE && !rule)
+    {
+      fprintf (stderr, "ERROR: Failed to allocate the native quadrature rule.\n");
+      gsl_spline_free (spline);
+      return eff_bg_data;
+    }
+
   /* Need to allocate enough size; otherwise
    * ERROR: a maximum of one iteration was insufficient
    * The size allocated for the workspace must be greater than or equal to the iteration limit of QAG; otherwise
    * if (limit > workspace->limit)
-   * GSL_ERROR ("iteration limit exceeds available workspace", GSL_EINVAL) ;  */
+   * GSL_ERROR ("iteration limit exceeds available workspace", GSL_EINVAL) ;
+   * Each worker owns its accelerator, integration workspace and min_params;
+   * worker 0 is the calling thread and is also used for the radiation and the examples below. */
   const size_t iter_lim = 50;
-  gsl_integration_workspace *p_int_ws = gsl_integration_workspace_alloc (iter_lim);
+  struct sqlimit_worker *workers = (struct sqlimit_worker *)calloc (n_workers, sizeof (struct sqlimit_worker));
+  if (!workers)
+    {
+      fprintf (stderr, "ERROR: Failed to allocate %u sqlimit workers.\n", n_workers);
+      spectrum_table_free (table);
+      spectrum_quad_free (quad);
+      quad_rule_free (rule);
+      gsl_spline_free (spline);
+      return eff_bg_data;
+    }
+  for (unsigned int w = 0; w < n_workers; w++)
+    {
+      if (sqlimit_worker_init (&workers[w], spline, table, quad, quad ? NULL : rule, E_max, temperature, iter_lim))
+        {
+          fprintf (stderr, "ERROR: Failed to allocate sqlimit worker %u.\n", w);
+          for (unsigned int k = 0; k <= w; k++)
+            sqlimit_worker_clear (&workers[k]);
+          free (workers);
+          spectrum_table_free (table);
+          spectrum_quad_free (quad);
+          quad_rule_free (rule);
+          gsl_spline_free (spline);
+          return eff_bg_data;
+        }
+    }
+  DEBUG_PRINT ("%u sqlimit worker(s) allocated.\n", n_workers);
 
   // For the solar spectrum, the radiation is the solar constant approximately equal to 1000 W/m^2
   double radiation;  // the final approximation from the extrapolation `result`
   double error;  // an estimate of the absolute error `abserr`
-  struct spline_params sql_spline_params;
-  sql_spline_params.spline = spline;
-  sql_spline_params.acc = acc;
-
-  gsl_function F_p, F_s, F_RR0;
+  gsl_function F_p;
   F_p.function = &power_per_tea;
-  F_s.function = &s_photons_per_tea;
-  F_RR0.function = &RR0_integrand;
-  F_p.params = &sql_spline_params;
-  F_s.params = &sql_spline_params;
-  F_RR0.params = NULL;
-
-  // No need to manually calculate xmin and xmax by gsl_statistics' gsl_stats_minmax()
-  double lambda_min = spline->interp->xmin * 1E-9, lambda_max = spline->interp->xmax * 1E-9;  /* m */
-  double E_min = hPlanck * c0 / lambda_max, E_max = hPlanck * c0 / lambda_min;  /* J */
-  double E_mean = (E_min + E_max) / 2;  /* J */
-  double E_min_eV = E_min / eV, E_max_eV = E_max / eV, E_mean_eV = E_mean / eV;  /* eV */
-  DEBUG_PRINT ("λ_min = %lf nm, λ_max = %lf nm, E_min = %lf eV, E_max = %lf eV.\n", spline->interp->xmin , spline->interp->xmax, E_min_eV, E_max_eV);
-  DEBUG_PRINT ("EXAMPLE: s_photons_per_tea(E_mean = %lf eV) = %.17g\n", E_mean_eV, s_photons_per_tea (E_mean, F_s.params) * 1E-3 * eV);
+  F_p.params = &workers[0].spline_params;
 
-  struct min_params sql_min_params;
-  sql_min_params.Emax = E_max;
-  sql_min_params.F_s = &F_s;
-  sql_min_params.F_RR0 = &F_RR0;
+  DEBUG_PRINT ("EXAMPLE: s_photons_per_tea(E_mean = %lf eV) = %.17g\n", E_mean_eV, s_photons_per_tea (E_mean, F_p.params) * 1E-3 * eV);
 
   /* epsabs, epsrel, and limit=50 keep same as scipy.integrate.quad (full_output=0 to show full output)
    * points=None, weight=None; no infinite bounds => QUADPACK routine is qagse
@@ -402,169 +984,2846 @@ sqlimit_main (struct csv_data *spectrum,
    * GSL_ERROR ("maximum number of subdivisions reached", GSL_EMAXITER);
    * error code is GSL_EMAXITER = 11
    * exceeded max number of iterations
-   * Thus, we have to "pass" the error  */
+   * Thus, we have to "pass" the error.
+   * The table has none of these problems; QAGS is still used for RR0 and the legacy quadrature.
+   * The handler is process-wide, so it is switched off before any worker thread starts. */
   gsl_error_handler_t *default_handler = gsl_set_error_handler_off ();
-  int err_code = gsl_integration_qags (&F_p, E_min, E_max, 1.49E-08, 1.49E-08, iter_lim, p_int_ws, &radiation, &error);
-  DEBUG_PRINT ("(Error code %d) Calculated radiation is %lf W/m^2 with error %lf.\n", err_code, radiation, error);
-  DEBUG_PRINT ("EXAMPLE: solar_photons_above_gap(E_g = %lf eV) = %lf / (m^2 s)\n", 1.5, solar_photons_above_gap (1.5 * eV, E_max, &F_s));
-
-  /* Use Nelder-Mead (downhill) Simplex algorithm (minimizing without derivatives)
-   * gsl_multimin_fminizer_nmsimplex and gsl_multimin_fminimizer_nmsimplex2 are both of O(N^2) memory usage
-   * but gsl_multimin_fminimizer_nmsimplex2 is O(N) operations while gsl_multimin_fminimizer_nmsimplex is O(N^2) operations */
-  gsl_multimin_function min_func;
-
-  min_func.n = 1;  // Number of function components
-  min_func.f = &func_to_minimize;
-  sql_min_params.Egap = 1.5 * eV;
-  min_func.params = &sql_min_params;
-
-  DEBUG_PRINT ("EXAMPLE: RR0(E_g = %lf eV) = %lf /(m^2 s)\n", 1.5, RR0 (sql_min_params.Egap, sql_min_params.Emax, sql_min_params.F_RR0));
-  DEBUG_PRINT ("EXAMPLE: JSC(E_g = %lf eV) = %lf A/m^2\n", 1.5, JSC (&sql_min_params));
-  DEBUG_PRINT ("EXAMPLE: VOC(E_g = %lf eV) = %lf V\n", 1.5, VOC (&sql_min_params));
-  DEBUG_PRINT ("EXAMPLE: V_mpp(E_g = %lf eV) = %lf V\n", 1.5, V_mpp (&min_func));
-  DEBUG_PRINT ("EXAMPLE: max_efficiency(E_g = %lf eV) = %lf%%\n", 1.5, max_efficiency (radiation, &min_func) * 100);
-  DEBUG_PRINT ("EXAMPLE: fill_factor(E_g = %lf eV) = %lf\n", 1.5, fill_factor (&min_func));
+  if (table)
+    {
+      radiation = spectrum_table_radiation (table);
+      DEBUG_PRINT ("Tabulated radiation is %lf W/m^2.\n", radiation);
+    }
+  else if (quad)
+    {
+      radiation = spectrum_quad_radiation (quad);
+      DEBUG_PRINT ("Fixed-order radiation is %lf W/m^2.\n", radiation);
+    }
+  else if (rule)
+    {
+      radiation = sl_native_power (&workers[0].cursor, rule, E_min, E_max, 1.49E-08, 1.49E-08, &error);
+      DEBUG_PRINT ("Native radiation is %lf W/m^2 with error %lf.\n", radiation, error);
+    }
+  else
+    {
+      int err_code = gsl_integration_qags (&F_p, E_min, E_max, 1.49E-08, 1.49E-08, iter_lim, workers[0].int_ws, &radiation, &error);
+      DEBUG_PRINT ("(Error code %d) Calculated radiation is %lf W/m^2 with error %lf.\n", err_code, radiation, error);
+    }
 
-  eff_bg_data.length = 100;
-  // Start and end of the linear space should be a little narrower, otherwise it will stuck at the last loop below.
+  /* V_mpp () solves dP/dV = 0 directly, see there; it used to be a Nelder-Mead simplex search */
+  struct min_params *sql_min_params = &workers[0].min_params;
+  struct sqlimit_operating_point example;
+  sql_min_params->Egap = 1.5 * eV;
+  sql_min_params->rr0 = RR0_by (quadrature, sql_min_params->Egap, E_max, temperature, sql_min_params->F_RR0, sql_min_params->int_ws, rule);
+
+  DEBUG_PRINT ("EXAMPLE: solar_photons_above_gap(E_g = %lf eV) = %lf / (m^2 s)\n", 1.5, solar_photons_above_gap (sql_min_params));
+
+  DEBUG_PRINT ("EXAMPLE: RR0(E_g = %lf eV) = %lf /(m^2 s)\n", 1.5, sql_min_params->rr0);
+  DEBUG_PRINT ("check RR0 series against QAGS (should equal 1): %.12lf\n", RR0_series (sql_min_params->Egap, E_max, temperature) / RR0 (sql_min_params->Egap, E_max, sql_min_params->F_RR0, sql_min_params->int_ws));
+  operating_point (radiation, sql_min_params, &example);
+  DEBUG_PRINT ("EXAMPLE: JSC(E_g = %lf eV) = %lf A/m^2\n", 1.5, example.jsc);
+  DEBUG_PRINT ("EXAMPLE: VOC(E_g = %lf eV) = %lf V\n", 1.5, example.voc);
+  DEBUG_PRINT ("EXAMPLE: V_mpp(E_g = %lf eV) = %lf V (status %d)\n", 1.5, example.vmpp, example.status);
+  DEBUG_PRINT ("EXAMPLE: J_mpp(E_g = %lf eV) = %lf A/m^2\n", 1.5, example.jmpp);
+  DEBUG_PRINT ("EXAMPLE: max_efficiency(E_g = %lf eV) = %lf%%\n", 1.5, example.efficiency * 100);
+  DEBUG_PRINT ("EXAMPLE: fill_factor(E_g = %lf eV) = %lf\n", 1.5, example.fill_factor);
+
+  /* The adaptive grid starts coarse and spends its points where the efficiency curves */
+  const enum sqlimit_grid grid = options ? options->grid : SQLIMIT_GRID_UNIFORM;
+  eff_bg_data.length = options && options->n_points >= 3 ? options->n_points : (grid == SQLIMIT_GRID_ADAPTIVE ? 33 : 100);
+  const double peak_tolerance = (options && options->peak_tolerance > 0 ? options->peak_tolerance : 1E-3) * eV;  /* J */
+  // Start and end of the linear space are a little narrower than the spectrum, where nothing happens.
   // Also do not exceed the E_min and E_max limit.
   eff_bg_data.bandgap = linspace (E_min + 0.01 * eV, E_max - 0.01 * eV, eff_bg_data.length);
-  eff_bg_data.efficiency = (double *)calloc (eff_bg_data.length, sizeof (double));
-
-  clock_t timer;
-  timer = clock ();
-  for (size_t i = 0; i < eff_bg_data.length; i++)
+  int sweep_status = eff_bg_alloc_results (&eff_bg_data);
+
+  struct sqlimit_sweep sweep;
+  sweep.workers = workers;
+  sweep.radiation = radiation;
+
+  /* clock () sums the CPU time of all threads, so time the sweep with the wall clock */
+  struct timespec t_start, t_end;
+  clock_gettime (CLOCK_MONOTONIC, &t_start);
+  if (!sweep_status)
+    sweep_status = sqlimit_sweep_evaluate (&sweep, &eff_bg_data, n_workers, E_max, quadrature);
+  if (!sweep_status && grid == SQLIMIT_GRID_ADAPTIVE)
+    sweep_status = sqlimit_refine_grid (&sweep, &eff_bg_data, n_workers, E_max, quadrature, 4 * peak_tolerance);
+  if (sweep_status)
     {
-      sql_min_params.Egap = eff_bg_data.bandgap[i];
-      min_func.params = &sql_min_params;
-      eff_bg_data.efficiency[i] = max_efficiency (radiation, &min_func);
+      fprintf (stderr, "ERROR: %s\n", gsl_strerror (sweep_status));
+      eff_bg_clear (&eff_bg_data);
+      gsl_set_error_handler (default_handler);
+      for (unsigned int w = 0; w < n_workers; w++)
+        sqlimit_worker_clear (&workers[w]);
+      free (workers);
+      spectrum_table_free (table);
+      spectrum_quad_free (quad);
+      quad_rule_free (rule);
+      gsl_spline_free (spline);
+      return eff_bg_data;
     }
-  timer = clock () - timer;
-  DEBUG_PRINT ("Time cost: %lf s\n", ((double) timer) / CLOCKS_PER_SEC);
-  gsl_vector_view eff_list = gsl_vector_view_array (eff_bg_data.efficiency, eff_bg_data.length);
-  printf ("Max efficiency %lf%% at %lf eV\n", gsl_vector_max (&eff_list.vector) * 100, E_min_eV + gsl_vector_max_index (&eff_list.vector) * (E_max_eV - E_min_eV) / (eff_bg_data.length - 1));
-
-#ifdef DEBUG
-  eff_bg_data.fill_factor = (double *)calloc (eff_bg_data.length, sizeof (double));
+  sqlimit_find_peak (&eff_bg_data, &workers[0].min_params, radiation, quadrature, grid == SQLIMIT_GRID_ADAPTIVE ? peak_tolerance : 0);
+  clock_gettime (CLOCK_MONOTONIC, &t_end);
+  DEBUG_PRINT ("Time cost: %lf s with %u worker(s)\n", (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) * 1E-9, n_workers);
   for (size_t i = 0; i < eff_bg_data.length; i++)
     {
-      sql_min_params.Egap = eff_bg_data.bandgap[i];
-      min_func.params = &sql_min_params;
-      eff_bg_data.fill_factor[i] = fill_factor (&min_func);
+      if (eff_bg_data.status[i] == SQLIMIT_NO_CONVERGENCE)
+        fprintf (stderr, "WARNING: V_mpp did not converge at E_g = %lf eV.\n", eff_bg_data.bandgap[i] / eV);
+      else if (eff_bg_data.status[i] != SQLIMIT_OK)
+        DEBUG_PRINT ("No maximum power point at E_g = %lf eV (status %d).\n", eff_bg_data.bandgap[i] / eV, eff_bg_data.status[i]);
     }
-#endif
+  printf ("Max efficiency %lf%% at %lf eV (%zu bandgaps)\n", eff_bg_data.peak_efficiency * 100, eff_bg_data.peak_bandgap / eV, eff_bg_data.length);
 
-  DEBUG_PRINT ("EXAMPLE: absorbed_power(1000 nm) = %lf\n", absorbed_power (1E-6, lambda_min, lambda_max, radiation, &sql_spline_params, p_int_ws));
-  DEBUG_PRINT ("check Stefan–Boltzmann law (should equal 1): %lf\n", sigma_SB * gsl_pow_4 (345 /* K */) / emitted_radiation (345 /*K*/, 8E-5 /* m */, p_int_ws));
+  DEBUG_PRINT ("EXAMPLE: absorbed_power(1000 nm) = %lf\n", absorbed_power (1E-6, lambda_min, lambda_max, radiation, &workers[0].spline_params, workers[0].int_ws));
+  DEBUG_PRINT ("check Stefan–Boltzmann law (should equal 1): %lf\n", sigma_SB * gsl_pow_4 (345 /* K */) / emitted_radiation (345 /*K*/, 8E-5 /* m */, workers[0].int_ws));
+  DEBUG_PRINT ("check emission series against QAGS (should equal 1): %lf\n", emitted_radiation_series (2000 /* K */, 2E-6 /* m */) / emitted_radiation (2000 /* K */, 2E-6 /* m */, workers[0].int_ws));
 
   // Restore the default error handler
   gsl_set_error_handler (default_handler);
 
+  for (unsigned int w = 0; w < n_workers; w++)
+    sqlimit_worker_clear (&workers[w]);
+  free (workers);
+  spectrum_table_free (table);
+  spectrum_quad_free (quad);
+  quad_rule_free (rule);
   gsl_spline_free (spline);
-  gsl_interp_accel_free (acc);
-  gsl_integration_workspace_free (p_int_ws);
 
   return eff_bg_data;
 }
 
-struct eff_bg_2d
-sqlimit_main_2d (struct csv_data_2d *spectrum,
-                 bool                axis)
+/* Photon flux above every bandgap of a map sweep, which is the only spectrum integral
+ * the map needs: the second axis of the map then only rescales or reuses it. */
+struct sqlimit_flux_sweep
 {
-  unsigned int i = 0;
-  struct eff_bg_2d eff_bg_data = {0};
+  struct sqlimit_worker *workers;
+  const double          *bandgap;
+  double                *photons;
+};
 
-  gsl_interp_accel *acc = gsl_interp_accel_alloc ();
-  const gsl_interp_type *t = gsl_interp_linear;
-  gsl_spline **splines = (gsl_spline **)calloc (spectrum->num_datarows, sizeof (gsl_spline *));
-  if (axis == HORIZONTAL)  // horizontal
-    {
-      for (i = 0; i < spectrum->num_datarows; i++)
-        {
-          splines[i] = gsl_spline_alloc (t, spectrum->num_fields);
-          gsl_spline_init (splines[i], spectrum->wavelengths, spectrum->intensities[i], spectrum->num_fields);
-        }
-    }
-  else
+static void
+sqlimit_flux_range (size_t        begin,
+                    size_t        end,
+                    unsigned int  worker_index,
+                    void         *user_data)
+{
+  struct sqlimit_flux_sweep *sweep = (struct sqlimit_flux_sweep *)user_data;
+  struct min_params *min_params = &sweep->workers[worker_index].min_params;
+
+  for (size_t i = begin; i < end; i++)
     {
-      fprintf (stderr, "Axis = 1, Dim = 2 is not implemented.\n");
-      return eff_bg_data;
+      min_params->Egap = sweep->bandgap[i];
+      sweep->photons[i] = solar_photons_above_gap (min_params);
     }
+}
 
-  const size_t iter_lim = 50;
-  gsl_integration_workspace *p_int_ws = gsl_integration_workspace_alloc (iter_lim);
-
-  double radiation, error, lambda_min, lambda_max, E_min, E_max;
-  struct spline_params sql_spline_params;
-  sql_spline_params.acc = acc;
-
-  gsl_function F_p, F_s, F_RR0;
-  F_p.function = &power_per_tea;
-  F_s.function = &s_photons_per_tea;
-  F_RR0.function = &RR0_integrand;
-  F_RR0.params = NULL;
-
-  gsl_multimin_function min_func;
-  min_func.n = 1;
-  min_func.f = &func_to_minimize;
+struct sqlimit_tcell_sweep
+{
+  struct sqlimit_worker   *workers;
+  struct eff_bg_tcell     *eff_bg_data;
+  const double            *photons;  // per bandgap, shared by every temperature
+  double                   Emax;  /* J */
+  double                   radiation;  /* W/m^2 */
+  enum sqlimit_quadrature  quadrature;
+};
 
-  lambda_min = splines[0]->interp->xmin * 1E-9;
-  lambda_max = splines[0]->interp->xmax * 1E-9;
-  E_min = hPlanck * c0 / lambda_max;
-  E_max = hPlanck * c0 / lambda_min;
+/* Items are numbered temperature-major; only RR0 and the diode equation depend on the temperature */
+static void
+sqlimit_tcell_range (size_t        begin,
+                     size_t        end,
+                     unsigned int  worker_index,
+                     void         *user_data)
+{
+  struct sqlimit_tcell_sweep *sweep = (struct sqlimit_tcell_sweep *)user_data;
+  struct sqlimit_worker *worker = &sweep->workers[worker_index];
+  struct eff_bg_tcell *eff_bg_data = sweep->eff_bg_data;
+  struct sqlimit_operating_point op;
 
-  struct min_params sql_min_params;
-  sql_min_params.Emax = E_max;
-  sql_min_params.F_RR0 = &F_RR0;
+  for (size_t item = begin; item < end; item++)
+    {
+      const size_t t = item / eff_bg_data->length, i = item % eff_bg_data->length;
+      const double Egap = eff_bg_data->bandgap[i];
+      double rr0;
+      worker->min_params.Tcell = eff_bg_data->temperature[t];
+      rr0 = RR0_by (sweep->quadrature, Egap, sweep->Emax, worker->min_params.Tcell, &worker->F_RR0, worker->int_ws,
+                    worker->min_params.quad ? worker->min_params.quad->rule : worker->min_params.native_rule);
+      operating_point_from_flux (sweep->photons[i], rr0, worker->min_params.Tcell, sweep->radiation, &op);
+      eff_bg_data->efficiency[t][i] = op.efficiency;
+    }
+}
 
-  eff_bg_data.length = 100;
-  /* The stop value should be less than E_max; otherwise, wavelengths will be out of range;
-   * however, the start value could be less than or equal to E_min.
-   * The stop value should also not be exactly same as E_max;
-   * otherwise, the program will iterate infinitely in V_mpp(). */
-  eff_bg_data.bandgap = linspace (E_min, 0.999 * E_max, eff_bg_data.length);
-  eff_bg_data.efficiency = (double **)calloc (spectrum->num_datarows, sizeof (double *));
+void
+eff_bg_tcell_clear (struct eff_bg_tcell *eff_bg_data)
+{
+  if (eff_bg_data->efficiency)
+    {
+      for (size_t t = 0; t < eff_bg_data->n_temperatures; t++)
+        free (eff_bg_data->efficiency[t]);
+    }
+  free (eff_bg_data->efficiency);
+  free (eff_bg_data->bandgap);
+  free (eff_bg_data->temperature);
+  *eff_bg_data = (struct eff_bg_tcell) {0};
+}
 
-  gsl_vector_view eff_list;
-  gsl_error_handler_t *default_handler = gsl_set_error_handler_off ();
-//  progressbar *minimizing_eff = progressbar_new ("", spectrum->num_datarows);
-  FILE *fout = fopen ("/home/ayka-tsuzuki/gnome-semilab/test/poly_spectrum_results.txt", "w");
+/* What every bandgap map (bandgap × temperature, bandgap × concentration) shares:
+ * one interpolation of the spectrum, the sweep workers and the 1-sun radiation */
+struct sqlimit_map
+{
+  gsl_spline              *spline;  // QAGS and native quadratures only
+  struct spectrum_table   *table;   // table quadrature only
+  struct quad_rule        *rule;    // fixed-order and native quadratures only
+  struct spectrum_quad    *quad;    // fixed-order quadratures only
+  struct sqlimit_worker   *workers;
+  unsigned int             n_workers;
+  enum sqlimit_quadrature  quadrature;
+  double                   E_min;  /* J */
+  double                   E_max;  /* J */
+  double                   radiation;  /* W/m^2 */
+  double                  *bandgap;
+  double                  *photons;  // per bandgap
+  double                  *rr0;      // per bandgap at options->temperature, only if requested
+  size_t                   length;
+  gsl_error_handler_t     *default_handler;
+};
 
-  for (i = 0; i < spectrum->num_datarows; i++)
+static void
+sqlimit_map_clear (struct sqlimit_map *map)
+{
+  if (map->workers)
     {
-      eff_bg_data.efficiency[i] = (double *)calloc (eff_bg_data.length, sizeof (double));
-
-      sql_spline_params.spline = splines[i];
-      F_p.params = &sql_spline_params;
-      F_s.params = &sql_spline_params;
-      sql_min_params.F_s = &F_s;
+      for (unsigned int w = 0; w < map->n_workers; w++)
+        sqlimit_worker_clear (&map->workers[w]);
+    }
+  free (map->workers);
+  free (map->photons);
+  free (map->rr0);
+  spectrum_table_free (map->table);
+  spectrum_quad_free (map->quad);
+  quad_rule_free (map->rule);
+  gsl_spline_free (map->spline);
+  if (map->default_handler)
+    gsl_set_error_handler (map->default_handler);
+  *map = (struct sqlimit_map) {0};
+}
 
-      gsl_integration_qags (&F_p, E_min, E_max, 1.49E-08, 1.49E-08, iter_lim, p_int_ws, &radiation, &error);
+/* Sets up the map of a spectrum and integrates the photon flux above each bandgap once.
+ * The bandgap grid is allocated here but owned by the caller's result from then on.
+ * Leaves the GSL error handler off until sqlimit_map_clear (). */
+static int
+sqlimit_map_init (struct sqlimit_map           *map,
+                  struct csv_data              *spectrum,
+                  const struct sqlimit_options *options,
+                  bool                          need_rr0)
+{
+  const size_t iter_lim = 50;
+  const double temperature = options && options->temperature > 0 ? options->temperature : Tcell;  /* K */
 
-      for (size_t j = 0; j < eff_bg_data.length; j++)
+  *map = (struct sqlimit_map) {0};
+  map->n_workers = sl_pool_resolve_workers (options ? options->n_threads : 1);
+  map->quadrature = options ? options->quadrature : SQLIMIT_QUAD_TABLE;
+  if (map->quadrature == SQLIMIT_QUAD_TABLE)
+    {
+      map->table = spectrum_table_alloc (spectrum->num_datarows);
+      if (!map->table || spectrum_table_init (map->table, spectrum->wavelengths, spectrum->intensities))
         {
-          sql_min_params.Egap = eff_bg_data.bandgap[j];
-          min_func.params = &sql_min_params;
-          eff_bg_data.efficiency[i][j] = max_efficiency (radiation, &min_func);
+          fprintf (stderr, "ERROR: Failed to tabulate the spectrum.\n");
+          return GSL_EINVAL;
         }
-
-      eff_list = gsl_vector_view_array (eff_bg_data.efficiency[i], eff_bg_data.length);
-
-      fprintf (fout, "Max efficiency %lf%% at %lf eV\n", gsl_vector_max(&eff_list.vector) * 100, (E_min + gsl_vector_max_index (&eff_list.vector) * (0.999 * E_max - E_min) / (eff_bg_data.length - 1)) / eV);
-
-      gsl_spline_free (splines[i]);
-//      progressbar_inc (minimizing_eff);
     }
-
-  fclose (fout);
-//  progressbar_finish (minimizing_eff);
-
-  gsl_set_error_handler (default_handler);
-
-  free (splines);
-  gsl_interp_accel_free (acc);
-  gsl_integration_workspace_free (p_int_ws);
-
-  return eff_bg_data;
-}
-
+  else if (sqlimit_quad_is_fixed (map->quadrature))
+    {
+      map->rule = sqlimit_quad_rule_alloc (map->quadrature, options ? options->quad_order : 0);
+      map->quad = map->rule ? spectrum_quad_alloc (spectrum->num_datarows, map->rule) : NULL;
+      if (!map->quad || spectrum_quad_init (map->quad, spectrum->wavelengths, spectrum->intensities))
+        {
+          fprintf (stderr, "ERROR: Failed to precompute the spectrum quadrature.\n");
+          return GSL_EINVAL;
+        }
+    }
+  else
+    {
+      if (map->quadrature == SQLIMIT_QUAD_NATIVE)
+        {
+          map->rule = sqlimit_quad_rule_alloc (map->quadrature, options ? options->quad_order : 0);
+          if (!map->rule)
+            return GSL_ENOMEM;
+        }
+      map->spline = gsl_spline_alloc (gsl_interp_linear, spectrum->num_datarows);
+      if (!map->spline || gsl_spline_init (map->spline, spectrum->wavelengths, spectrum->intensities, spectrum->num_datarows))
+        {
+          fprintf (stderr, "ERROR: Failed to interpolate the spectrum.\n");
+          return GSL_EINVAL;
+        }
+    }
+  map->E_min = hPlanck * c0 / (spectrum->wavelengths[spectrum->num_datarows - 1] * 1E-9);
+  map->E_max = hPlanck * c0 / (spectrum->wavelengths[0] * 1E-9);
+
+  map->workers = (struct sqlimit_worker *)calloc (map->n_workers, sizeof (struct sqlimit_worker));
+  if (!map->workers)
+    return GSL_ENOMEM;
+  for (unsigned int w = 0; w < map->n_workers; w++)
+    {
+      if (sqlimit_worker_init (&map->workers[w], map->spline, map->table, map->quad, map->quad ? NULL : map->rule, map->E_max, temperature, iter_lim))
+        return GSL_ENOMEM;
+    }
+
+  map->length = options && options->n_points >= 3 ? options->n_points : 100;
+  map->bandgap = linspace (map->E_min + 0.01 * eV, map->E_max - 0.01 * eV, map->length);
+  map->photons = (double *)calloc (map->length, sizeof (double));
+  if (!map->bandgap || !map->photons)
+    return GSL_ENOMEM;
+
+  /* QAGS gives up on the Bose-Einstein integrand, see sqlimit_main_full () */
+  map->default_handler = gsl_set_error_handler_off ();
+  if (map->table)
+    map->radiation = spectrum_table_radiation (map->table);
+  else if (map->quad)
+    map->radiation = spectrum_quad_radiation (map->quad);
+  else if (map->rule)
+    map->radiation = sl_native_power (&map->workers[0].cursor, map->rule, map->E_min, map->E_max, 1.49E-08, 1.49E-08, NULL);
+  else
+    {
+      double error;
+      gsl_function F_p;
+      F_p.function = &power_per_tea;
+      F_p.params = &map->workers[0].spline_params;
+      gsl_integration_qags (&F_p, map->E_min, map->E_max, 1.49E-08, 1.49E-08, iter_lim, map->workers[0].int_ws, &map->radiation, &error);
+    }
+
+  struct sqlimit_flux_sweep flux = { map->workers, map->bandgap, map->photons };
+  sl_parallel_for (map->length, 1, map->n_workers, sqlimit_flux_range, &flux);
+  if (need_rr0)
+    {
+      map->rr0 = RR0_sweep (map->bandgap, map->length, map->E_max, temperature, map->quadrature, &map->workers[0].F_RR0, map->workers[0].int_ws, map->rule);
+      if (!map->rr0)
+        return GSL_ENOMEM;
+    }
+  return GSL_SUCCESS;
+}
+
+struct eff_bg_tcell
+sqlimit_main_tcell (struct csv_data              *spectrum,
+                    bool                          axis,
+                    const double                 *temperatures,  /* K */
+                    size_t                        n_temperatures,
+                    const struct sqlimit_options *options)
+{
+  struct eff_bg_tcell eff_bg_data = {0};
+  struct sqlimit_map map;
+
+  if (axis != VERTICAL)
+    {
+      fprintf (stderr, "Axis = 0, Dim = 1 is not implemented.\n");
+      return eff_bg_data;
+    }
+  for (size_t t = 0; t < n_temperatures; t++)
+    {
+      if (!(temperatures[t] > 0))
+        {
+          fprintf (stderr, "ERROR: Cell temperature %lf K is not positive.\n", temperatures[t]);
+          return eff_bg_data;
+        }
+    }
+
+  int status = sqlimit_map_init (&map, spectrum, options, false);
+  eff_bg_data.bandgap = map.bandgap;
+  eff_bg_data.length = map.length;
+  eff_bg_data.n_temperatures = n_temperatures;
+  eff_bg_data.temperature = (double *)calloc (n_temperatures, sizeof (double));
+  eff_bg_data.efficiency = (double **)calloc (n_temperatures, sizeof (double *));
+  if (!status && (!eff_bg_data.temperature || !eff_bg_data.efficiency))
+    status = GSL_ENOMEM;
+  for (size_t t = 0; !status && t < n_temperatures; t++)
+    {
+      eff_bg_data.temperature[t] = temperatures[t];
+      eff_bg_data.efficiency[t] = (double *)calloc (eff_bg_data.length, sizeof (double));
+      if (!eff_bg_data.efficiency[t])
+        status = GSL_ENOMEM;
+    }
+
+  if (status)
+    {
+      fprintf (stderr, "ERROR: Failed to set up the cell temperature sweep: %s\n", gsl_strerror (status));
+      eff_bg_tcell_clear (&eff_bg_data);
+    }
+  else
+    {
+      struct sqlimit_tcell_sweep sweep;
+      sweep.workers = map.workers;
+      sweep.eff_bg_data = &eff_bg_data;
+      sweep.photons = map.photons;
+      sweep.Emax = map.E_max;
+      sweep.radiation = map.radiation;
+      sweep.quadrature = map.quadrature;
+      sl_parallel_for (eff_bg_data.length * n_temperatures, 1, map.n_workers, sqlimit_tcell_range, &sweep);
+    }
+
+  sqlimit_map_clear (&map);
+  return eff_bg_data;
+}
+
+struct sqlimit_concentration_sweep
+{
+  struct eff_bg_concentration *eff_bg_data;
+  const double                *photons;  // per bandgap at 1 sun
+  const double                *rr0;      // per bandgap, independent of the concentration
+  double                       temperature;  /* K */
+  double                       radiation;  /* W/m^2 at 1 sun */
+};
+
+/* Concentrating X suns multiplies the absorbed photon flux and the incident power by X
+ * and leaves the dark recombination RR0 alone, so every item is a V_mpp () solve only */
+static void
+sqlimit_concentration_range (size_t        begin,
+                             size_t        end,
+                             unsigned int  worker_index,
+                             void         *user_data)
+{
+  struct sqlimit_concentration_sweep *sweep = (struct sqlimit_concentration_sweep *)user_data;
+  struct eff_bg_concentration *eff_bg_data = sweep->eff_bg_data;
+  struct sqlimit_operating_point op;
+
+  for (size_t item = begin; item < end; item++)
+    {
+      const size_t c = item / eff_bg_data->length, i = item % eff_bg_data->length;
+      const double X = eff_bg_data->concentration[c];
+      operating_point_from_flux (X * sweep->photons[i], sweep->rr0[i], sweep->temperature, X * sweep->radiation, &op);
+      eff_bg_data->efficiency[c][i] = op.efficiency;
+    }
+}
+
+void
+eff_bg_concentration_clear (struct eff_bg_concentration *eff_bg_data)
+{
+  if (eff_bg_data->efficiency)
+    {
+      for (size_t c = 0; c < eff_bg_data->n_concentrations; c++)
+        free (eff_bg_data->efficiency[c]);
+    }
+  free (eff_bg_data->efficiency);
+  free (eff_bg_data->bandgap);
+  free (eff_bg_data->concentration);
+  *eff_bg_data = (struct eff_bg_concentration) {0};
+}
+
+struct eff_bg_concentration
+sqlimit_main_concentration (struct csv_data              *spectrum,
+                            bool                          axis,
+                            const double                 *concentrations,  /* suns */
+                            size_t                        n_concentrations,
+                            const struct sqlimit_options *options)
+{
+  /* 1 / sin^2 of the angular radius of the sun (0.2665 deg) */
+  const double max_concentration = 46200;
+  /* Items are a few logarithms each, so hand them out in larger chunks */
+  const size_t grain = 256;
+  struct eff_bg_concentration eff_bg_data = {0};
+  struct sqlimit_map map;
+
+  if (axis != VERTICAL)
+    {
+      fprintf (stderr, "Axis = 0, Dim = 1 is not implemented.\n");
+      return eff_bg_data;
+    }
+  for (size_t c = 0; c < n_concentrations; c++)
+    {
+      if (!(concentrations[c] >= 1 && concentrations[c] <= max_concentration))
+        {
+          fprintf (stderr, "ERROR: Concentration %lf is not in the range of [1, %.0lf] suns.\n", concentrations[c], max_concentration);
+          return eff_bg_data;
+        }
+    }
+
+  int status = sqlimit_map_init (&map, spectrum, options, true);
+  eff_bg_data.bandgap = map.bandgap;
+  eff_bg_data.length = map.length;
+  eff_bg_data.n_concentrations = n_concentrations;
+  eff_bg_data.concentration = (double *)calloc (n_concentrations, sizeof (double));
+  eff_bg_data.efficiency = (double **)calloc (n_concentrations, sizeof (double *));
+  if (!status && (!eff_bg_data.concentration || !eff_bg_data.efficiency))
+    status = GSL_ENOMEM;
+  for (size_t c = 0; !status && c < n_concentrations; c++)
+    {
+      eff_bg_data.concentration[c] = concentrations[c];
+      eff_bg_data.efficiency[c] = (double *)calloc (eff_bg_data.length, sizeof (double));
+      if (!eff_bg_data.efficiency[c])
+        status = GSL_ENOMEM;
+    }
+
+  if (status)
+    {
+      fprintf (stderr, "ERROR: Failed to set up the concentration sweep: %s\n", gsl_strerror (status));
+      eff_bg_concentration_clear (&eff_bg_data);
+    }
+  else
+    {
+      struct sqlimit_concentration_sweep sweep;
+      sweep.eff_bg_data = &eff_bg_data;
+      sweep.photons = map.photons;
+      sweep.rr0 = map.rr0;
+      sweep.temperature = map.workers[0].min_params.Tcell;
+      sweep.radiation = map.radiation;
+      sl_parallel_for (eff_bg_data.length * n_concentrations, grain, map.n_workers, sqlimit_concentration_range, &sweep);
+    }
+
+  sqlimit_map_clear (&map);
+  return eff_bg_data;
+}
+
+/* Absorptance kernels of a bandgap sweep, one per worker since each caches its last bandgap */
+struct sqlimit_absorber_sweep
+{
+  struct absorptance_kernel **kernels;
+  const double               *bandgap;  /* J */
+  size_t                      length;
+  struct eff_bg              *eff_bg_data;     // sqlimit_main_absorber () only
+  double                      thickness;       /* m, sqlimit_main_absorber () only */
+  struct eff_bg_thickness    *thickness_data;  // sqlimit_main_thickness () only
+  double                      temperature;     /* K */
+  atomic_int                  status;
+};
+
+static void
+sqlimit_absorber_sweep_clear (struct sqlimit_absorber_sweep *sweep,
+                              unsigned int                   n_workers)
+{
+  for (unsigned int w = 0; sweep->kernels && w < n_workers; w++)
+    absorptance_kernel_free (sweep->kernels[w]);
+  free (sweep->kernels);
+  sweep->kernels = NULL;
+}
+
+static int
+sqlimit_absorber_sweep_init (struct sqlimit_absorber_sweep    *sweep,
+                             struct csv_data                  *spectrum,
+                             const struct absorptance_params  *absorber,
+                             const struct sqlimit_options     *options,
+                             unsigned int                      n_workers)
+{
+  *sweep = (struct sqlimit_absorber_sweep) {0};
+  sweep->temperature = options && options->temperature > 0 ? options->temperature : Tcell;  /* K */
+  atomic_init (&sweep->status, GSL_SUCCESS);
+  sweep->kernels = (struct absorptance_kernel **)calloc (n_workers, sizeof (struct absorptance_kernel *));
+  if (!sweep->kernels)
+    return GSL_ENOMEM;
+  for (unsigned int w = 0; w < n_workers; w++)
+    {
+      sweep->kernels[w] = absorptance_kernel_alloc (absorber, spectrum->wavelengths, spectrum->intensities, spectrum->num_datarows, sweep->temperature);
+      if (!sweep->kernels[w])
+        return GSL_EINVAL;
+    }
+  return GSL_SUCCESS;
+}
+
+static void
+sqlimit_absorber_range (size_t        begin,
+                        size_t        end,
+                        unsigned int  worker_index,
+                        void         *user_data)
+{
+  struct sqlimit_absorber_sweep *sweep = (struct sqlimit_absorber_sweep *)user_data;
+  struct absorptance_kernel *kernel = sweep->kernels[worker_index];
+  struct eff_bg *eff_bg_data = sweep->eff_bg_data;
+  struct sqlimit_operating_point op;
+
+  for (size_t i = begin; i < end; i++)
+    {
+      if (absorptance_kernel_set (kernel, eff_bg_data->bandgap[i], sweep->thickness))
+        {
+          atomic_store (&sweep->status, GSL_EDOM);
+          return;
+        }
+      operating_point_from_flux (absorptance_kernel_photons (kernel), absorptance_kernel_rr0 (kernel), sweep->temperature, kernel->radiation, &op);
+      eff_bg_data->efficiency[i] = op.efficiency;
+      eff_bg_data->fill_factor[i] = op.fill_factor;
+      eff_bg_data->jsc[i] = op.jsc;
+      eff_bg_data->voc[i] = op.voc;
+      eff_bg_data->vmpp[i] = op.vmpp;
+      eff_bg_data->jmpp[i] = op.jmpp;
+      eff_bg_data->status[i] = op.status;
+    }
+}
+
+/* Detailed-balance sweep of an absorber that is not an ideal step: the same A(E) weights the
+ * absorbed sunlight and the emission behind RR0. thickness is ignored by the step and Urbach
+ * models. The peak is the best grid point. */
+struct eff_bg
+sqlimit_main_absorber (struct csv_data                 *spectrum,
+                       bool                             axis,
+                       const struct absorptance_params *absorber,
+                       double                           thickness,  /* m */
+                       const struct sqlimit_options    *options)
+{
+  struct eff_bg eff_bg_data = {0};
+  struct sqlimit_absorber_sweep sweep;
+  const unsigned int n_workers = sl_pool_resolve_workers (options ? options->n_threads : 1);
+
+  if (axis != VERTICAL)
+    {
+      fprintf (stderr, "Axis = 0, Dim = 1 is not implemented.\n");
+      return eff_bg_data;
+    }
+
+  int status = sqlimit_absorber_sweep_init (&sweep, spectrum, absorber, options, n_workers);
+  const double E_min = hPlanck * c0 / (spectrum->wavelengths[spectrum->num_datarows - 1] * 1E-9);  /* J */
+  const double E_max = hPlanck * c0 / (spectrum->wavelengths[0] * 1E-9);  /* J */
+  eff_bg_data.length = options && options->n_points >= 3 ? options->n_points : 100;
+  eff_bg_data.bandgap = linspace (E_min + 0.01 * eV, E_max - 0.01 * eV, eff_bg_data.length);
+  if (!status)
+    status = eff_bg_alloc_results (&eff_bg_data);
+  if (!status)
+    {
+      sweep.eff_bg_data = &eff_bg_data;
+      sweep.thickness = thickness;
+      sl_parallel_for (eff_bg_data.length, 1, n_workers, sqlimit_absorber_range, &sweep);
+      status = atomic_load (&sweep.status);
+    }
+
+  if (status)
+    {
+      fprintf (stderr, "ERROR: Failed to sweep the absorber: %s\n", gsl_strerror (status));
+      eff_bg_clear (&eff_bg_data);
+    }
+  else
+    {
+      size_t best = 0;
+      for (size_t i = 1; i < eff_bg_data.length; i++)
+        {
+          if (eff_bg_data.efficiency[i] > eff_bg_data.efficiency[best])
+            best = i;
+        }
+      eff_bg_data.peak_bandgap = eff_bg_data.bandgap[best];
+      eff_bg_data.peak_efficiency = eff_bg_data.efficiency[best];
+      printf ("Max efficiency %lf%% at %lf eV (%zu bandgaps)\n", eff_bg_data.peak_efficiency * 100, eff_bg_data.peak_bandgap / eV, eff_bg_data.length);
+    }
+  sqlimit_absorber_sweep_clear (&sweep, n_workers);
+  return eff_bg_data;
+}
+
+/* One bandgap per item: the absorption coefficient on the spectrum grid is looked up once
+ * and every thickness only updates A and takes the two dot products */
+static void
+sqlimit_thickness_range (size_t        begin,
+                         size_t        end,
+                         unsigned int  worker_index,
+                         void         *user_data)
+{
+  struct sqlimit_absorber_sweep *sweep = (struct sqlimit_absorber_sweep *)user_data;
+  struct absorptance_kernel *kernel = sweep->kernels[worker_index];
+  struct eff_bg_thickness *eff_bg_data = sweep->thickness_data;
+  struct sqlimit_operating_point op;
+
+  for (size_t i = begin; i < end; i++)
+    {
+      for (size_t t = 0; t < eff_bg_data->n_thicknesses; t++)
+        {
+          if (absorptance_kernel_set (kernel, eff_bg_data->bandgap[i], eff_bg_data->thickness[t]))
+            {
+              atomic_store (&sweep->status, GSL_EDOM);
+              return;
+            }
+          operating_point_from_flux (absorptance_kernel_photons (kernel), absorptance_kernel_rr0 (kernel), sweep->temperature, kernel->radiation, &op);
+          eff_bg_data->efficiency[t][i] = op.efficiency;
+        }
+    }
+}
+
+void
+eff_bg_thickness_clear (struct eff_bg_thickness *eff_bg_data)
+{
+  if (eff_bg_data->efficiency)
+    {
+      for (size_t t = 0; t < eff_bg_data->n_thicknesses; t++)
+        free (eff_bg_data->efficiency[t]);
+    }
+  free (eff_bg_data->efficiency);
+  free (eff_bg_data->bandgap);
+  free (eff_bg_data->thickness);
+  *eff_bg_data = (struct eff_bg_thickness) {0};
+}
+
+struct eff_bg_thickness
+sqlimit_main_thickness (struct csv_data                 *spectrum,
+                        bool                             axis,
+                        const struct absorptance_params *absorber,
+                        const double                    *thicknesses,  /* m */
+                        size_t                           n_thicknesses,
+                        const struct sqlimit_options    *options)
+{
+  struct eff_bg_thickness eff_bg_data = {0};
+  struct sqlimit_absorber_sweep sweep;
+  const unsigned int n_workers = sl_pool_resolve_workers (options ? options->n_threads : 1);
+
+  if (axis != VERTICAL)
+    {
+      fprintf (stderr, "Axis = 0, Dim = 1 is not implemented.\n");
+      return eff_bg_data;
+    }
+  for (size_t t = 0; t < n_thicknesses; t++)
+    {
+      if (!(thicknesses[t] > 0))
+        {
+          fprintf (stderr, "ERROR: Absorber thickness %g m is not positive.\n", thicknesses[t]);
+          return eff_bg_data;
+        }
+    }
+
+  int status = sqlimit_absorber_sweep_init (&sweep, spectrum, absorber, options, n_workers);
+  const double E_min = hPlanck * c0 / (spectrum->wavelengths[spectrum->num_datarows - 1] * 1E-9);  /* J */
+  const double E_max = hPlanck * c0 / (spectrum->wavelengths[0] * 1E-9);  /* J */
+  eff_bg_data.length = options && options->n_points >= 3 ? options->n_points : 100;
+  eff_bg_data.bandgap = linspace (E_min + 0.01 * eV, E_max - 0.01 * eV, eff_bg_data.length);
+  eff_bg_data.n_thicknesses = n_thicknesses;
+  eff_bg_data.thickness = (double *)calloc (n_thicknesses, sizeof (double));
+  eff_bg_data.efficiency = (double **)calloc (n_thicknesses, sizeof (double *));
+  if (!status && (!eff_bg_data.bandgap || !eff_bg_data.thickness || !eff_bg_data.efficiency))
+    status = GSL_ENOMEM;
+  for (size_t t = 0; !status && t < n_thicknesses; t++)
+    {
+      eff_bg_data.thickness[t] = thicknesses[t];
+      eff_bg_data.efficiency[t] = (double *)calloc (eff_bg_data.length, sizeof (double));
+      if (!eff_bg_data.efficiency[t])
+        status = GSL_ENOMEM;
+    }
+  if (!status)
+    {
+      sweep.thickness_data = &eff_bg_data;
+      sl_parallel_for (eff_bg_data.length, 1, n_workers, sqlimit_thickness_range, &sweep);
+      status = atomic_load (&sweep.status);
+    }
+
+  if (status)
+    {
+      fprintf (stderr, "ERROR: Failed to set up the thickness sweep: %s\n", gsl_strerror (status));
+      eff_bg_thickness_clear (&eff_bg_data);
+    }
+  sqlimit_absorber_sweep_clear (&sweep, n_workers);
+  return eff_bg_data;
+}
+
+struct sqlimit_thermal_sweep
+{
+  struct sqlimit_map *map;
+  struct eff_thermal *eff_data;
+  const double       *absorbed;  // per absorption edge at 1 sun
+  double             *emitted;   // n_T_hot × n_edges, the emission cache
+  double              lambda_max;  /* m */
+};
+
+/* Absorbed power at 1 sun below an absorption edge, from the prefix table or fixed rule when there is one */
+static double
+thermal_absorbed_power (const struct sqlimit_map *map,
+                        struct sqlimit_worker    *worker,
+                        double                    absorption_edge,  /* m */
+                        double                    lambda_min,       /* m */
+                        double                    lambda_max)       /* m */
+{
+  if (map->table)
+    return absorption_edge > lambda_max ? map->radiation : spectrum_table_power_below (map->table, absorption_edge * 1E9);
+  if (map->quad)
+    return spectrum_quad_power_below (map->quad, absorption_edge * 1E9);
+  if (map->rule)
+    return absorption_edge > lambda_max ? map->radiation
+                                        : sl_native_interp (&worker->cursor, map->rule, lambda_min, absorption_edge, 1.49E-08, 1.49E-08, NULL);
+  return absorbed_power (absorption_edge, lambda_min, lambda_max, map->radiation, &worker->spline_params, worker->int_ws);
+}
+
+/* Fills the emission cache; it depends on neither the spectrum nor the concentration */
+static void
+sqlimit_thermal_emission_range (size_t        begin,
+                                size_t        end,
+                                unsigned int  worker_index,
+                                void         *user_data)
+{
+  struct sqlimit_thermal_sweep *sweep = (struct sqlimit_thermal_sweep *)user_data;
+  const struct eff_thermal *eff_data = sweep->eff_data;
+
+  for (size_t item = begin; item < end; item++)
+    {
+      const size_t t = item / eff_data->n_edges, e = item % eff_data->n_edges;
+      sweep->emitted[item] = emitted_radiation_series (eff_data->T_hot[t], eff_data->absorption_edge[e]);
+    }
+}
+
+static void
+sqlimit_thermal_map_range (size_t        begin,
+                           size_t        end,
+                           unsigned int  worker_index,
+                           void         *user_data)
+{
+  struct sqlimit_thermal_sweep *sweep = (struct sqlimit_thermal_sweep *)user_data;
+  struct eff_thermal *eff_data = sweep->eff_data;
+  const size_t n_cells = eff_data->n_T_hot * eff_data->n_edges;
+
+  for (size_t item = begin; item < end; item++)
+    {
+      const size_t c = item / n_cells, cell = item % n_cells;
+      const size_t t = cell / eff_data->n_edges, e = cell % eff_data->n_edges;
+      const double X = eff_data->concentration[c];
+      eff_data->efficiency[c][cell] = power_generation (eff_data->T_hot[t], X, sweep->absorbed[e], sweep->emitted[cell])
+                                      / (X * sweep->map->radiation);
+    }
+}
+
+struct thermal_min_params
+{
+  const struct sqlimit_map *map;
+  struct sqlimit_worker    *worker;
+  double                    concentration;  /* suns */
+  double                    lambda_min;     /* m */
+  double                    lambda_max;     /* m */
+};
+
+/* The simplex works on T_hot / 1000 K and the edge in um so that both steps are O(1) */
+static double
+thermal_negative_efficiency (const gsl_vector *x,
+                             void             *p)
+{
+  struct thermal_min_params *params = (struct thermal_min_params *)p;
+  const double T_hot = gsl_vector_get (x, 0) * 1E3;  /* K */
+  const double absorption_edge = gsl_vector_get (x, 1) * 1E-6;  /* m */
+  if (!(absorption_edge >= params->lambda_min && absorption_edge <= params->lambda_max) || !(T_hot > 0))
+    return 0;
+  const double absorbed = thermal_absorbed_power (params->map, params->worker, absorption_edge, params->lambda_min, params->lambda_max);
+  const double emitted = emitted_radiation_series (T_hot, absorption_edge);
+  return -power_generation (T_hot, params->concentration, absorbed, emitted) / (params->concentration * params->map->radiation);
+}
+
+/* Polishes the best grid point of each concentration with the Nelder-Mead simplex,
+ * whose first steps span one grid cell */
+static void
+sqlimit_thermal_refine_range (size_t        begin,
+                              size_t        end,
+                              unsigned int  worker_index,
+                              void         *user_data)
+{
+  struct sqlimit_thermal_sweep *sweep = (struct sqlimit_thermal_sweep *)user_data;
+  struct eff_thermal *eff_data = sweep->eff_data;
+  const size_t n_cells = eff_data->n_T_hot * eff_data->n_edges;
+  const size_t max_iter = 500;
+
+  struct thermal_min_params params;
+  params.map = sweep->map;
+  params.worker = &sweep->map->workers[worker_index];
+  params.lambda_min = eff_data->absorption_edge[0];
+  params.lambda_max = sweep->lambda_max;
+  gsl_multimin_function min_func;
+  min_func.n = 2;
+  min_func.f = &thermal_negative_efficiency;
+  min_func.params = &params;
+
+  gsl_multimin_fminimizer *minimizer = gsl_multimin_fminimizer_alloc (gsl_multimin_fminimizer_nmsimplex2, 2);
+  gsl_vector *x = gsl_vector_alloc (2);
+  gsl_vector *step = gsl_vector_alloc (2);
+  for (size_t c = begin; c < end; c++)
+    {
+      size_t best = 0;
+      for (size_t cell = 1; cell < n_cells; cell++)
+        if (eff_data->efficiency[c][cell] > eff_data->efficiency[c][best])
+          best = cell;
+      eff_data->best_T_hot[c] = eff_data->T_hot[best / eff_data->n_edges];
+      eff_data->best_edge[c] = eff_data->absorption_edge[best % eff_data->n_edges];
+      eff_data->best_efficiency[c] = eff_data->efficiency[c][best];
+      if (!minimizer || !x || !step || !(eff_data->best_efficiency[c] > 0))
+        continue;
+
+      params.concentration = eff_data->concentration[c];
+      gsl_vector_set (x, 0, eff_data->best_T_hot[c] * 1E-3);
+      gsl_vector_set (x, 1, eff_data->best_edge[c] * 1E6);
+      gsl_vector_set (step, 0, eff_data->n_T_hot > 1 ? (eff_data->T_hot[1] - eff_data->T_hot[0]) * 1E-3 : 0.1);
+      gsl_vector_set (step, 1, eff_data->n_edges > 1 ? (eff_data->absorption_edge[1] - eff_data->absorption_edge[0]) * 1E6 : 0.1);
+      gsl_multimin_fminimizer_set (minimizer, &min_func, x, step);
+      int status = GSL_CONTINUE;
+      for (size_t iter = 0; status == GSL_CONTINUE && iter < max_iter; iter++)
+        {
+          if (gsl_multimin_fminimizer_iterate (minimizer))
+            break;
+          status = gsl_multimin_test_size (gsl_multimin_fminimizer_size (minimizer), 1E-6);
+        }
+      if (-minimizer->fval > eff_data->best_efficiency[c])
+        {
+          eff_data->best_T_hot[c] = gsl_vector_get (minimizer->x, 0) * 1E3;
+          eff_data->best_edge[c] = gsl_vector_get (minimizer->x, 1) * 1E-6;
+          eff_data->best_efficiency[c] = -minimizer->fval;
+        }
+    }
+  gsl_vector_free (step);
+  gsl_vector_free (x);
+  if (minimizer)
+    gsl_multimin_fminimizer_free (minimizer);
+}
+
+void
+eff_thermal_clear (struct eff_thermal *eff_data)
+{
+  if (eff_data->efficiency)
+    {
+      for (size_t c = 0; c < eff_data->n_concentrations; c++)
+        free (eff_data->efficiency[c]);
+    }
+  free (eff_data->efficiency);
+  free (eff_data->T_hot);
+  free (eff_data->absorption_edge);
+  free (eff_data->concentration);
+  free (eff_data->best_T_hot);
+  free (eff_data->best_edge);
+  free (eff_data->best_efficiency);
+  *eff_data = (struct eff_thermal) {0};
+}
+
+struct eff_thermal
+sqlimit_main_thermal (struct csv_data              *spectrum,
+                      bool                          axis,
+                      const double                 *concentrations,  /* suns */
+                      size_t                        n_concentrations,
+                      double                        T_min,           /* K */
+                      double                        T_max,           /* K */
+                      const struct sqlimit_options *options)
+{
+  const size_t grain = 256;
+  struct eff_thermal eff_data = {0};
+  struct sqlimit_map map;
+
+  if (axis != VERTICAL)
+    {
+      fprintf (stderr, "Axis = 0, Dim = 1 is not implemented.\n");
+      return eff_data;
+    }
+  if (!(T_min > 0 && T_max > T_min))
+    {
+      fprintf (stderr, "ERROR: Absorber temperatures [%lf K, %lf K] are not a valid range.\n", T_min, T_max);
+      return eff_data;
+    }
+  for (size_t c = 0; c < n_concentrations; c++)
+    {
+      if (!(concentrations[c] >= 1))
+        {
+          fprintf (stderr, "ERROR: Concentration %lf is less than 1 sun.\n", concentrations[c]);
+          return eff_data;
+        }
+    }
+
+  int status = sqlimit_map_init (&map, spectrum, options, false);
+  /* Absorber grid: n_points absorption edges across the spectrum and as many temperatures */
+  const double lambda_min = spectrum->wavelengths[0] * 1E-9, lambda_max = spectrum->wavelengths[spectrum->num_datarows - 1] * 1E-9;  /* m */
+  eff_data.n_T_hot = eff_data.n_edges = map.length;
+  eff_data.n_concentrations = n_concentrations;
+  eff_data.T_hot = linspace (T_min, T_max, eff_data.n_T_hot);
+  eff_data.absorption_edge = linspace (lambda_min, lambda_max, eff_data.n_edges);
+  eff_data.concentration = (double *)calloc (n_concentrations, sizeof (double));
+  eff_data.efficiency = (double **)calloc (n_concentrations, sizeof (double *));
+  eff_data.best_T_hot = (double *)calloc (n_concentrations, sizeof (double));
+  eff_data.best_edge = (double *)calloc (n_concentrations, sizeof (double));
+  eff_data.best_efficiency = (double *)calloc (n_concentrations, sizeof (double));
+  double *absorbed = (double *)calloc (eff_data.n_edges, sizeof (double));
+  double *emitted = (double *)calloc (eff_data.n_T_hot * eff_data.n_edges, sizeof (double));
+  if (!status && (!eff_data.T_hot || !eff_data.absorption_edge || !eff_data.concentration || !eff_data.efficiency
+                  || !eff_data.best_T_hot || !eff_data.best_edge || !eff_data.best_efficiency || !absorbed || !emitted))
+    status = GSL_ENOMEM;
+  for (size_t c = 0; !status && c < n_concentrations; c++)
+    {
+      eff_data.concentration[c] = concentrations[c];
+      eff_data.efficiency[c] = (double *)calloc (eff_data.n_T_hot * eff_data.n_edges, sizeof (double));
+      if (!eff_data.efficiency[c])
+        status = GSL_ENOMEM;
+    }
+
+  if (status)
+    {
+      fprintf (stderr, "ERROR: Failed to set up the solar-thermal sweep: %s\n", gsl_strerror (status));
+      eff_thermal_clear (&eff_data);
+    }
+  else
+    {
+      for (size_t e = 0; e < eff_data.n_edges; e++)
+        absorbed[e] = thermal_absorbed_power (&map, &map.workers[0], eff_data.absorption_edge[e], lambda_min, lambda_max);
+
+      struct sqlimit_thermal_sweep sweep;
+      sweep.map = &map;
+      sweep.eff_data = &eff_data;
+      sweep.absorbed = absorbed;
+      sweep.emitted = emitted;
+      sweep.lambda_max = lambda_max;
+      sl_parallel_for (eff_data.n_T_hot * eff_data.n_edges, grain, map.n_workers, sqlimit_thermal_emission_range, &sweep);
+      sl_parallel_for (n_concentrations * eff_data.n_T_hot * eff_data.n_edges, grain, map.n_workers, sqlimit_thermal_map_range, &sweep);
+      sl_parallel_for (n_concentrations, 1, map.n_workers, sqlimit_thermal_refine_range, &sweep);
+    }
+
+  free (absorbed);
+  free (emitted);
+  /* The bandgap grid of the map is not part of the result */
+  free (map.bandgap);
+  sqlimit_map_clear (&map);
+  return eff_data;
+}
+
+struct tandem_candidate
+{
+  size_t index[SQLIMIT_MAX_JUNCTIONS];  // grid index of each junction, top junction first
+  double efficiency;
+  size_t n_evaluated;
+};
+
+struct tandem_search
+{
+  const struct sqlimit_map *map;
+  const double             *power_above;  /* W/m^2 of the photons above each grid bandgap */
+  unsigned int              n_junctions;
+  enum sqlimit_tandem       connection;
+  double                    temperature;  /* K */
+  _Atomic double            best;         // best efficiency found by any worker, for pruning
+  struct tandem_candidate  *candidates;   // best stack of each top bandgap
+};
+
+/* Photons absorbed by the junction at grid index i under the one at index above
+ * (the whole flux above the gap for the top junction, above == length) */
+static double
+tandem_photons (const struct sqlimit_map *map,
+                size_t                    i,
+                size_t                    above)
+{
+  return above < map->length ? map->photons[i] - map->photons[above] : map->photons[i];
+}
+
+/* Maximum power of series-connected junctions sharing the current j (in photons):
+ * P(j) = e Vt j sum ln((N_k - j) / RR0_k), whose derivative
+ * g(j) = sum ln((N_k - j) / RR0_k) - j sum 1 / (N_k - j) decreases from g(0) to -inf
+ * at j = min N_k, so its root is bracketed and found by the same safeguarded Newton as V_mpp () */
+static double
+tandem_series_power (const double *N,
+                     const double *rr0,
+                     unsigned int  n_junctions,
+                     double        temperature)  /* K */
+{
+  const size_t max_iter = 100;
+  const double Vt = kB * temperature / eV;
+  double lo = 0, hi = N[0];
+  for (unsigned int k = 1; k < n_junctions; k++)
+    hi = GSL_MIN (hi, N[k]);
+  if (!(hi > 0))
+    return 0;
+
+  double g0 = 0;
+  for (unsigned int k = 0; k < n_junctions; k++)
+    g0 += gsl_sf_log (N[k] / rr0[k]);
+  if (!(g0 > 0))
+    return 0;
+
+  double j = hi / 2;
+  for (size_t iter = 0; iter < max_iter; iter++)
+    {
+      double g = 0, dg = 0;
+      for (unsigned int k = 0; k < n_junctions; k++)
+        {
+          const double rest = N[k] - j;
+          g += gsl_sf_log (rest / rr0[k]) - j / rest;
+          dg -= 2 / rest + j / (rest * rest);
+        }
+      if (g > 0)
+        lo = j;
+      else
+        hi = j;
+      double j_new = j - g / dg;
+      if (!(j_new > lo && j_new < hi))
+        j_new = (lo + hi) / 2;
+      const bool converged = fabs (j_new - j) <= 4 * GSL_DBL_EPSILON * j_new;
+      j = j_new;
+      if (converged)
+        break;
+    }
+
+  double voltage = 0;
+  for (unsigned int k = 0; k < n_junctions; k++)
+    voltage += Vt * gsl_sf_log ((N[k] - j) / rr0[k]);
+  return voltage > 0 ? eV * j * voltage : 0;
+}
+
+/* Efficiency of the complete stack in index[] */
+static double
+tandem_efficiency (const struct tandem_search *search,
+                   const size_t               *index)
+{
+  const struct sqlimit_map *map = search->map;
+  double N[SQLIMIT_MAX_JUNCTIONS], rr0[SQLIMIT_MAX_JUNCTIONS];
+  double efficiency = 0;
+  struct sqlimit_operating_point op;
+
+  for (unsigned int k = 0; k < search->n_junctions; k++)
+    {
+      N[k] = tandem_photons (map, index[k], k ? index[k - 1] : map->length);
+      rr0[k] = map->rr0[index[k]];
+      if (search->connection == SQLIMIT_TANDEM_INDEPENDENT)
+        {
+          operating_point_from_flux (N[k], rr0[k], search->temperature, map->radiation, &op);
+          efficiency += op.efficiency;
+        }
+    }
+  if (search->connection == SQLIMIT_TANDEM_SERIES)
+    efficiency = tandem_series_power (N, rr0, search->n_junctions, search->temperature) / map->radiation;
+  return efficiency;
+}
+
+/* Depth-first over descending bandgaps. Junction depth - 1 is fixed once its own gap and the one
+ * above are, so the fixed junctions contribute their exact 4-terminal efficiency (an upper bound of
+ * the series one). With Voc < Egap, a junction delivers less than its gap per absorbed photon, so
+ * the next junction at gap i yields at most Egap_i per photon above it, and those below at most the
+ * power of the photons under Egap_i. Branches whose bound cannot beat the best stack are skipped. */
+static void
+tandem_search_branch (struct tandem_search    *search,
+                      unsigned int             depth,
+                      size_t                  *index,
+                      double                   fixed,  // efficiency of junctions 0 .. depth - 2
+                      struct tandem_candidate *candidate)
+{
+  const struct sqlimit_map *map = search->map;
+  const unsigned int remaining = search->n_junctions - depth;
+  const size_t last = index[depth - 1];
+  struct sqlimit_operating_point op;
+
+  operating_point_from_flux (tandem_photons (map, last, depth > 1 ? index[depth - 2] : map->length),
+                             map->rr0[last], search->temperature, map->radiation, &op);
+  fixed += op.efficiency;
+  if (!remaining)
+    {
+      candidate->n_evaluated++;
+      const double efficiency = search->connection == SQLIMIT_TANDEM_INDEPENDENT ? fixed : tandem_efficiency (search, index);
+      if (efficiency > candidate->efficiency)
+        {
+          candidate->efficiency = efficiency;
+          memcpy (candidate->index, index, search->n_junctions * sizeof (size_t));
+          double best = atomic_load (&search->best);
+          while (efficiency > best && !atomic_compare_exchange_weak (&search->best, &best, efficiency))
+            ;
+        }
+      return;
+    }
+
+  /* The other remaining - 1 junctions need distinct grid points below this one */
+  for (size_t i = last; i-- > remaining - 1;)
+    {
+      const double upper = fixed + (map->bandgap[i] * (map->photons[i] - map->photons[last])
+                                    + search->power_above[0] - search->power_above[i]) / map->radiation;
+      if (upper < atomic_load (&search->best))
+        continue;
+      index[depth] = i;
+      tandem_search_branch (search, depth + 1, index, fixed, candidate);
+    }
+}
+
+static void
+sqlimit_tandem_range (size_t        begin,
+                      size_t        end,
+                      unsigned int  worker_index,
+                      void         *user_data)
+{
+  struct tandem_search *search = (struct tandem_search *)user_data;
+  size_t index[SQLIMIT_MAX_JUNCTIONS];
+
+  for (size_t item = begin; item < end; item++)
+    {
+      /* Item 0 is the highest top bandgap */
+      index[0] = search->map->length - 1 - item;
+      tandem_search_branch (search, 1, index, 0, &search->candidates[item]);
+    }
+}
+
+struct eff_tandem
+sqlimit_main_tandem (struct csv_data              *spectrum,
+                     bool                          axis,
+                     unsigned int                  n_junctions,
+                     enum sqlimit_tandem           connection,
+                     const struct sqlimit_options *options)
+{
+  struct eff_tandem eff_data = {0};
+  struct sqlimit_map map;
+
+  if (axis != VERTICAL)
+    {
+      fprintf (stderr, "Axis = 0, Dim = 1 is not implemented.\n");
+      return eff_data;
+    }
+  if (n_junctions < 1 || n_junctions > SQLIMIT_MAX_JUNCTIONS)
+    {
+      fprintf (stderr, "ERROR: %u junctions are not in the range of [1, %d].\n", n_junctions, SQLIMIT_MAX_JUNCTIONS);
+      return eff_data;
+    }
+
+  int status = sqlimit_map_init (&map, spectrum, options, true);
+  const double lambda_min = spectrum->wavelengths[0] * 1E-9, lambda_max = spectrum->wavelengths[spectrum->num_datarows - 1] * 1E-9;  /* m */
+  double *power_above = (double *)calloc (map.length, sizeof (double));
+  struct tandem_search search;
+  search.candidates = (struct tandem_candidate *)calloc (map.length, sizeof (struct tandem_candidate));
+  if (!status && (!power_above || !search.candidates))
+    status = GSL_ENOMEM;
+  if (!status && map.length < n_junctions)
+    status = GSL_EINVAL;
+
+  if (status)
+    fprintf (stderr, "ERROR: Failed to set up the tandem search: %s\n", gsl_strerror (status));
+  else
+    {
+      for (size_t i = 0; i < map.length; i++)
+        power_above[i] = thermal_absorbed_power (&map, &map.workers[0], hPlanck * c0 / map.bandgap[i], lambda_min, lambda_max);
+      search.map = &map;
+      search.power_above = power_above;
+      search.n_junctions = n_junctions;
+      search.connection = connection;
+      search.temperature = map.workers[0].min_params.Tcell;
+      atomic_init (&search.best, 0.0);
+
+      /* Every top bandgap with room for the junctions below it is one task */
+      const size_t n_items = map.length - (n_junctions - 1);
+      sl_parallel_for (n_items, 1, map.n_workers, sqlimit_tandem_range, &search);
+
+      /* Ties go to the higher top bandgap, whatever the order the workers finished in */
+      size_t best = 0;
+      for (size_t item = 0; item < n_items; item++)
+        {
+          eff_data.n_evaluated += search.candidates[item].n_evaluated;
+          if (search.candidates[item].efficiency > search.candidates[best].efficiency)
+            best = item;
+        }
+      eff_data.n_junctions = n_junctions;
+      eff_data.connection = connection;
+      /* The candidates start at efficiency 0 with index {0}, which is no stack */
+      if (search.candidates[best].efficiency > 0)
+        {
+          eff_data.efficiency = search.candidates[best].efficiency;
+          for (unsigned int k = 0; k < n_junctions; k++)
+            eff_data.bandgap[k] = map.bandgap[search.candidates[best].index[k]];
+        }
+      else
+        {
+          fprintf (stderr, "ERROR: No stack of %u junctions has a positive efficiency.\n", n_junctions);
+          for (unsigned int k = 0; k < n_junctions; k++)
+            eff_data.bandgap[k] = GSL_NAN;
+        }
+      DEBUG_PRINT ("Tandem search evaluated %zu of the stacks of %u out of %zu bandgaps.\n", eff_data.n_evaluated, n_junctions, map.length);
+    }
+
+  free (power_above);
+  free (search.candidates);
+  free (map.bandgap);
+  sqlimit_map_clear (&map);
+  return eff_data;
+}
+
+struct sqlimit_2d_job;
+struct sqlimit_2d_row;
+
+struct sqlimit_2d_task
+{
+  struct sqlimit_2d_row *row;
+  size_t                 begin;  // bandgap block [begin, end)
+  size_t                 end;
+};
+
+/* A slot of the window of spectra in flight. The spline is allocated once per slot
+ * and re-initialised for every row passing through it, so the memory used by the
+ * engine depends on the window size and not on the number of spectra. */
+struct sqlimit_2d_row
+{
+  struct sqlimit_2d_job  *job;
+  unsigned int            index;
+  const double           *intensities;  /* W/(m^2 nm), of the spectrum in the slot */
+  double                 *efficiency;   // per bandgap, of the spectrum in the slot
+  double                 *own_efficiency;  // streamed spectra only
+  gsl_spline             *spline;  // QAGS quadrature only
+  struct spectrum_table  *table;   // table quadrature only
+  struct spectrum_quad   *quad;    // fixed-order quadratures only
+  double                  radiation;  /* W/m^2 */
+  atomic_size_t           blocks_left;
+  struct sqlimit_2d_task  setup;
+  struct sqlimit_2d_task *blocks;
+  struct sqlimit_2d_row  *next_free;
+};
+
+struct sqlimit_2d_job
+{
+  const double            *wavelengths;  /* nm, shared by all spectra */
+  size_t                   num_fields;
+  struct eff_bg_2d        *eff_bg_data;
+  struct sqlimit_worker   *workers;
+  struct sqlimit_2d_row   *rows;
+  double                  *rr0;  // per bandgap, shared by all spectra
+  struct quad_rule        *rule;  // fixed-order and native quadratures only
+  size_t                   n_rows;  // window size
+  size_t                   n_blocks;
+  size_t                   iter_lim;
+  double                   E_min;  /* J */
+  double                   E_max;  /* J */
+  enum sqlimit_quadrature  quadrature;
+  unsigned int             n_workers;
+  struct sl_pool          *pool;
+  gsl_error_handler_t     *default_handler;
+
+  /* Streamed spectra only: the rows come from the ring and the curves go to func */
+  struct csv_row_ring     *ring;
+  sqlimit_2d_func          func;
+  void                    *user_data;
+
+  pthread_mutex_t          lock;
+  pthread_cond_t           slot_cond;
+  struct sqlimit_2d_row   *free_rows;
+  atomic_uint              n_failed;  // spectra that could not be tabulated
+};
+
+/* A failed spectrum is not handed to func */
+static void
+sqlimit_2d_release_row (struct sqlimit_2d_row *row,
+                        bool                   failed)
+{
+  struct sqlimit_2d_job *job = row->job;
+  if (job->func && !failed)
+    job->func (row->index, job->eff_bg_data->bandgap, row->efficiency, job->eff_bg_data->length, job->user_data);
+  if (job->ring)
+    csv_row_ring_release (job->ring, row->intensities);
+  pthread_mutex_lock (&job->lock);
+  row->next_free = job->free_rows;
+  job->free_rows = row;
+  pthread_cond_signal (&job->slot_cond);
+  pthread_mutex_unlock (&job->lock);
+}
+
+/* Two kinds of tasks go through the pool: the set-up task of a spectrum, which fills
+ * the spline and integrates the radiation, then pushes the bandgap blocks of that
+ * spectrum onto the running worker's deque; and the blocks themselves, which idle
+ * workers steal. */
+static void
+sqlimit_2d_run_task (void           *data,
+                     unsigned int    worker_index,
+                     struct sl_pool *pool,
+                     void           *user_data)
+{
+  struct sqlimit_2d_task *task = (struct sqlimit_2d_task *)data;
+  struct sqlimit_2d_row *row = task->row;
+  struct sqlimit_2d_job *job = row->job;
+  struct sqlimit_worker *worker = &job->workers[worker_index];
+  struct eff_bg_2d *eff_bg_data = job->eff_bg_data;
+
+  worker->min_params.table = row->table;
+  worker->min_params.quad = row->quad;
+  if (worker->spline_params.spline != row->spline)
+    {
+      worker->spline_params.spline = row->spline;
+      gsl_interp_accel_reset (worker->acc);
+      if (row->spline)
+        sl_linear_cursor_bind (&worker->cursor, row->spline->x, row->spline->y, row->spline->size);
+    }
+
+  if (task == &row->setup)
+    {
+      int status;
+      if (row->table)
+        {
+          status = spectrum_table_init (row->table, job->wavelengths, row->intensities);
+          if (!status)
+            row->radiation = spectrum_table_radiation (row->table);
+        }
+      else if (row->quad)
+        {
+          status = spectrum_quad_init (row->quad, job->wavelengths, row->intensities);
+          if (!status)
+            row->radiation = spectrum_quad_radiation (row->quad);
+        }
+      else
+        {
+          double error;
+          gsl_function F_p;
+          F_p.function = &power_per_tea;
+          F_p.params = &worker->spline_params;
+
+          status = gsl_spline_init (row->spline, job->wavelengths, row->intensities, job->num_fields);
+          gsl_interp_accel_reset (worker->acc);
+          worker->cursor.index = 0;
+          if (status)
+            ;
+          else if (job->rule)
+            row->radiation = sl_native_power (&worker->cursor, job->rule, job->E_min, job->E_max, 1.49E-08, 1.49E-08, &error);
+          else
+            gsl_integration_qags (&F_p, job->E_min, job->E_max, 1.49E-08, 1.49E-08, job->iter_lim, worker->int_ws, &row->radiation, &error);
+        }
+
+      /* As in sqlimit_main_full (), a spectrum that cannot be tabulated is not swept at all;
+       * its curve is NaN rather than read from a half-built table */
+      if (status)
+        {
+          fprintf (stderr, "ERROR: Failed to tabulate spectrum %u.\n", row->index);
+          for (size_t j = 0; j < eff_bg_data->length; j++)
+            row->efficiency[j] = GSL_NAN;
+          atomic_fetch_add (&job->n_failed, 1);
+          sqlimit_2d_release_row (row, true);
+          return;
+        }
+
+      atomic_store (&row->blocks_left, job->n_blocks);
+      for (size_t b = 0; b < job->n_blocks; b++)
+        sl_pool_push (pool, &row->blocks[b]);
+      return;
+    }
+
+  double *efficiency = row->efficiency;
+  struct sqlimit_operating_point op;
+  for (size_t j = task->begin; j < task->end; j++)
+    {
+      worker->min_params.Egap = eff_bg_data->bandgap[j];
+      worker->min_params.rr0 = job->rr0[j];
+      operating_point (row->radiation, &worker->min_params, &op);
+      efficiency[j] = op.efficiency;
+      if (op.status == SQLIMIT_NO_CONVERGENCE)
+        fprintf (stderr, "WARNING: V_mpp did not converge for spectrum %u at E_g = %lf eV.\n", row->index, eff_bg_data->bandgap[j] / eV);
+    }
+
+  if (atomic_fetch_sub (&row->blocks_left, 1) == 1)
+    sqlimit_2d_release_row (row, false);
+}
+
+/* Everything the spectra on a wavelength grid share: the bandgap grid of eff_bg_data, RR0,
+ * the workers, a window of n_rows slots and the pool. Streamed spectra get an efficiency
+ * buffer per slot, since nothing else holds them. */
+static int
+sqlimit_2d_job_init (struct sqlimit_2d_job        *job,
+                     const double                 *wavelengths,  /* nm */
+                     size_t                        num_fields,
+                     size_t                        n_rows,
+                     struct eff_bg_2d             *eff_bg_data,
+                     const struct sqlimit_options *options,
+                     bool                          streamed)
+{
+  const unsigned int n_workers = sl_pool_resolve_workers (options ? options->n_threads : 1);
+  const double temperature = options && options->temperature > 0 ? options->temperature : Tcell;  /* K */
+  const size_t block_size = (options && options->block_size) ? options->block_size : 10;
+  const size_t iter_lim = 50;
+  const gsl_interp_type *t = gsl_interp_linear;
+
+  /* Same as splines[0]->interp->xmin and xmax: the wavelength row is shared by all spectra */
+  double lambda_min = wavelengths[0] * 1E-9, lambda_max = wavelengths[num_fields - 1] * 1E-9;
+  double E_min = hPlanck * c0 / lambda_max, E_max = hPlanck * c0 / lambda_min;
+
+  eff_bg_data->length = 100;
+  /* The stop value should be less than E_max; otherwise, wavelengths will be out of range;
+   * however, the start value could be less than or equal to E_min.
+   * At E_max itself there are no photons left and V_mpp () reports SQLIMIT_NO_PHOTONS
+   * (the simplex search it replaced used to loop forever there). */
+  eff_bg_data->bandgap = linspace (E_min, 0.999 * E_max, eff_bg_data->length);
+
+  job->wavelengths = wavelengths;
+  job->num_fields = num_fields;
+  job->eff_bg_data = eff_bg_data;
+  job->iter_lim = iter_lim;
+  job->E_min = E_min;
+  job->E_max = E_max;
+  job->n_workers = n_workers;
+  job->quadrature = options ? options->quadrature : SQLIMIT_QUAD_TABLE;
+  job->n_blocks = (eff_bg_data->length + block_size - 1) / block_size;
+  /* Two spectra per worker keep every worker busy while the next set-up task runs */
+  job->n_rows = 2 * (size_t)n_workers;
+  if (job->n_rows > n_rows)
+    job->n_rows = n_rows ? n_rows : 1;
+  pthread_mutex_init (&job->lock, NULL);
+  pthread_cond_init (&job->slot_cond, NULL);
+  atomic_init (&job->n_failed, 0);
+
+  job->rule = sqlimit_quad_rule_alloc (job->quadrature, options ? options->quad_order : 0);
+  job->workers = (struct sqlimit_worker *)calloc (n_workers, sizeof (struct sqlimit_worker));
+  job->rows = (struct sqlimit_2d_row *)calloc (job->n_rows, sizeof (struct sqlimit_2d_row));
+  bool alloc_failed = !eff_bg_data->bandgap || !job->workers || !job->rows
+                      || ((sqlimit_quad_is_fixed (job->quadrature) || job->quadrature == SQLIMIT_QUAD_NATIVE) && !job->rule);
+  for (unsigned int w = 0; !alloc_failed && w < n_workers; w++)
+    {
+      if (sqlimit_worker_init (&job->workers[w], NULL, NULL, NULL, sqlimit_quad_is_fixed (job->quadrature) ? NULL : job->rule, E_max, temperature, iter_lim))
+        alloc_failed = true;
+    }
+  for (size_t r = 0; !alloc_failed && r < job->n_rows; r++)
+    {
+      struct sqlimit_2d_row *row = &job->rows[r];
+      row->job = job;
+      if (job->quadrature == SQLIMIT_QUAD_TABLE)
+        row->table = spectrum_table_alloc (num_fields);
+      else if (sqlimit_quad_is_fixed (job->quadrature))
+        row->quad = spectrum_quad_alloc (num_fields, job->rule);
+      else
+        row->spline = gsl_spline_alloc (t, num_fields);
+      row->blocks = (struct sqlimit_2d_task *)calloc (job->n_blocks, sizeof (struct sqlimit_2d_task));
+      if (streamed)
+        row->own_efficiency = (double *)calloc (eff_bg_data->length, sizeof (double));
+      if ((!row->spline && !row->table && !row->quad) || !row->blocks || (streamed && !row->own_efficiency))
+        {
+          alloc_failed = true;
+          break;
+        }
+      row->setup.row = row;
+      for (size_t b = 0; b < job->n_blocks; b++)
+        {
+          row->blocks[b].row = row;
+          row->blocks[b].begin = b * block_size;
+          row->blocks[b].end = (b + 1) * block_size < eff_bg_data->length ? (b + 1) * block_size : eff_bg_data->length;
+        }
+      row->next_free = job->free_rows;
+      job->free_rows = row;
+    }
+
+  job->default_handler = gsl_set_error_handler_off ();
+  if (!alloc_failed)
+    {
+      job->rr0 = RR0_sweep (eff_bg_data->bandgap, eff_bg_data->length, E_max, temperature, job->quadrature, &job->workers[0].F_RR0, job->workers[0].int_ws, job->rule);
+      alloc_failed = !job->rr0;
+    }
+  job->pool = alloc_failed ? NULL : sl_pool_new (n_workers, sqlimit_2d_run_task, job);
+  return job->pool ? GSL_SUCCESS : GSL_ENOMEM;
+}
+
+/* Waits for a free slot, so that no more than the window of spectra is ever in flight */
+static void
+sqlimit_2d_submit (struct sqlimit_2d_job *job,
+                   unsigned int           index,
+                   const double          *intensities,
+                   double                *efficiency)
+{
+  pthread_mutex_lock (&job->lock);
+  while (!job->free_rows)
+    pthread_cond_wait (&job->slot_cond, &job->lock);
+  struct sqlimit_2d_row *row = job->free_rows;
+  job->free_rows = row->next_free;
+  pthread_mutex_unlock (&job->lock);
+
+  row->index = index;
+  row->intensities = intensities;
+  row->efficiency = efficiency ? efficiency : row->own_efficiency;
+  sl_pool_push (job->pool, &row->setup);
+}
+
+static void
+sqlimit_2d_job_clear (struct sqlimit_2d_job *job)
+{
+  if (!job->wavelengths)
+    return;  // never set up
+  if (job->pool)
+    {
+      sl_pool_wait (job->pool);
+      sl_pool_free (job->pool);
+    }
+  for (size_t r = 0; job->rows && r < job->n_rows; r++)
+    {
+      if (job->rows[r].spline)
+        gsl_spline_free (job->rows[r].spline);
+      spectrum_table_free (job->rows[r].table);
+      spectrum_quad_free (job->rows[r].quad);
+      free (job->rows[r].blocks);
+      free (job->rows[r].own_efficiency);
+    }
+  for (unsigned int w = 0; job->workers && w < job->n_workers; w++)
+    sqlimit_worker_clear (&job->workers[w]);
+  gsl_set_error_handler (job->default_handler);
+  free (job->rows);
+  free (job->workers);
+  free (job->rr0);
+  quad_rule_free (job->rule);
+  pthread_mutex_destroy (&job->lock);
+  pthread_cond_destroy (&job->slot_cond);
+}
+
+struct eff_bg_2d
+sqlimit_main_2d (struct csv_data_2d *spectrum,
+                 bool                axis)
+{
+  return sqlimit_main_2d_full (spectrum, axis, NULL);
+}
+
+struct eff_bg_2d
+sqlimit_main_2d_full (struct csv_data_2d           *spectrum,
+                      bool                          axis,
+                      const struct sqlimit_options *options)
+{
+  unsigned int i = 0;
+  struct eff_bg_2d eff_bg_data = {0};
+  struct sqlimit_2d_job job = {0};
+
+  if (axis != HORIZONTAL)  // horizontal
+    {
+      fprintf (stderr, "Axis = 1, Dim = 2 is not implemented.\n");
+      return eff_bg_data;
+    }
+
+  eff_bg_data.efficiency = (double **)calloc (spectrum->num_datarows, sizeof (double *));
+  if (!eff_bg_data.efficiency
+      || sqlimit_2d_job_init (&job, spectrum->wavelengths, spectrum->num_fields, spectrum->num_datarows, &eff_bg_data, options, false))
+    {
+      fprintf (stderr, "ERROR: Failed to set up %u sqlimit worker(s) for %u spectra.\n", job.n_workers, spectrum->num_datarows);
+      free (eff_bg_data.efficiency);
+      free (eff_bg_data.bandgap);
+      sqlimit_2d_job_clear (&job);
+      return (struct eff_bg_2d) {0};
+    }
+  else
+    {
+      struct timespec t_start, t_end;
+      clock_gettime (CLOCK_MONOTONIC, &t_start);
+
+      for (i = 0; i < spectrum->num_datarows; i++)
+        {
+          eff_bg_data.efficiency[i] = (double *)calloc (eff_bg_data.length, sizeof (double));
+          if (!eff_bg_data.efficiency[i])
+            break;
+          sqlimit_2d_submit (&job, i, spectrum->intensities[i], eff_bg_data.efficiency[i]);
+        }
+      sl_pool_wait (job.pool);
+      if (i < spectrum->num_datarows)
+        {
+          fprintf (stderr, "ERROR: Failed to allocate the efficiencies of spectrum %u.\n", i);
+          while (i--)
+            free (eff_bg_data.efficiency[i]);
+          free (eff_bg_data.efficiency);
+          free (eff_bg_data.bandgap);
+          sqlimit_2d_job_clear (&job);
+          return (struct eff_bg_2d) {0};
+        }
+
+      clock_gettime (CLOCK_MONOTONIC, &t_end);
+      DEBUG_PRINT ("Time cost: %lf s for %u spectra with %u worker(s)\n", (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) * 1E-9, spectrum->num_datarows, job.n_workers);
+
+      gsl_vector_view eff_list;
+      for (i = 0; i < spectrum->num_datarows; i++)
+        {
+          if (gsl_isnan (eff_bg_data.efficiency[i][0]))
+            continue;  // reported by its set-up task
+          eff_list = gsl_vector_view_array (eff_bg_data.efficiency[i], eff_bg_data.length);
+          printf ("Max efficiency %lf%% at %lf eV\n", gsl_vector_max(&eff_list.vector) * 100, eff_bg_data.bandgap[gsl_vector_max_index (&eff_list.vector)] / eV);
+        }
+    }
+
+  sqlimit_2d_job_clear (&job);
+  return eff_bg_data;
+}
+
+static void
+sqlimit_2d_print_peak (unsigned int  index,
+                       const double *bandgap,
+                       const double *efficiency,
+                       size_t        length,
+                       void         *user_data)
+{
+  gsl_vector_const_view eff_list = gsl_vector_const_view_array (efficiency, length);
+  printf ("Spectrum %u: max efficiency %lf%% at %lf eV\n", index, gsl_vector_max (&eff_list.vector) * 100, bandgap[gsl_vector_max_index (&eff_list.vector)] / eV);
+}
+
+/* sqlimit_main_2d_full () over a file like poly_spectrum.csv without loading it: the rows
+ * are parsed ahead through a ring of row buffers while the window of spectra in flight is
+ * swept, and every efficiency curve goes to func as soon as it is done, from a worker
+ * thread and not in the order of the file; NULL prints its peak. The memory used depends
+ * on the width of a row and the number of workers, not on the number of spectra. */
+int
+sqlimit_main_2d_stream (FILE                         *fp,
+                        const struct sqlimit_options *options,
+                        sqlimit_2d_func               func,
+                        void                         *user_data)
+{
+  struct eff_bg_2d eff_bg_data = {0};
+  struct sqlimit_2d_job job = {0};
+  const unsigned int n_workers = sl_pool_resolve_workers (options ? options->n_threads : 1);
+  /* The wavelength row and every slot of the window hold a row buffer each, and two more
+   * let the parser run ahead */
+  struct csv_row_ring *ring = csv_row_ring_new (fp, 2 * n_workers + 3);
+  const double *values;
+  unsigned int row, n_values, n_spectra = 0;
+  int status = GSL_SUCCESS;
+  struct timespec t_start, t_end;
+
+  if (!ring)
+    return GSL_ENOMEM;
+  clock_gettime (CLOCK_MONOTONIC, &t_start);
+  while (!status && (values = csv_row_ring_next (ring, &row, &n_values)))
+    {
+      if (row)
+        {
+          sqlimit_2d_submit (&job, n_spectra++, values, NULL);
+          continue;
+        }
+      /* The wavelength row stays in its buffer until the end, for the slots to share */
+      if (n_values < 2)
+        {
+          fprintf (stderr, "ERROR: A spectrum needs at least 2 points, got %u.\n", n_values);
+          status = GSL_EINVAL;
+          break;
+        }
+      for (unsigned int k = 1; k < n_values; k++)
+        if (!(values[k] > values[k - 1]))
+          {
+            fprintf (stderr, "ERROR: The wavelengths in the first row must be strictly ascending.\n");
+            status = GSL_EINVAL;
+            break;
+          }
+      if (!status)
+        {
+          job.ring = ring;
+          job.func = func ? func : sqlimit_2d_print_peak;
+          job.user_data = user_data;
+          status = sqlimit_2d_job_init (&job, values, n_values, SIZE_MAX, &eff_bg_data, options, true);
+          if (status)
+            fprintf (stderr, "ERROR: Failed to set up %u sqlimit worker(s).\n", job.n_workers);
+        }
+    }
+  if (job.pool)
+    sl_pool_wait (job.pool);
+  clock_gettime (CLOCK_MONOTONIC, &t_end);
+  DEBUG_PRINT ("Time cost: %lf s for %u streamed spectra with %u worker(s)\n", (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) * 1E-9, n_spectra, job.n_workers);
+
+  sqlimit_2d_job_clear (&job);
+  free (eff_bg_data.bandgap);
+  const int read_status = csv_row_ring_free (ring);
+  if (!status && (read_status || atomic_load (&job.n_failed)))
+    status = GSL_EFAILED;
+  if (!status && !job.wavelengths)
+    {
+      fprintf (stderr, "ERROR: The file holds no wavelength row.\n");
+      status = GSL_EINVAL;
+    }
+  return status;
+}
+
+/* Preallocated state of sqlimit_batch_eval (): one spectrum table per pool worker, the RR0 of the
+ * bandgap grid and the pool itself, so that evaluating a batch allocates nothing once the pool
+ * deques have grown to n_workers tasks. One workspace serves one caller at a time. */
+struct sqlimit_batch_workspace
+{
+  struct sl_pool                *pool;
+  struct spectrum_table        **tables;  // per worker
+  double                        *rr0;     // per bandgap
+  unsigned int                  *tasks;   // one token per worker, pushed once per batch
+  unsigned int                   n_workers;
+  size_t                         max_points;
+  size_t                         max_bandgaps;
+  double                         temperature;  /* K */
+
+  /* The batch in flight */
+  const struct csv_data_2d      *spectra;
+  const double                  *bandgap;
+  size_t                         n_bandgaps;
+  double                         Emax;  /* J */
+  struct sqlimit_batch_results  *results;
+  atomic_size_t                  next_spectrum;
+  atomic_int                     status;
+};
+
+static void
+sqlimit_batch_spectrum (struct sqlimit_batch_workspace *ws,
+                        struct spectrum_table          *table,
+                        size_t                          s)
+{
+  const struct csv_data_2d *spectra = ws->spectra;
+  struct sqlimit_batch_results *results = ws->results;
+  struct sqlimit_operating_point op;
+  struct min_params params = {0};
+
+  table->length = spectra->num_fields;
+  if (spectrum_table_init (table, spectra->wavelengths, spectra->intensities[s]))
+    {
+      atomic_store (&ws->status, GSL_EINVAL);
+      return;
+    }
+  const double radiation = spectrum_table_radiation (table);  /* W/m^2 */
+  params.Emax = ws->Emax;
+  params.table = table;
+  params.Tcell = ws->temperature;
+
+  size_t best = 0;
+  double *efficiency = results->efficiency + s * ws->n_bandgaps;
+  for (size_t j = 0; j < ws->n_bandgaps; j++)
+    {
+      const size_t k = s * ws->n_bandgaps + j;
+      params.Egap = ws->bandgap[j];
+      params.rr0 = ws->rr0[j];
+      operating_point (radiation, &params, &op);
+      efficiency[j] = op.efficiency;
+      if (results->fill_factor)
+        results->fill_factor[k] = op.fill_factor;
+      if (results->jsc)
+        results->jsc[k] = op.jsc;
+      if (results->voc)
+        results->voc[k] = op.voc;
+      if (efficiency[j] > efficiency[best])
+        best = j;
+    }
+  if (results->peak_bandgap)
+    results->peak_bandgap[s] = ws->bandgap[best];
+  if (results->peak_efficiency)
+    results->peak_efficiency[s] = efficiency[best];
+}
+
+static void
+sqlimit_batch_run_task (void           *task,
+                        unsigned int    worker,
+                        struct sl_pool *pool,
+                        void           *user_data)
+{
+  struct sqlimit_batch_workspace *ws = (struct sqlimit_batch_workspace *)user_data;
+  size_t s;
+
+  while ((s = atomic_fetch_add (&ws->next_spectrum, 1)) < ws->spectra->num_datarows)
+    sqlimit_batch_spectrum (ws, ws->tables[worker], s);
+}
+
+struct sqlimit_batch_workspace *
+sqlimit_batch_workspace_alloc (size_t                        max_points,
+                               size_t                        max_bandgaps,
+                               const struct sqlimit_options *options)
+{
+  struct sqlimit_batch_workspace *ws = (struct sqlimit_batch_workspace *)calloc (1, sizeof (struct sqlimit_batch_workspace));
+  if (!ws)
+    return NULL;
+
+  ws->n_workers = sl_pool_resolve_workers (options ? options->n_threads : 1);
+  ws->max_points = max_points;
+  ws->max_bandgaps = max_bandgaps;
+  ws->temperature = options && options->temperature > 0 ? options->temperature : Tcell;
+  ws->tables = (struct spectrum_table **)calloc (ws->n_workers, sizeof (struct spectrum_table *));
+  ws->tasks = (unsigned int *)calloc (ws->n_workers, sizeof (unsigned int));
+  ws->rr0 = (double *)calloc (max_bandgaps, sizeof (double));
+  if (!ws->tables || !ws->tasks || !ws->rr0)
+    {
+      sqlimit_batch_workspace_free (ws);
+      return NULL;
+    }
+  for (unsigned int w = 0; w < ws->n_workers; w++)
+    {
+      ws->tasks[w] = w;
+      ws->tables[w] = spectrum_table_alloc (max_points);
+      if (!ws->tables[w])
+        {
+          sqlimit_batch_workspace_free (ws);
+          return NULL;
+        }
+    }
+  ws->pool = sl_pool_new (ws->n_workers, sqlimit_batch_run_task, ws);
+  if (!ws->pool)
+    {
+      sqlimit_batch_workspace_free (ws);
+      return NULL;
+    }
+  return ws;
+}
+
+void
+sqlimit_batch_workspace_free (struct sqlimit_batch_workspace *ws)
+{
+  if (!ws)
+    return;
+  sl_pool_free (ws->pool);
+  for (unsigned int w = 0; ws->tables && w < ws->n_workers; w++)
+    spectrum_table_free (ws->tables[w]);
+  free (ws->tables);
+  free (ws->tasks);
+  free (ws->rr0);
+  free (ws);
+}
+
+/* Evaluates every spectrum of spectra (sharing their wavelengths, as read_csv () gives them)
+ * at every bandgap of the grid into the caller's buffers, indexed [spectrum * n_bandgaps + bandgap].
+ * Only results->efficiency is required. The prefix tables and the RR0 series are used whatever
+ * options->quadrature the workspace was made with, so no GSL error handler is touched either. */
+int
+sqlimit_batch_eval (struct sqlimit_batch_workspace *ws,
+                    const struct csv_data_2d       *spectra,
+                    const double                   *bandgap,  /* J */
+                    size_t                          n_bandgaps,
+                    struct sqlimit_batch_results   *results)
+{
+  if (!results->efficiency)
+    return GSL_EFAULT;
+  if (spectra->num_fields < 2 || spectra->num_fields > ws->max_points || n_bandgaps < 1 || n_bandgaps > ws->max_bandgaps)
+    return GSL_EBADLEN;
+
+  ws->spectra = spectra;
+  ws->bandgap = bandgap;
+  ws->n_bandgaps = n_bandgaps;
+  ws->Emax = hPlanck * c0 / (spectra->wavelengths[0] * 1E-9);
+  ws->results = results;
+  for (size_t j = 0; j < n_bandgaps; j++)
+    ws->rr0[j] = RR0_series (bandgap[j], ws->Emax, ws->temperature);
+  atomic_store (&ws->next_spectrum, 0);
+  atomic_store (&ws->status, GSL_SUCCESS);
+
+  for (unsigned int w = 0; w < ws->n_workers; w++)
+    sl_pool_push (ws->pool, &ws->tasks[w]);
+  sl_pool_wait (ws->pool);
+
+  ws->spectra = NULL;
+  ws->results = NULL;
+  return atomic_load (&ws->status);
+}
+
+/* A single-spectrum sweep kept alive for interactive editing. The spectrum is borrowed; the
+ * caller edits its intensities in place and reports the edited index range, and only the
+ * bandgaps whose above-gap photon flux covers the edit are solved again. */
+struct sqlimit_state
+{
+  struct csv_data       *spectrum;
+  struct spectrum_table *table;  // over the points [first, last] of the spectrum
+  size_t                 first;
+  size_t                 last;
+  double                 Emax;         /* J, top of the clipped spectrum */
+  double                 temperature;  /* K */
+  double                 radiation;    /* W/m^2 */
+  double                *rr0;          // per bandgap
+  struct eff_bg          eff_bg_data;
+};
+
+static void
+sqlimit_state_solve (struct sqlimit_state *state,
+                     size_t                begin,
+                     size_t                end)
+{
+  struct eff_bg *eff_bg_data = &state->eff_bg_data;
+  struct sqlimit_operating_point op;
+  struct min_params params = {0};
+  params.Emax = state->Emax;
+  params.table = state->table;
+  params.Tcell = state->temperature;
+
+  for (size_t i = begin; i < end; i++)
+    {
+      params.Egap = eff_bg_data->bandgap[i];
+      params.rr0 = state->rr0[i];
+      operating_point (state->radiation, &params, &op);
+      eff_bg_data->efficiency[i] = op.efficiency;
+      eff_bg_data->fill_factor[i] = op.fill_factor;
+      eff_bg_data->jsc[i] = op.jsc;
+      eff_bg_data->voc[i] = op.voc;
+      eff_bg_data->vmpp[i] = op.vmpp;
+      eff_bg_data->jmpp[i] = op.jmpp;
+      eff_bg_data->status[i] = op.status;
+    }
+}
+
+static void
+sqlimit_state_find_peak (struct sqlimit_state *state)
+{
+  struct eff_bg *eff_bg_data = &state->eff_bg_data;
+  size_t best = 0;
+  for (size_t i = 1; i < eff_bg_data->length; i++)
+    if (eff_bg_data->efficiency[i] > eff_bg_data->efficiency[best])
+      best = i;
+  eff_bg_data->peak_bandgap = eff_bg_data->bandgap[best];
+  eff_bg_data->peak_efficiency = eff_bg_data->efficiency[best];
+}
+
+/* Re-tabulates the points [first, last] and solves every bandgap */
+static int
+sqlimit_state_reset (struct sqlimit_state *state,
+                     size_t                first,
+                     size_t                last)
+{
+  state->first = first;
+  state->last = last;
+  state->table->length = last - first + 1;
+  int status = spectrum_table_init (state->table, state->spectrum->wavelengths + first, state->spectrum->intensities + first);
+  if (status)
+    return status;
+  state->radiation = spectrum_table_radiation (state->table);
+  state->Emax = hPlanck * c0 / (state->spectrum->wavelengths[first] * 1E-9);
+  for (size_t i = 0; i < state->eff_bg_data.length; i++)
+    state->rr0[i] = RR0_series (state->eff_bg_data.bandgap[i], state->Emax, state->temperature);
+  sqlimit_state_solve (state, 0, state->eff_bg_data.length);
+  sqlimit_state_find_peak (state);
+  return GSL_SUCCESS;
+}
+
+/* Sweeps the same bandgap grid as sqlimit_main_full () with options->n_points bandgaps.
+ * The grid is kept for the lifetime of the state, also when the spectrum is clipped later. */
+struct sqlimit_state *
+sqlimit_state_new (struct csv_data              *spectrum,
+                   const struct sqlimit_options *options)
+{
+  if (spectrum->num_datarows < 2)
+    return NULL;
+  struct sqlimit_state *state = (struct sqlimit_state *)calloc (1, sizeof (struct sqlimit_state));
+  if (!state)
+    return NULL;
+
+  state->spectrum = spectrum;
+  state->temperature = options && options->temperature > 0 ? options->temperature : Tcell;
+  state->table = spectrum_table_alloc (spectrum->num_datarows);
+  const double E_min = hPlanck * c0 / (spectrum->wavelengths[spectrum->num_datarows - 1] * 1E-9);  /* J */
+  const double E_max = hPlanck * c0 / (spectrum->wavelengths[0] * 1E-9);  /* J */
+  state->eff_bg_data.length = options && options->n_points >= 3 ? options->n_points : 100;
+  state->eff_bg_data.bandgap = linspace (E_min + 0.01 * eV, E_max - 0.01 * eV, state->eff_bg_data.length);
+  state->rr0 = (double *)calloc (state->eff_bg_data.length, sizeof (double));
+  if (!state->table || !state->rr0 || eff_bg_alloc_results (&state->eff_bg_data)
+      || sqlimit_state_reset (state, 0, spectrum->num_datarows - 1))
+    {
+      sqlimit_state_free (state);
+      return NULL;
+    }
+  return state;
+}
+
+void
+sqlimit_state_free (struct sqlimit_state *state)
+{
+  if (!state)
+    return;
+  spectrum_table_free (state->table);
+  free (state->rr0);
+  eff_bg_clear (&state->eff_bg_data);
+  free (state);
+}
+
+/* Owned by the state and refreshed in place by the calls below */
+const struct eff_bg *
+sqlimit_state_results (const struct sqlimit_state *state)
+{
+  return &state->eff_bg_data;
+}
+
+/* The intensities of the points [first, last] of the spectrum were edited in place.
+ * The photon flux above a gap only depends on the spectrum below its wavelength, so
+ * the bandgaps at or above the photon energy of the point before the edit keep their
+ * operating points and only have their efficiency rescaled to the new radiation.
+ * Returns the number of bandgaps solved again in n_solved, if not NULL. */
+int
+sqlimit_state_update (struct sqlimit_state *state,
+                      size_t                first,
+                      size_t                last,
+                      size_t               *n_solved)
+{
+  struct eff_bg *eff_bg_data = &state->eff_bg_data;
+  if (n_solved)
+    *n_solved = 0;
+  if (first > last || last >= state->spectrum->num_datarows)
+    return GSL_EINVAL;
+  if (last < state->first || first > state->last)
+    return GSL_SUCCESS;  // outside of the clipped spectrum
+
+  const size_t k = first > state->first ? first - state->first : 0;  // in the table
+  int status = spectrum_table_update (state->table, k);
+  if (status)
+    return status;
+  const double old_radiation = state->radiation;
+  state->radiation = spectrum_table_radiation (state->table);
+
+  /* Bandgaps ascend in energy, so the ones to solve again are a prefix of the grid */
+  const double E_cut = k ? hPlanck * c0 / (state->table->wavelengths[k - 1] * 1E-9) : GSL_POSINF;  /* J */
+  size_t n_affected = 0;
+  while (n_affected < eff_bg_data->length && eff_bg_data->bandgap[n_affected] < E_cut)
+    n_affected++;
+  sqlimit_state_solve (state, 0, n_affected);
+  for (size_t i = n_affected; i < eff_bg_data->length; i++)
+    eff_bg_data->efficiency[i] *= old_radiation / state->radiation;
+  sqlimit_state_find_peak (state);
+
+  DEBUG_PRINT ("Spectrum edit of points [%zu, %zu] solved %zu of %zu bandgaps again.\n", first, last, n_affected, eff_bg_data->length);
+  if (n_solved)
+    *n_solved = n_affected;
+  return GSL_SUCCESS;
+}
+
+/* Restricts the spectrum to its points [first, last] (of the original data, so clipping can
+ * also be undone). Clipping the long-wavelength end keeps E_max and RR0; clipping the
+ * short-wavelength end lowers E_max and hence changes RR0 of every bandgap. Either way the
+ * prefix table is rebuilt over the new range only and every bandgap is solved again,
+ * without any quadrature. Bandgaps above the new E_max report SQLIMIT_NO_PHOTONS. */
+int
+sqlimit_state_clip (struct sqlimit_state *state,
+                    size_t                first,
+                    size_t                last)
+{
+  if (first >= last || last >= state->spectrum->num_datarows)
+    return GSL_EINVAL;
+  return sqlimit_state_reset (state, first, last);
+}
+
+/* Scratch of one Monte Carlo worker, reused for every realisation it draws */
+struct sqlimit_mc_scratch
+{
+  gsl_rng               *rng;
+  double                *wavelengths;  /* nm */
+  double                *intensities;  /* W/(m^2 nm) */
+  struct spectrum_table *table;
+};
+
+struct sqlimit_mc_sweep
+{
+  const struct csv_data      *spectrum;
+  const struct sqlimit_noise *noise;
+  struct sqlimit_mc_scratch  *scratch;  // per worker
+  const double               *bandgap;  /* J */
+  const double               *rr0;      // per bandgap
+  size_t                      length;
+  double                      Emax;         /* J */
+  double                      temperature;  /* K */
+  unsigned long               seed;
+  size_t                      n_realisations;
+  double                     *efficiency;       // length × n_realisations, bandgap-major
+  double                     *peak_bandgap;     /* J, per realisation */
+  double                     *peak_efficiency;  // per realisation
+  atomic_int                  status;
+};
+
+void
+eff_bg_mc_clear (struct eff_bg_mc *eff_data)
+{
+  free (eff_data->bandgap);
+  free (eff_data->efficiency_mean);
+  free (eff_data->efficiency_low);
+  free (eff_data->efficiency_high);
+  *eff_data = (struct eff_bg_mc) {0};
+}
+
+/* Each realisation seeds its own generator from (seed, index), so the draws and hence the
+ * statistics do not depend on the number of workers or on which worker runs what. */
+static void
+sqlimit_mc_range (size_t        begin,
+                  size_t        end,
+                  unsigned int  worker_index,
+                  void         *user_data)
+{
+  struct sqlimit_mc_sweep *sweep = (struct sqlimit_mc_sweep *)user_data;
+  struct sqlimit_mc_scratch *scratch = &sweep->scratch[worker_index];
+  const struct sqlimit_noise *noise = sweep->noise;
+  const struct csv_data *spectrum = sweep->spectrum;
+  const size_t n_points = spectrum->num_datarows, length = sweep->length;
+  struct sqlimit_operating_point op;
+  struct min_params params = {0};
+  params.Emax = sweep->Emax;
+  params.table = scratch->table;
+  params.Tcell = sweep->temperature;
+
+  for (size_t r = begin; r < end; r++)
+    {
+      gsl_rng_set (scratch->rng, sweep->seed ^ (0x9E3779B97F4A7C15ULL * (r + 1)));
+      const double shift = noise->wavelength_shift > 0 ? gsl_ran_gaussian_ziggurat (scratch->rng, noise->wavelength_shift) : 0;  /* nm */
+      const double scale = noise->intensity_scale > 0 ? 1 + gsl_ran_gaussian_ziggurat (scratch->rng, noise->intensity_scale) : 1;
+      for (size_t k = 0; k < n_points; k++)
+        {
+          const double intensity = spectrum->intensities[k];
+          const double sigma = hypot (noise->intensity_rel * intensity, noise->intensity_sigma ? noise->intensity_sigma[k] : 0);
+          const double perturbed = scale * (sigma > 0 ? intensity + gsl_ran_gaussian_ziggurat (scratch->rng, sigma) : intensity);
+          scratch->wavelengths[k] = spectrum->wavelengths[k] + shift;
+          scratch->intensities[k] = perturbed > 0 ? perturbed : 0;  // clamped, see struct sqlimit_noise
+        }
+      if (!(scratch->wavelengths[0] > 0) || spectrum_table_init (scratch->table, scratch->wavelengths, scratch->intensities))
+        {
+          atomic_store (&sweep->status, GSL_EDOM);
+          return;
+        }
+
+      const double radiation = spectrum_table_radiation (scratch->table);  /* W/m^2 */
+      size_t best = 0;
+      double best_efficiency = -1;
+      for (size_t j = 0; j < length; j++)
+        {
+          params.Egap = sweep->bandgap[j];
+          params.rr0 = sweep->rr0[j];
+          operating_point (radiation, &params, &op);
+          sweep->efficiency[j * sweep->n_realisations + r] = op.efficiency;
+          if (op.efficiency > best_efficiency)
+            {
+              best = j;
+              best_efficiency = op.efficiency;
+            }
+        }
+
+      /* The vertex of the parabola through the best grid point and its neighbours keeps
+       * the optimum bandgap from snapping to the grid, which would widen its band */
+      double peak_bandgap = sweep->bandgap[best], peak_efficiency = best_efficiency;
+      if (best > 0 && best + 1 < length)
+        {
+          const double e0 = sweep->efficiency[(best - 1) * sweep->n_realisations + r];
+          const double e2 = sweep->efficiency[(best + 1) * sweep->n_realisations + r];
+          const double curvature = e0 - 2 * best_efficiency + e2;
+          if (curvature < 0)
+            {
+              const double offset = 0.5 * (e0 - e2) / curvature;
+              peak_bandgap += offset * (sweep->bandgap[best + 1] - sweep->bandgap[best - 1]) / 2;
+              peak_efficiency -= 0.25 * (e0 - e2) * offset;
+            }
+        }
+      sweep->peak_bandgap[r] = peak_bandgap;
+      sweep->peak_efficiency[r] = peak_efficiency;
+    }
+}
+
+static void
+sqlimit_mc_band (double       *data,  // sorted in place
+                 size_t        n,
+                 double        confidence,
+                 double       *mean,
+                 double       *low,
+                 double       *high)
+{
+  *mean = gsl_stats_mean (data, 1, n);
+  gsl_sort (data, 1, n);
+  *low = gsl_stats_quantile_from_sorted_data (data, 1, n, (1 - confidence) / 2);
+  *high = gsl_stats_quantile_from_sorted_data (data, 1, n, (1 + confidence) / 2);
+}
+
+/* Propagates the calibration uncertainty of a measured spectrum to its efficiency curve and
+ * optimum bandgap. Every realisation perturbs the nominal spectrum by the noise model and
+ * sweeps the same bandgap grid through the prefix table, so its cost is one table build and
+ * the operating points; all scratch is allocated once per worker. RR0 does not depend on
+ * the spectrum and is shared. n_realisations 0 uses 1000 and confidence 0 uses 0.95. */
+struct eff_bg_mc
+sqlimit_main_mc (struct csv_data              *spectrum,
+                 bool                          axis,
+                 const struct sqlimit_noise   *noise,
+                 size_t                        n_realisations,
+                 double                        confidence,
+                 unsigned long                 seed,
+                 const struct sqlimit_options *options)
+{
+  struct eff_bg_mc eff_data = {0};
+  const struct sqlimit_noise no_noise = {0};
+  const unsigned int n_workers = sl_pool_resolve_workers (options ? options->n_threads : 1);
+
+  if (axis != VERTICAL)
+    {
+      fprintf (stderr, "Axis = 0, Dim = 1 is not implemented.\n");
+      return eff_data;
+    }
+  if (spectrum->num_datarows < 2)
+    {
+      fprintf (stderr, "ERROR: A spectrum needs at least 2 points, got %u.\n", spectrum->num_datarows);
+      return eff_data;
+    }
+
+  struct sqlimit_mc_sweep sweep = {0};
+  sweep.spectrum = spectrum;
+  sweep.noise = noise ? noise : &no_noise;
+  sweep.seed = seed;
+  sweep.n_realisations = n_realisations ? n_realisations : 1000;
+  sweep.temperature = options && options->temperature > 0 ? options->temperature : Tcell;  /* K */
+  sweep.Emax = hPlanck * c0 / (spectrum->wavelengths[0] * 1E-9);
+  const double E_min = hPlanck * c0 / (spectrum->wavelengths[spectrum->num_datarows - 1] * 1E-9);  /* J */
+  atomic_init (&sweep.status, GSL_SUCCESS);
+
+  eff_data.confidence = confidence > 0 && confidence < 1 ? confidence : 0.95;
+  eff_data.n_realisations = sweep.n_realisations;
+  eff_data.length = sweep.length = options && options->n_points >= 3 ? options->n_points : 100;
+  eff_data.bandgap = linspace (E_min + 0.01 * eV, sweep.Emax - 0.01 * eV, eff_data.length);
+  eff_data.efficiency_mean = (double *)calloc (eff_data.length, sizeof (double));
+  eff_data.efficiency_low = (double *)calloc (eff_data.length, sizeof (double));
+  eff_data.efficiency_high = (double *)calloc (eff_data.length, sizeof (double));
+  sweep.bandgap = eff_data.bandgap;
+  sweep.efficiency = (double *)malloc (eff_data.length * sweep.n_realisations * sizeof (double));
+  sweep.peak_bandgap = (double *)malloc (sweep.n_realisations * sizeof (double));
+  sweep.peak_efficiency = (double *)malloc (sweep.n_realisations * sizeof (double));
+  sweep.scratch = (struct sqlimit_mc_scratch *)calloc (n_workers, sizeof (struct sqlimit_mc_scratch));
+  int status = GSL_SUCCESS;
+  if (!eff_data.bandgap || !eff_data.efficiency_mean || !eff_data.efficiency_low || !eff_data.efficiency_high
+      || !sweep.efficiency || !sweep.peak_bandgap || !sweep.peak_efficiency || !sweep.scratch)
+    status = GSL_ENOMEM;
+  for (unsigned int w = 0; !status && w < n_workers; w++)
+    {
+      struct sqlimit_mc_scratch *scratch = &sweep.scratch[w];
+      scratch->rng = gsl_rng_alloc (gsl_rng_mt19937);
+      scratch->wavelengths = (double *)malloc (spectrum->num_datarows * sizeof (double));
+      scratch->intensities = (double *)malloc (spectrum->num_datarows * sizeof (double));
+      scratch->table = spectrum_table_alloc (spectrum->num_datarows);
+      if (!scratch->rng || !scratch->wavelengths || !scratch->intensities || !scratch->table)
+        status = GSL_ENOMEM;
+    }
+  double *rr0 = NULL;
+  if (!status)
+    {
+      rr0 = RR0_sweep (eff_data.bandgap, eff_data.length, sweep.Emax, sweep.temperature, SQLIMIT_QUAD_TABLE, NULL, NULL, NULL);
+      sweep.rr0 = rr0;
+      if (!rr0)
+        status = GSL_ENOMEM;
+    }
+
+  if (!status)
+    {
+      struct timespec t_start, t_end;
+      clock_gettime (CLOCK_MONOTONIC, &t_start);
+      sl_parallel_for (sweep.n_realisations, 8, n_workers, sqlimit_mc_range, &sweep);
+      status = atomic_load (&sweep.status);
+      clock_gettime (CLOCK_MONOTONIC, &t_end);
+      DEBUG_PRINT ("Time cost: %lf s for %zu realisations with %u worker(s)\n", (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) * 1E-9, sweep.n_realisations, n_workers);
+    }
+
+  if (!status)
+    {
+      for (size_t j = 0; j < eff_data.length; j++)
+        sqlimit_mc_band (sweep.efficiency + j * sweep.n_realisations, sweep.n_realisations, eff_data.confidence,
+                         &eff_data.efficiency_mean[j], &eff_data.efficiency_low[j], &eff_data.efficiency_high[j]);
+      sqlimit_mc_band (sweep.peak_bandgap, sweep.n_realisations, eff_data.confidence,
+                       &eff_data.peak_bandgap_mean, &eff_data.peak_bandgap_low, &eff_data.peak_bandgap_high);
+      sqlimit_mc_band (sweep.peak_efficiency, sweep.n_realisations, eff_data.confidence,
+                       &eff_data.peak_efficiency_mean, &eff_data.peak_efficiency_low, &eff_data.peak_efficiency_high);
+      printf ("Max efficiency %lf%% [%lf%%, %lf%%] at %lf eV [%lf eV, %lf eV] (%zu realisations, %.0lf%% confidence)\n",
+              eff_data.peak_efficiency_mean * 100, eff_data.peak_efficiency_low * 100, eff_data.peak_efficiency_high * 100,
+              eff_data.peak_bandgap_mean / eV, eff_data.peak_bandgap_low / eV, eff_data.peak_bandgap_high / eV,
+              eff_data.n_realisations, eff_data.confidence * 100);
+    }
+  else
+    {
+      fprintf (stderr, "ERROR: %s\n", gsl_strerror (status));
+      eff_bg_mc_clear (&eff_data);
+    }
+
+  for (unsigned int w = 0; sweep.scratch && w < n_workers; w++)
+    {
+      if (sweep.scratch[w].rng)
+        gsl_rng_free (sweep.scratch[w].rng);
+      free (sweep.scratch[w].wavelengths);
+      free (sweep.scratch[w].intensities);
+      spectrum_table_free (sweep.scratch[w].table);
+    }
+  free (sweep.scratch);
+  free (sweep.efficiency);
+  free (sweep.peak_bandgap);
+  free (sweep.peak_efficiency);
+  free (rr0);
+  return eff_data;
+}
+
+/* The weights of the spectrum_table integrals on a fixed wavelength grid, for sweeping
+ * many spectra sampled on it. They are linear in the intensities, so the photon flux of
+ * a spectrum above each bandgap is a prefix sum plus two products. */
+struct sqlimit_band_weights
+{
+  size_t  bands;
+  size_t  length;            // bandgaps
+  double *segment_lo;        /* 1/(m^2 s) per W/(m^2 nm), first point of every segment */
+  double *segment_hi;        // last point of every segment
+  double *radiation_weight;  /* nm, per band */
+  size_t *gap_segment;       // per bandgap, the segment holding its wavelength
+  double *gap_lo;            // per bandgap, weights of the partial segment
+  double *gap_hi;
+};
+
+/* What every pixel of a cube shares: the band weights and RR0 */
+struct sqlimit_cube_sweep
+{
+  const struct envi_cube      *cube;
+  struct eff_bg_cube          *eff_data;
+  size_t                       tile_pixels;
+  size_t                       n_pixels;
+  struct sqlimit_band_weights  weights;
+  const double                *bandgap;      /* J */
+  double                      *rr0;          // per bandgap
+  size_t                       length;
+  double                       temperature;  /* K */
+  double                     **tiles;        // per worker, tile_pixels × bands
+  double                     **cum_photons;  // per worker, per band
+  double                     **efficiency;   // per worker, per bandgap
+};
+
+static double
+sqlimit_band_radiation (const struct sqlimit_band_weights *weights,
+                        const double                      *intensities)
+{
+  double radiation = 0;  /* W/m^2 */
+  for (size_t k = 0; k < weights->bands; k++)
+    radiation += weights->radiation_weight[k] * intensities[k];
+  return radiation;
+}
+
+/* Photon flux above every bandgap; cum_photons is scratch of one value per band */
+static void
+sqlimit_band_photons (const struct sqlimit_band_weights *weights,
+                      const double                      *intensities,
+                      double                            *cum_photons,
+                      double                            *photons)
+{
+  cum_photons[0] = 0;
+  for (size_t k = 1; k < weights->bands; k++)
+    cum_photons[k] = cum_photons[k - 1] + weights->segment_lo[k - 1] * intensities[k - 1] + weights->segment_hi[k - 1] * intensities[k];
+  for (size_t j = 0; j < weights->length; j++)
+    {
+      const size_t k = weights->gap_segment[j];
+      photons[j] = cum_photons[k] + weights->gap_lo[j] * intensities[k] + weights->gap_hi[j] * intensities[k + 1];
+    }
+}
+
+/* Vertex of the parabola through the best grid point of a curve and its neighbours */
+static void
+sqlimit_curve_peak (const double *bandgap,
+                    const double *curve,
+                    size_t        length,
+                    double       *peak_bandgap,
+                    double       *peak_value)
+{
+  size_t best = 0;
+  for (size_t j = 1; j < length; j++)
+    if (curve[j] > curve[best])
+      best = j;
+  *peak_bandgap = bandgap[best];
+  *peak_value = curve[best];
+  if (best > 0 && best + 1 < length)
+    {
+      const double e0 = curve[best - 1], e2 = curve[best + 1];
+      const double curvature = e0 - 2 * curve[best] + e2;
+      if (curvature < 0)
+        {
+          const double offset = 0.5 * (e0 - e2) / curvature;
+          *peak_bandgap += offset * (bandgap[best + 1] - bandgap[best - 1]) / 2;
+          *peak_value -= 0.25 * (e0 - e2) * offset;
+        }
+    }
+}
+
+void
+eff_bg_cube_clear (struct eff_bg_cube *eff_data)
+{
+  free (eff_data->peak_bandgap);
+  free (eff_data->peak_efficiency);
+  *eff_data = (struct eff_bg_cube) {0};
+}
+
+static void
+sqlimit_cube_range (size_t        begin,
+                    size_t        end,
+                    unsigned int  worker_index,
+                    void         *user_data)
+{
+  struct sqlimit_cube_sweep *sweep = (struct sqlimit_cube_sweep *)user_data;
+  const size_t bands = sweep->cube->bands, length = sweep->length;
+  double *tile = sweep->tiles[worker_index], *cum_photons = sweep->cum_photons[worker_index];
+  double *efficiency = sweep->efficiency[worker_index];
+  struct sqlimit_operating_point op;
+  double peak_bandgap, peak_efficiency;
+
+  for (size_t t = begin; t < end; t++)
+    {
+      const size_t first = t * sweep->tile_pixels;
+      const size_t n = GSL_MIN (sweep->tile_pixels, sweep->n_pixels - first);
+      envi_cube_read (sweep->cube, first, n, tile);
+      for (size_t p = 0; p < n; p++)
+        {
+          const double *intensities = tile + p * bands;
+          const double radiation = sqlimit_band_radiation (&sweep->weights, intensities);  /* W/m^2 */
+          if (!(radiation > 0))
+            {
+              sweep->eff_data->peak_bandgap[first + p] = GSL_NAN;
+              sweep->eff_data->peak_efficiency[first + p] = 0;
+              continue;
+            }
+          /* The photon fluxes are overwritten in place by the efficiencies */
+          sqlimit_band_photons (&sweep->weights, intensities, cum_photons, efficiency);
+          for (size_t j = 0; j < length; j++)
+            {
+              operating_point_from_flux (efficiency[j], sweep->rr0[j], sweep->temperature, radiation, &op);
+              efficiency[j] = op.efficiency;
+            }
+          sqlimit_curve_peak (sweep->bandgap, efficiency, length, &peak_bandgap, &peak_efficiency);
+          sweep->eff_data->peak_bandgap[first + p] = peak_bandgap;
+          sweep->eff_data->peak_efficiency[first + p] = peak_efficiency;
+        }
+    }
+}
+
+/* Integration weights on the band grid, see spectrum_table.c: a whole segment [a, b] of
+ * width h contributes h / 6 ((2 a + b) I_a + (a + 2 b) I_b) / (h c) photons, and the part
+ * [a, a + u] below a gap wavelength contributes
+ *   ((a u + u^2 / 2 - (a u^2 / 2 + u^3 / 3) / h) I_a + (a u^2 / 2 + u^3 / 3) / h I_b) / (h c) */
+static int
+sqlimit_band_weights_init (struct sqlimit_band_weights *weights,
+                           const double                *wavelengths,  /* nm, ascending */
+                           size_t                       bands,
+                           const double                *bandgap,      /* J */
+                           size_t                       length)
+{
+  const double photon_scale = 1E-9 / (hPlanck * c0);
+
+  weights->bands = bands;
+  weights->length = length;
+  weights->segment_lo = (double *)calloc (bands, sizeof (double));
+  weights->segment_hi = (double *)calloc (bands, sizeof (double));
+  weights->radiation_weight = (double *)calloc (bands, sizeof (double));
+  weights->gap_segment = (size_t *)calloc (length, sizeof (size_t));
+  weights->gap_lo = (double *)calloc (length, sizeof (double));
+  weights->gap_hi = (double *)calloc (length, sizeof (double));
+  if (!weights->segment_lo || !weights->segment_hi || !weights->radiation_weight
+      || !weights->gap_segment || !weights->gap_lo || !weights->gap_hi)
+    return GSL_ENOMEM;
+
+  for (size_t k = 0; k + 1 < bands; k++)
+    {
+      const double a = wavelengths[k], b = wavelengths[k + 1], h = b - a;
+      weights->segment_lo[k] = h / 6 * (2 * a + b) * photon_scale;
+      weights->segment_hi[k] = h / 6 * (a + 2 * b) * photon_scale;
+      weights->radiation_weight[k] += h / 2;
+      weights->radiation_weight[k + 1] += h / 2;
+    }
+  for (size_t j = 0; j < length; j++)
+    {
+      const double lambda_gap = hPlanck * c0 / bandgap[j] * 1E9;  /* nm */
+      if (!(lambda_gap > wavelengths[0] && lambda_gap < wavelengths[bands - 1]))
+        return GSL_EDOM;
+      const size_t k = gsl_interp_bsearch (wavelengths, lambda_gap, 0, bands - 1);
+      const double a = wavelengths[k], h = wavelengths[k + 1] - a, u = lambda_gap - a;
+      const double upper = (a * u * u / 2 + u * u * u / 3) / h;
+      weights->gap_segment[j] = k;
+      weights->gap_lo[j] = (a * u + u * u / 2 - upper) * photon_scale;
+      weights->gap_hi[j] = upper * photon_scale;
+    }
+  return GSL_SUCCESS;
+}
+
+static void
+sqlimit_band_weights_free (struct sqlimit_band_weights *weights)
+{
+  free (weights->segment_lo);
+  free (weights->segment_hi);
+  free (weights->radiation_weight);
+  free (weights->gap_segment);
+  free (weights->gap_lo);
+  free (weights->gap_hi);
+  *weights = (struct sqlimit_band_weights) {0};
+}
+
+/* Optimum bandgap and efficiency of every pixel of a hyperspectral cube. The cube is split
+ * into tiles of block_size pixels that the workers convert from the mapped file and sweep;
+ * nothing per pixel is allocated and no spline is built. */
+struct eff_bg_cube
+sqlimit_main_cube (const struct envi_cube       *cube,
+                   const struct sqlimit_options *options)
+{
+  struct eff_bg_cube eff_data = {0};
+  struct sqlimit_cube_sweep sweep = {0};
+  const unsigned int n_workers = sl_pool_resolve_workers (options ? options->n_threads : 1);
+  const size_t bands = cube->bands;
+
+  if (bands < 2)
+    {
+      fprintf (stderr, "ERROR: A cube needs at least 2 bands, got %zu.\n", bands);
+      return eff_data;
+    }
+
+  sweep.cube = cube;
+  sweep.eff_data = &eff_data;
+  sweep.tile_pixels = options && options->block_size ? options->block_size : 4096;
+  sweep.n_pixels = cube->samples * cube->lines;
+  sweep.temperature = options && options->temperature > 0 ? options->temperature : Tcell;  /* K */
+  sweep.length = options && options->n_points >= 3 ? options->n_points : 100;
+  const double E_min = hPlanck * c0 / (cube->wavelengths[bands - 1] * 1E-9), E_max = hPlanck * c0 / (cube->wavelengths[0] * 1E-9);  /* J */
+  double *bandgap = linspace (E_min + 0.01 * eV, E_max - 0.01 * eV, sweep.length);
+  sweep.bandgap = bandgap;
+
+  eff_data.samples = cube->samples;
+  eff_data.lines = cube->lines;
+  eff_data.peak_bandgap = (double *)malloc (sweep.n_pixels * sizeof (double));
+  eff_data.peak_efficiency = (double *)malloc (sweep.n_pixels * sizeof (double));
+  sweep.tiles = (double **)calloc (n_workers, sizeof (double *));
+  sweep.cum_photons = (double **)calloc (n_workers, sizeof (double *));
+  sweep.efficiency = (double **)calloc (n_workers, sizeof (double *));
+  int status = GSL_SUCCESS;
+  if (!bandgap || !eff_data.peak_bandgap || !eff_data.peak_efficiency || !sweep.tiles || !sweep.cum_photons || !sweep.efficiency)
+    status = GSL_ENOMEM;
+  for (unsigned int w = 0; !status && w < n_workers; w++)
+    {
+      sweep.tiles[w] = (double *)malloc (sweep.tile_pixels * bands * sizeof (double));
+      sweep.cum_photons[w] = (double *)malloc (bands * sizeof (double));
+      sweep.efficiency[w] = (double *)malloc (sweep.length * sizeof (double));
+      if (!sweep.tiles[w] || !sweep.cum_photons[w] || !sweep.efficiency[w])
+        status = GSL_ENOMEM;
+    }
+  if (!status)
+    status = sqlimit_band_weights_init (&sweep.weights, cube->wavelengths, bands, bandgap, sweep.length);
+  if (!status)
+    {
+      sweep.rr0 = RR0_sweep (bandgap, sweep.length, E_max, sweep.temperature, SQLIMIT_QUAD_TABLE, NULL, NULL, NULL);
+      if (!sweep.rr0)
+        status = GSL_ENOMEM;
+    }
+
+  if (!status)
+    {
+      struct timespec t_start, t_end;
+      const size_t n_tiles = (sweep.n_pixels + sweep.tile_pixels - 1) / sweep.tile_pixels;
+      clock_gettime (CLOCK_MONOTONIC, &t_start);
+      sl_parallel_for (n_tiles, 1, n_workers, sqlimit_cube_range, &sweep);
+      clock_gettime (CLOCK_MONOTONIC, &t_end);
+      DEBUG_PRINT ("Time cost: %lf s for %zu pixels in %zu tiles with %u worker(s)\n", (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) * 1E-9, sweep.n_pixels, n_tiles, n_workers);
+    }
+  if (status)
+    {
+      fprintf (stderr, "ERROR: Failed to sweep the cube: %s\n", gsl_strerror (status));
+      eff_bg_cube_clear (&eff_data);
+    }
+
+  for (unsigned int w = 0; w < n_workers; w++)
+    {
+      if (sweep.tiles)
+        free (sweep.tiles[w]);
+      if (sweep.cum_photons)
+        free (sweep.cum_photons[w]);
+      if (sweep.efficiency)
+        free (sweep.efficiency[w]);
+    }
+  free (sweep.tiles);
+  free (sweep.cum_photons);
+  free (sweep.efficiency);
+  sqlimit_band_weights_free (&sweep.weights);
+  free (sweep.rr0);
+  free (bandgap);
+  return eff_data;
+}
+
+struct sqlimit_yield_job;
+
+/* One spectrum of the window between the reader and the workers */
+struct sqlimit_yield_slot
+{
+  struct sqlimit_yield_job  *job;
+  double                    *intensities;  /* W/(m^2 nm) */
+  struct sqlimit_yield_slot *next_free;
+};
+
+/* The first row of the stream fixes the wavelength grid and with it everything the
+ * spectra share; every worker then sums the yield of the spectra it runs into its own
+ * accumulators, which are combined once the stream ends. */
+struct sqlimit_yield_job
+{
+  struct sqlimit_yield         *yield_data;
+  const struct sqlimit_options *options;
+  struct sqlimit_band_weights   weights;
+  double                       *rr0;          // per bandgap
+  double                        temperature;  /* K */
+  double                        interval;     /* s */
+  unsigned int                  n_workers;
+  double                      **cum_photons;  // per worker, per band
+  double                      **photons;      // per worker, per bandgap
+  double                      **energy;       /* J/m^2, per worker, per bandgap */
+  double                      **ff_energy;    // per worker, fill factor × energy per bandgap
+  double                       *incident;     /* J/m^2, per worker */
+  struct sqlimit_yield_slot    *slots;
+  size_t                        n_slots;
+  struct sl_pool               *pool;
+  int                           status;
+
+  pthread_mutex_t               lock;
+  pthread_cond_t                slot_cond;
+  struct sqlimit_yield_slot    *free_slots;
+};
+
+void
+sqlimit_yield_clear (struct sqlimit_yield *yield_data)
+{
+  free (yield_data->bandgap);
+  free (yield_data->energy);
+  free (yield_data->efficiency);
+  free (yield_data->fill_factor);
+  *yield_data = (struct sqlimit_yield) {0};
+}
+
+static void
+sqlimit_yield_run_task (void           *data,
+                        unsigned int    worker_index,
+                        struct sl_pool *pool,
+                        void           *user_data)
+{
+  struct sqlimit_yield_slot *slot = (struct sqlimit_yield_slot *)data;
+  struct sqlimit_yield_job *job = slot->job;
+  const double radiation = sqlimit_band_radiation (&job->weights, slot->intensities);  /* W/m^2 */
+  struct sqlimit_operating_point op;
+
+  if (radiation > 0)
+    {
+      double *photons = job->photons[worker_index];
+      double *energy = job->energy[worker_index], *ff_energy = job->ff_energy[worker_index];
+      sqlimit_band_photons (&job->weights, slot->intensities, job->cum_photons[worker_index], photons);
+      for (size_t j = 0; j < job->weights.length; j++)
+        {
+          operating_point_from_flux (photons[j], job->rr0[j], job->temperature, radiation, &op);
+          if (op.status != SQLIMIT_OK)
+            continue;
+          const double e = op.vmpp * op.jmpp * job->interval;  /* J/m^2 */
+          energy[j] += e;
+          ff_energy[j] += op.fill_factor * e;
+        }
+      job->incident[worker_index] += radiation * job->interval;
+    }
+
+  pthread_mutex_lock (&job->lock);
+  slot->next_free = job->free_slots;
+  job->free_slots = slot;
+  pthread_cond_signal (&job->slot_cond);
+  pthread_mutex_unlock (&job->lock);
+}
+
+/* Everything that depends on the wavelength grid, from the first row of the stream */
+static int
+sqlimit_yield_setup (struct sqlimit_yield_job *job,
+                     const double             *wavelengths,  /* nm */
+                     size_t                    bands)
+{
+  struct sqlimit_yield *yield_data = job->yield_data;
+  const struct sqlimit_options *options = job->options;
+
+  if (bands < 2)
+    {
+      fprintf (stderr, "ERROR: A spectrum needs at least 2 points, got %zu.\n", bands);
+      return GSL_EINVAL;
+    }
+  for (size_t k = 1; k < bands; k++)
+    if (!(wavelengths[k] > wavelengths[k - 1]))
+      {
+        fprintf (stderr, "ERROR: The wavelengths in the first row must be strictly ascending.\n");
+        return GSL_EINVAL;
+      }
+
+  const double E_min = hPlanck * c0 / (wavelengths[bands - 1] * 1E-9), E_max = hPlanck * c0 / (wavelengths[0] * 1E-9);  /* J */
+  yield_data->length = options && options->n_points >= 3 ? options->n_points : 100;
+  yield_data->bandgap = linspace (E_min + 0.01 * eV, E_max - 0.01 * eV, yield_data->length);
+  yield_data->energy = (double *)calloc (yield_data->length, sizeof (double));
+  yield_data->efficiency = (double *)calloc (yield_data->length, sizeof (double));
+  yield_data->fill_factor = (double *)calloc (yield_data->length, sizeof (double));
+  if (!yield_data->bandgap || !yield_data->energy || !yield_data->efficiency || !yield_data->fill_factor)
+    return GSL_ENOMEM;
+  int status = sqlimit_band_weights_init (&job->weights, wavelengths, bands, yield_data->bandgap, yield_data->length);
+  if (status)
+    return status;
+  job->rr0 = RR0_sweep (yield_data->bandgap, yield_data->length, E_max, job->temperature, SQLIMIT_QUAD_TABLE, NULL, NULL, NULL);
+
+  job->cum_photons = (double **)calloc (job->n_workers, sizeof (double *));
+  job->photons = (double **)calloc (job->n_workers, sizeof (double *));
+  job->energy = (double **)calloc (job->n_workers, sizeof (double *));
+  job->ff_energy = (double **)calloc (job->n_workers, sizeof (double *));
+  job->incident = (double *)calloc (job->n_workers, sizeof (double));
+  job->n_slots = 2 * job->n_workers;
+  job->slots = (struct sqlimit_yield_slot *)calloc (job->n_slots, sizeof (struct sqlimit_yield_slot));
+  if (!job->rr0 || !job->cum_photons || !job->photons || !job->energy || !job->ff_energy || !job->incident || !job->slots)
+    return GSL_ENOMEM;
+  for (unsigned int w = 0; w < job->n_workers; w++)
+    {
+      job->cum_photons[w] = (double *)malloc (bands * sizeof (double));
+      job->photons[w] = (double *)malloc (yield_data->length * sizeof (double));
+      job->energy[w] = (double *)calloc (yield_data->length, sizeof (double));
+      job->ff_energy[w] = (double *)calloc (yield_data->length, sizeof (double));
+      if (!job->cum_photons[w] || !job->photons[w] || !job->energy[w] || !job->ff_energy[w])
+        return GSL_ENOMEM;
+    }
+  for (size_t i = 0; i < job->n_slots; i++)
+    {
+      struct sqlimit_yield_slot *slot = &job->slots[i];
+      slot->job = job;
+      slot->intensities = (double *)malloc (bands * sizeof (double));
+      if (!slot->intensities)
+        return GSL_ENOMEM;
+      slot->next_free = job->free_slots;
+      job->free_slots = slot;
+    }
+
+  job->pool = sl_pool_new (job->n_workers, sqlimit_yield_run_task, job);
+  return job->pool ? GSL_SUCCESS : GSL_ENOMEM;
+}
+
+/* Called by the reader for every row: the wavelengths, then one spectrum per interval.
+ * A spectrum waits for a free slot, so no more than the window is ever held. */
+static int
+sqlimit_yield_row (unsigned int  row,
+                   const double *values,
+                   unsigned int  n_values,
+                   void         *user_data)
+{
+  struct sqlimit_yield_job *job = (struct sqlimit_yield_job *)user_data;
+  if (!row)
+    {
+      job->status = sqlimit_yield_setup (job, values, n_values);
+      return job->status != GSL_SUCCESS;
+    }
+
+  pthread_mutex_lock (&job->lock);
+  while (!job->free_slots)
+    pthread_cond_wait (&job->slot_cond, &job->lock);
+  struct sqlimit_yield_slot *slot = job->free_slots;
+  job->free_slots = slot->next_free;
+  pthread_mutex_unlock (&job->lock);
+
+  memcpy (slot->intensities, values, n_values * sizeof (double));
+  job->yield_data->n_spectra++;
+  sl_pool_push (job->pool, slot);
+  return 0;
+}
+
+/* Energy yield per bandgap of a time series of spectra such as a year of hourly spectra,
+ * stored like poly_spectrum.csv: a row of wavelengths (nm), then one row of intensities
+ * (W/(m^2 nm)) per spectrum. The file is streamed through a window of two spectra per
+ * worker, so memory does not grow with its length. interval is the duration of every
+ * spectrum in s, 0 uses 3600; the bandgap grid and the workers follow the options. */
+struct sqlimit_yield
+sqlimit_main_yield (FILE                         *fp,
+                    double                        interval,
+                    const struct sqlimit_options *options)
+{
+  struct sqlimit_yield yield_data = {0};
+  struct sqlimit_yield_job job = {0};
+  struct timespec t_start, t_end;
+
+  job.yield_data = &yield_data;
+  job.options = options;
+  job.interval = interval > 0 ? interval : 3600;
+  job.temperature = options && options->temperature > 0 ? options->temperature : Tcell;  /* K */
+  job.n_workers = sl_pool_resolve_workers (options ? options->n_threads : 1);
+  pthread_mutex_init (&job.lock, NULL);
+  pthread_cond_init (&job.slot_cond, NULL);
+
+  clock_gettime (CLOCK_MONOTONIC, &t_start);
+  const int read_status = read_csv_rows (fp, sqlimit_yield_row, &job);
+  if (job.pool)
+    {
+      sl_pool_wait (job.pool);
+      sl_pool_free (job.pool);
+    }
+  clock_gettime (CLOCK_MONOTONIC, &t_end);
+  DEBUG_PRINT ("Time cost: %lf s for %zu spectra with %u worker(s)\n", (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) * 1E-9, yield_data.n_spectra, job.n_workers);
+
+  int status = job.status;
+  if (!status && read_status)
+    status = GSL_EFAILED;
+  if (!status && !yield_data.n_spectra)
+    {
+      fprintf (stderr, "ERROR: The time series holds no spectra.\n");
+      status = GSL_EINVAL;
+    }
+  if (!status)
+    {
+      for (unsigned int w = 0; w < job.n_workers; w++)
+        yield_data.incident_energy += job.incident[w];
+      for (size_t j = 0; j < yield_data.length; j++)
+        {
+          double ff_energy = 0;
+          for (unsigned int w = 0; w < job.n_workers; w++)
+            {
+              yield_data.energy[j] += job.energy[w][j];
+              ff_energy += job.ff_energy[w][j];
+            }
+          yield_data.fill_factor[j] = yield_data.energy[j] > 0 ? ff_energy / yield_data.energy[j] : 0;
+          yield_data.efficiency[j] = yield_data.incident_energy > 0 ? yield_data.energy[j] / yield_data.incident_energy : 0;
+        }
+      sqlimit_curve_peak (yield_data.bandgap, yield_data.energy, yield_data.length, &yield_data.peak_bandgap, &yield_data.peak_energy);
+      printf ("Max energy yield %lf kWh/m^2 at %lf eV (%zu spectra of %lf s)\n", yield_data.peak_energy / 3.6E6, yield_data.peak_bandgap / eV, yield_data.n_spectra, job.interval);
+    }
+  else
+    {
+      fprintf (stderr, "ERROR: Failed to sweep the time series: %s\n", gsl_strerror (status));
+      sqlimit_yield_clear (&yield_data);
+    }
+
+  for (unsigned int w = 0; w < job.n_workers; w++)
+    {
+      if (job.cum_photons)
+        free (job.cum_photons[w]);
+      if (job.photons)
+        free (job.photons[w]);
+      if (job.energy)
+        free (job.energy[w]);
+      if (job.ff_energy)
+        free (job.ff_energy[w]);
+    }
+  for (size_t i = 0; job.slots && i < job.n_slots; i++)
+    free (job.slots[i].intensities);
+  free (job.cum_photons);
+  free (job.photons);
+  free (job.energy);
+  free (job.ff_energy);
+  free (job.incident);
+  free (job.slots);
+  free (job.rr0);
+  sqlimit_band_weights_free (&job.weights);
+  pthread_mutex_destroy (&job.lock);
+  pthread_cond_destroy (&job.slot_cond);
+  return yield_data;
+}
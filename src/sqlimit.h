@@ -21,6 +21,7 @@
 #include <stdio.h>
 
 #include "data_io.h"
+#include "absorptance.h"
 
 #ifndef SQLIMIT_H
 #define SQLIMIT_H
@@ -40,21 +41,222 @@ enum eff_bg_types
   EFF_BG_2D
 };
 
+/* Outcome of the maximum power point search of one bandgap */
+enum sqlimit_status
+{
+  SQLIMIT_OK,
+  SQLIMIT_NO_PHOTONS,     // no photon above the gap (at or beyond E_max), zero power
+  SQLIMIT_NO_VOLTAGE,     // photon flux below the dark recombination RR0, Voc <= 0
+  SQLIMIT_NO_CONVERGENCE  // V_mpp () hit its iteration cap
+};
+
+/* Figures of merit of one bandgap at the detailed-balance limit */
+struct sqlimit_operating_point
+{
+  double              jsc;          /* A/m^2 */
+  double              voc;          /* V */
+  double              vmpp;         /* V */
+  double              jmpp;         /* A/m^2 */
+  double              fill_factor;
+  double              efficiency;
+  enum sqlimit_status status;
+};
+
 struct eff_bg
 {
-  double *bandgap;
-  double *efficiency;
-  double *fill_factor;
-  size_t  length;
+  double              *bandgap;
+  double              *efficiency;
+  double              *fill_factor;
+  double              *jsc;
+  double              *voc;
+  double              *vmpp;
+  double              *jmpp;
+  enum sqlimit_status *status;
+  size_t               length;
+  double               peak_bandgap;     /* J */
+  double               peak_efficiency;
+  void                *mapping;          // set when the arrays live in a sqlimit_cache_load () mapping
+  size_t               mapping_size;
+};
+
+/* How the photon flux (and radiation) integrals over the spectrum are evaluated */
+enum sqlimit_quadrature
+{
+  SQLIMIT_QUAD_TABLE,             // exact prefix integrals of the linearly interpolated spectrum, series RR0
+  SQLIMIT_QUAD_QAGS,              // adaptive QAGS over the gsl_spline and RR0_integrand, as scipy.integrate.quad
+  SQLIMIT_QUAD_GAUSS_LEGENDRE,    // fixed-order Gauss-Legendre per spectrum segment and per RR0 panel
+  SQLIMIT_QUAD_CLENSHAW_CURTIS,   // fixed-order Clenshaw-Curtis, nested nodes, same segments and panels
+  SQLIMIT_QUAD_NATIVE             // adaptive Gauss-Legendre bisection to the QAGS tolerances, kernels inlined from sl_kernels.h
+};
+
+/* How the bandgaps of a single-spectrum sweep are chosen */
+enum sqlimit_grid
+{
+  SQLIMIT_GRID_UNIFORM,  // n_points evenly spaced bandgaps, peak at the best of them
+  SQLIMIT_GRID_ADAPTIVE  // coarse grid refined where the efficiency curves, peak by Brent's method
+};
+
+struct sqlimit_options
+{
+  unsigned int            n_threads;   // Number of sweep workers; 0 uses one per online CPU, 1 is the serial sweep
+  size_t                  block_size;  // Bandgaps per task of the multi-spectrum engine, 0 uses 10; pixels per cube tile, 0 uses 4096
+  enum sqlimit_quadrature quadrature;
+  enum sqlimit_grid       grid;            // Single-spectrum sweeps only
+  size_t                  n_points;        // Uniform grid or coarse adaptive pass; 0 uses 100 or 33 respectively
+  double                  peak_tolerance;  /* eV; width of the final peak bracket, 0 uses 1 meV */
+  double                  temperature;     /* K; cell temperature, 0 uses Tcell */
+  size_t                  quad_order;      // Nodes of the fixed-order and native quadratures; 0 uses 8
 };
 
 struct eff_bg_2d
 {
   double  *bandgap;
-  double **efficiency;  // Size of spectrum->num_datarows × length
+  double **efficiency;  // Size of spectrum->num_datarows × length; NaN for a spectrum that cannot be tabulated
+  size_t   length;
+};
+
+struct eff_bg_tcell
+{
+  double  *bandgap;
+  double  *temperature;     /* K */
+  double **efficiency;      // Size of n_temperatures × length
+  size_t   length;
+  size_t   n_temperatures;
+};
+
+struct eff_bg_concentration
+{
+  double  *bandgap;
+  double  *concentration;   /* suns */
+  double **efficiency;      // Size of n_concentrations × length
   size_t   length;
+  size_t   n_concentrations;
+};
+
+struct eff_bg_thickness
+{
+  double  *bandgap;
+  double  *thickness;       /* m */
+  double **efficiency;      // Size of n_thicknesses × length
+  size_t   length;
+  size_t   n_thicknesses;
+};
+
+/* Per-pixel maps of a hyperspectral cube, line by line */
+struct eff_bg_cube
+{
+  double *peak_bandgap;     /* J per pixel, NaN where the pixel receives no light */
+  double *peak_efficiency;  // per pixel
+  size_t  samples;
+  size_t  lines;
+};
+
+/* Solar-thermal absorber at T_hot driving a Carnot engine, per concentration */
+struct eff_thermal
+{
+  double  *T_hot;            /* K */
+  double  *absorption_edge;  /* m */
+  double  *concentration;    /* suns */
+  double **efficiency;       // Size of n_concentrations × (n_T_hot × n_edges), T_hot-major
+  double  *best_T_hot;       /* K, per concentration */
+  double  *best_edge;        /* m, per concentration */
+  double  *best_efficiency;  // per concentration
+  size_t   n_T_hot;
+  size_t   n_edges;
+  size_t   n_concentrations;
+};
+
+#define SQLIMIT_MAX_JUNCTIONS 4
+
+/* How the junctions of a tandem stack are connected */
+enum sqlimit_tandem
+{
+  SQLIMIT_TANDEM_SERIES,      // 2-terminal, current matched
+  SQLIMIT_TANDEM_INDEPENDENT  // 4-terminal; also the ideal 3-terminal limit of two junctions
+};
+
+/* Best stack of a tandem search, each junction absorbing what the ones above let through */
+struct eff_tandem
+{
+  double              bandgap[SQLIMIT_MAX_JUNCTIONS];  /* J, top junction first */
+  double              efficiency;
+  unsigned int        n_junctions;
+  enum sqlimit_tandem connection;
+  size_t              n_evaluated;  // complete stacks left after pruning
+};
+
+/* Caller-owned buffers of sqlimit_batch_eval (), n_spectra × n_bandgaps row-major
+ * or n_spectra long; any but efficiency may be NULL */
+struct sqlimit_batch_results
+{
+  double *efficiency;
+  double *fill_factor;
+  double *jsc;              /* A/m^2 */
+  double *voc;              /* V */
+  double *peak_bandgap;     /* J, best grid bandgap per spectrum */
+  double *peak_efficiency;  // per spectrum
+};
+
+struct sqlimit_batch_workspace;
+
+/* Calibration uncertainty of a measured spectrum, one standard deviation each; zero disables a term.
+ * Every term is Gaussian. A perturbed intensity below zero is clamped to zero, which is a
+ * censored rather than a truncated normal: where sigma is comparable to the intensity, as in
+ * the UV tail of astmg173, the perturbed spectra are biased upward and so are the mean and
+ * the confidence band of sqlimit_main_mc (). Keep sigma well below the intensity there. */
+struct sqlimit_noise
+{
+  const double *intensity_sigma;   /* W/(m^2 nm) per point, independent; may be NULL */
+  double        intensity_rel;     // relative, per point and independent
+  double        intensity_scale;   // relative, common to all points (absolute irradiance calibration)
+  double        wavelength_shift;  /* nm, common to all points (wavelength calibration) */
+};
+
+/* Monte Carlo statistics of a sweep over perturbed copies of a spectrum.
+ * low and high bound the central confidence interval of every quantity. */
+struct eff_bg_mc
+{
+  double *bandgap;               /* J */
+  double *efficiency_mean;
+  double *efficiency_low;
+  double *efficiency_high;
+  double  peak_bandgap_mean;     /* J */
+  double  peak_bandgap_low;      /* J */
+  double  peak_bandgap_high;     /* J */
+  double  peak_efficiency_mean;
+  double  peak_efficiency_low;
+  double  peak_efficiency_high;
+  double  confidence;
+  size_t  length;
+  size_t  n_realisations;
+};
+
+/* Energy yield of a spectral time series, every spectrum of which lasts the same interval.
+ * Spectra without light, such as at night, add nothing to any sum. */
+struct sqlimit_yield
+{
+  double *bandgap;          /* J */
+  double *energy;           /* J/m^2, per bandgap */
+  double *efficiency;       // energy / incident_energy, per bandgap
+  double *fill_factor;      // weighted by the energy of every spectrum, per bandgap
+  double  incident_energy;  /* J/m^2 */
+  size_t  length;
+  size_t  n_spectra;
+  double  peak_bandgap;     /* J, of the largest energy */
+  double  peak_energy;      /* J/m^2 */
 };
 
+/* Called by sqlimit_main_2d_stream () with the efficiency per bandgap of every spectrum, from
+ * any worker thread; the arrays only live until it returns. A spectrum that cannot be
+ * tabulated is reported on stderr instead, and the stream then returns GSL_EFAILED. */
+typedef void (*sqlimit_2d_func) (unsigned int  index,
+                                 const double *bandgap,     /* J */
+                                 const double *efficiency,
+                                 size_t        length,
+                                 void         *user_data);
+
+struct sqlimit_state;
+
 struct var_eff_bg
 {
   enum eff_bg_types type;
@@ -91,13 +293,162 @@ double           *linspace        (double start,
                                    double stop,
                                    size_t num);
 
+extern
+void              eff_bg_clear    (struct eff_bg *eff_bg_data);
+
+extern
+int               sqlimit_operating_point (struct csv_data                *spectrum,
+                                           double                          Egap,
+                                           struct sqlimit_operating_point *op);
+
+extern
+double            sqlimit_RR0     (double                  Egap,
+                                   double                  Emax,
+                                   enum sqlimit_quadrature quadrature);
+
 extern
 struct eff_bg     sqlimit_main    (struct csv_data *spectrum,
                                    bool             axis);
 
+extern
+struct eff_bg     sqlimit_main_full (struct csv_data              *spectrum,
+                                     bool                          axis,
+                                     const struct sqlimit_options *options);
+
+extern
+void              eff_bg_tcell_clear (struct eff_bg_tcell *eff_bg_data);
+
+extern
+struct eff_bg_tcell sqlimit_main_tcell (struct csv_data              *spectrum,
+                                        bool                          axis,
+                                        const double                 *temperatures,
+                                        size_t                        n_temperatures,
+                                        const struct sqlimit_options *options);
+
+extern
+void              eff_bg_concentration_clear (struct eff_bg_concentration *eff_bg_data);
+
+extern
+struct eff_bg_concentration sqlimit_main_concentration (struct csv_data              *spectrum,
+                                                        bool                          axis,
+                                                        const double                 *concentrations,
+                                                        size_t                        n_concentrations,
+                                                        const struct sqlimit_options *options);
+
+extern
+struct eff_bg     sqlimit_main_absorber (struct csv_data                 *spectrum,
+                                         bool                             axis,
+                                         const struct absorptance_params *absorber,
+                                         double                           thickness,
+                                         const struct sqlimit_options    *options);
+
+extern
+void              eff_bg_thickness_clear (struct eff_bg_thickness *eff_bg_data);
+
+extern
+struct eff_bg_thickness sqlimit_main_thickness (struct csv_data                 *spectrum,
+                                                bool                             axis,
+                                                const struct absorptance_params *absorber,
+                                                const double                    *thicknesses,  /* m */
+                                                size_t                           n_thicknesses,
+                                                const struct sqlimit_options    *options);
+
+extern
+void              eff_thermal_clear (struct eff_thermal *eff_data);
+
+extern
+struct eff_thermal sqlimit_main_thermal (struct csv_data              *spectrum,
+                                         bool                          axis,
+                                         const double                 *concentrations,
+                                         size_t                        n_concentrations,
+                                         double                        T_min,
+                                         double                        T_max,
+                                         const struct sqlimit_options *options);
+
+extern
+struct eff_tandem sqlimit_main_tandem (struct csv_data              *spectrum,
+                                       bool                          axis,
+                                       unsigned int                  n_junctions,
+                                       enum sqlimit_tandem           connection,
+                                       const struct sqlimit_options *options);
+
+extern
+struct sqlimit_batch_workspace *sqlimit_batch_workspace_alloc (size_t                        max_points,
+                                                               size_t                        max_bandgaps,
+                                                               const struct sqlimit_options *options);
+
+extern
+void              sqlimit_batch_workspace_free (struct sqlimit_batch_workspace *ws);
+
+extern
+int               sqlimit_batch_eval (struct sqlimit_batch_workspace *ws,
+                                      const struct csv_data_2d       *spectra,
+                                      const double                   *bandgap,
+                                      size_t                          n_bandgaps,
+                                      struct sqlimit_batch_results   *results);
+
+extern
+struct sqlimit_state *sqlimit_state_new (struct csv_data              *spectrum,
+                                         const struct sqlimit_options *options);
+
+extern
+void              sqlimit_state_free (struct sqlimit_state *state);
+
+extern
+const struct eff_bg *sqlimit_state_results (const struct sqlimit_state *state);
+
+extern
+int               sqlimit_state_update (struct sqlimit_state *state,
+                                        size_t                first,
+                                        size_t                last,
+                                        size_t               *n_solved);
+
+extern
+int               sqlimit_state_clip (struct sqlimit_state *state,
+                                      size_t                first,
+                                      size_t                last);
+
+extern
+void              eff_bg_mc_clear (struct eff_bg_mc *eff_data);
+
+extern
+struct eff_bg_mc  sqlimit_main_mc (struct csv_data              *spectrum,
+                                   bool                          axis,
+                                   const struct sqlimit_noise   *noise,
+                                   size_t                        n_realisations,
+                                   double                        confidence,
+                                   unsigned long                 seed,
+                                   const struct sqlimit_options *options);
+
+extern
+void              eff_bg_cube_clear (struct eff_bg_cube *eff_data);
+
+extern
+struct eff_bg_cube sqlimit_main_cube (const struct envi_cube       *cube,
+                                      const struct sqlimit_options *options);
+
+extern
+void              sqlimit_yield_clear (struct sqlimit_yield *yield_data);
+
+extern
+struct sqlimit_yield sqlimit_main_yield (FILE                         *fp,
+                                         double                        interval,
+                                         const struct sqlimit_options *options);
+
 extern
 struct eff_bg_2d  sqlimit_main_2d (struct csv_data_2d *spectrum,
                                    bool                axis);
 
+extern
+struct eff_bg_2d  sqlimit_main_2d_full (struct csv_data_2d           *spectrum,
+                                        bool                          axis,
+                                        const struct sqlimit_options *options);
+
+extern
+int               sqlimit_main_2d_stream (FILE                         *fp,
+                                          const struct sqlimit_options *options,
+                                          sqlimit_2d_func               func,
+                                          void                         *user_data);
+
 #endif  /* SQLIMIT_H */
 
@@ -0,0 +1,236 @@
+/* sqlimit_cache.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gsl/gsl_errno.h>
+
+#include "sqlimit_cache.h"
+#include "utils.h"
+
+#define SQLIMIT_CACHE_FORMAT 1
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+
+/* Followed by the bandgap, efficiency, fill_factor, jsc, voc, vmpp and jmpp arrays,
+ * then the status array; everything in host byte order. */
+struct sqlimit_cache_header
+{
+  char     magic[8];
+  uint32_t format;
+  uint32_t status_size;  // sizeof (enum sqlimit_status) of the writer
+  uint64_t key;
+  uint64_t length;
+  double   peak_bandgap;  /* J */
+  double   peak_efficiency;
+};
+
+static const char sqlimit_cache_magic[8] = "SLCACHE";
+
+uint64_t
+sqlimit_cache_key (const struct csv_data        *spectrum,
+                   const struct sqlimit_options *options)
+{
+  const struct sqlimit_options defaults = {0};
+  if (!options)
+    options = &defaults;
+  const uint32_t model_version = SQLIMIT_CACHE_MODEL_VERSION;
+  const uint64_t length = spectrum->num_datarows;
+  const int32_t quadrature = options->quadrature, grid = options->grid;
+  const uint64_t n_points = options->n_points, quad_order = options->quad_order;
+  const double temperature = options->temperature > 0 ? options->temperature : Tcell;
+
+  uint64_t hash = FNV_OFFSET_BASIS;
+  hash = sl_fnv1a (hash, &model_version, sizeof (model_version));
+  hash = sl_fnv1a (hash, &length, sizeof (length));
+  hash = sl_fnv1a (hash, spectrum->wavelengths, length * sizeof (double));
+  hash = sl_fnv1a (hash, spectrum->intensities, length * sizeof (double));
+  hash = sl_fnv1a (hash, &quadrature, sizeof (quadrature));
+  hash = sl_fnv1a (hash, &grid, sizeof (grid));
+  hash = sl_fnv1a (hash, &n_points, sizeof (n_points));
+  hash = sl_fnv1a (hash, &options->peak_tolerance, sizeof (options->peak_tolerance));
+  hash = sl_fnv1a (hash, &temperature, sizeof (temperature));
+  hash = sl_fnv1a (hash, &quad_order, sizeof (quad_order));
+  return hash;
+}
+
+static int
+sqlimit_cache_path (char     *path,
+                    uint64_t  key,
+                    bool      create)
+{
+  char dir[PATH_MAX];
+  if (sl_cache_dir (dir, "sqlimit", create))
+    return GSL_EFAILED;
+  int n = snprintf (path, PATH_MAX, "%s/%016" PRIx64 ".bin", dir, key);
+  return n < 0 || n >= PATH_MAX ? GSL_EBADLEN : GSL_SUCCESS;
+}
+
+static size_t
+sqlimit_cache_size (size_t length)
+{
+  return sizeof (struct sqlimit_cache_header) + length * (7 * sizeof (double) + sizeof (enum sqlimit_status));
+}
+
+int
+sqlimit_cache_load (uint64_t       key,
+                    struct eff_bg *eff_bg_data)
+{
+  char path[PATH_MAX];
+  int status = sqlimit_cache_path (path, key, false);
+  if (status)
+    return status;
+
+  int fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return GSL_EOF;  // a miss
+  struct stat st;
+  if (fstat (fd, &st) || (size_t)st.st_size < sizeof (struct sqlimit_cache_header))
+    {
+      close (fd);
+      return GSL_EFAILED;
+    }
+  /* Private and writable: callers may scribble on the arrays without touching the file */
+  void *mapping = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (mapping == MAP_FAILED)
+    return GSL_EFAILED;
+
+  const struct sqlimit_cache_header *header = (const struct sqlimit_cache_header *)mapping;
+  if (memcmp (header->magic, sqlimit_cache_magic, sizeof (header->magic))
+      || header->format != SQLIMIT_CACHE_FORMAT
+      || header->status_size != sizeof (enum sqlimit_status)
+      || header->key != key
+      || header->length == 0
+      || sqlimit_cache_size (header->length) != (size_t)st.st_size)
+    {
+      fprintf (stderr, "WARNING: Ignoring the invalid sqlimit cache entry %s.\n", path);
+      munmap (mapping, st.st_size);
+      return GSL_EFAILED;
+    }
+
+  double *arrays = (double *)(header + 1);
+  const size_t length = header->length;
+  *eff_bg_data = (struct eff_bg) {0};
+  eff_bg_data->bandgap = arrays;
+  eff_bg_data->efficiency = arrays + length;
+  eff_bg_data->fill_factor = arrays + 2 * length;
+  eff_bg_data->jsc = arrays + 3 * length;
+  eff_bg_data->voc = arrays + 4 * length;
+  eff_bg_data->vmpp = arrays + 5 * length;
+  eff_bg_data->jmpp = arrays + 6 * length;
+  eff_bg_data->status = (enum sqlimit_status *)(arrays + 7 * length);
+  eff_bg_data->length = length;
+  eff_bg_data->peak_bandgap = header->peak_bandgap;
+  eff_bg_data->peak_efficiency = header->peak_efficiency;
+  eff_bg_data->mapping = mapping;
+  eff_bg_data->mapping_size = st.st_size;
+  return GSL_SUCCESS;
+}
+
+static int
+write_all (int         fd,
+           const void *data,
+           size_t      size)
+{
+  const char *bytes = (const char *)data;
+  while (size)
+    {
+      ssize_t n = write (fd, bytes, size);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return GSL_EFAILED;
+      bytes += n;
+      size -= n;
+    }
+  return GSL_SUCCESS;
+}
+
+int
+sqlimit_cache_store (uint64_t             key,
+                     const struct eff_bg *eff_bg_data)
+{
+  const size_t length = eff_bg_data->length;
+  if (!length || !eff_bg_data->bandgap || !eff_bg_data->efficiency || !eff_bg_data->fill_factor || !eff_bg_data->jsc
+      || !eff_bg_data->voc || !eff_bg_data->vmpp || !eff_bg_data->jmpp || !eff_bg_data->status)
+    return GSL_EINVAL;
+
+  char path[PATH_MAX], tmp_path[PATH_MAX];
+  int status = sqlimit_cache_path (path, key, true);
+  if (status)
+    return status;
+  if (snprintf (tmp_path, PATH_MAX, "%s.XXXXXX", path) >= PATH_MAX)
+    return GSL_EBADLEN;
+  /* Written aside and renamed into place, so that a concurrent run never maps half a file */
+  int fd = mkstemp (tmp_path);
+  if (fd < 0)
+    return GSL_EFAILED;
+
+  struct sqlimit_cache_header header = {0};
+  memcpy (header.magic, sqlimit_cache_magic, sizeof (header.magic));
+  header.format = SQLIMIT_CACHE_FORMAT;
+  header.status_size = sizeof (enum sqlimit_status);
+  header.key = key;
+  header.length = length;
+  header.peak_bandgap = eff_bg_data->peak_bandgap;
+  header.peak_efficiency = eff_bg_data->peak_efficiency;
+
+  const double *arrays[] = { eff_bg_data->bandgap, eff_bg_data->efficiency, eff_bg_data->fill_factor, eff_bg_data->jsc,
+                             eff_bg_data->voc, eff_bg_data->vmpp, eff_bg_data->jmpp };
+  status = write_all (fd, &header, sizeof (header));
+  for (size_t a = 0; !status && a < sizeof (arrays) / sizeof (arrays[0]); a++)
+    status = write_all (fd, arrays[a], length * sizeof (double));
+  if (!status)
+    status = write_all (fd, eff_bg_data->status, length * sizeof (enum sqlimit_status));
+  if (close (fd) && !status)
+    status = GSL_EFAILED;
+  if (!status && rename (tmp_path, path))
+    status = GSL_EFAILED;
+  if (status)
+    unlink (tmp_path);
+  return status;
+}
+
+struct eff_bg
+sqlimit_main_cached (struct csv_data              *spectrum,
+                     bool                          axis,
+                     const struct sqlimit_options *options)
+{
+  struct eff_bg eff_bg_data = {0};
+  const uint64_t key = sqlimit_cache_key (spectrum, options);
+  if (!sqlimit_cache_load (key, &eff_bg_data))
+    {
+      DEBUG_PRINT ("sqlimit cache hit %016" PRIx64 ".\n", key);
+      printf ("Max efficiency %lf%% at %lf eV (%zu bandgaps)\n", eff_bg_data.peak_efficiency * 100, eff_bg_data.peak_bandgap / eV, eff_bg_data.length);
+      return eff_bg_data;
+    }
+
+  eff_bg_data = sqlimit_main_full (spectrum, axis, options);
+  if (eff_bg_data.efficiency && sqlimit_cache_store (key, &eff_bg_data))
+    fprintf (stderr, "WARNING: Failed to cache the sqlimit results %016" PRIx64 ".\n", key);
+  return eff_bg_data;
+}
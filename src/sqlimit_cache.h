@@ -0,0 +1,56 @@
+/* sqlimit_cache.h
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdint.h>
+
+#include "sqlimit.h"
+
+#ifndef SQLIMIT_CACHE_H
+#define SQLIMIT_CACHE_H
+
+/* Part of every cache key: bump it whenever a change to the engine changes its results,
+ * so that entries written by an older build are never returned. */
+#define SQLIMIT_CACHE_MODEL_VERSION 1
+
+/* Content-addressed cache of sqlimit_main_full () results under
+ * $XDG_CACHE_HOME/gnome-semilab/sqlimit (~/.cache when unset), one file per key.
+ * The key hashes the spectrum arrays and every option that changes the results;
+ * n_threads and block_size do not. A hit maps the file instead of reading it:
+ * the arrays of the returned eff_bg point into the private mapping, which
+ * eff_bg_clear () unmaps. */
+
+extern
+uint64_t      sqlimit_cache_key   (const struct csv_data        *spectrum,
+                                   const struct sqlimit_options *options);
+
+extern
+int           sqlimit_cache_load  (uint64_t                      key,
+                                   struct eff_bg                *eff_bg_data);
+
+extern
+int           sqlimit_cache_store (uint64_t                      key,
+                                   const struct eff_bg          *eff_bg_data);
+
+extern
+struct eff_bg sqlimit_main_cached (struct csv_data              *spectrum,
+                                   bool                          axis,
+                                   const struct sqlimit_options *options);
+
+#endif /* SQLIMIT_CACHE_H */
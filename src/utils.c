@@ -18,8 +18,15 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
 #include "utils.h"
 
+#define FNV_PRIME 0x100000001b3ULL
+
 #if defined(__MINGW32__) || defined(_MSC_VER)
 wchar_t *
 sl_multibyte_to_wchar_str (const char* in_mb_str)
@@ -145,3 +152,56 @@ matrix_transpose(double *m,
     }
 }
 
+/* 64-bit FNV-1a, to be started from 0xcbf29ce484222325; not cryptographic, but the caches
+ * only have to tell their entries apart */
+uint64_t
+sl_fnv1a (uint64_t    hash,
+          const void *data,
+          size_t      size)
+{
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; i++)
+    {
+      hash ^= bytes[i];
+      hash *= FNV_PRIME;
+    }
+  return hash;
+}
+
+/* $XDG_CACHE_HOME/gnome-semilab/subdir, or ~/.cache/gnome-semilab/subdir when unset, into dir
+ * of PATH_MAX bytes; created on demand when `create' is set. Returns 0 or -1. */
+int
+sl_cache_dir (char       *dir,
+              const char *subdir,
+              bool        create)
+{
+  const char *xdg_cache_home = getenv ("XDG_CACHE_HOME");
+  const char *home = getenv ("HOME");
+  int n;
+  if (xdg_cache_home && xdg_cache_home[0] == '/')
+    n = snprintf (dir, PATH_MAX, "%s/gnome-semilab/%s", xdg_cache_home, subdir);
+  else if (home && home[0])
+    n = snprintf (dir, PATH_MAX, "%s/.cache/gnome-semilab/%s", home, subdir);
+  else
+    return -1;
+  if (n < 0 || n >= PATH_MAX)
+    return -1;
+  if (!create)
+    return 0;
+
+  /* mkdir -p, skipping the leading '/' */
+  for (char *p = dir + 1; ; p++)
+    {
+      if (*p != '/' && *p != '\0')
+        continue;
+      const char c = *p;
+      *p = '\0';
+      int err = mkdir (dir, 0700) && errno != EEXIST;
+      *p = c;
+      if (err)
+        return -1;
+      if (c == '\0')
+        break;
+    }
+  return 0;
+}
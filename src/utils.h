@@ -20,6 +20,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #if defined(__MINGW32__) || defined(_MSC_VER)
 extern
@@ -45,3 +46,12 @@ void     matrix_transpose          (double *m,
                                     int     w,
                                     int     h);
 
+extern
+uint64_t sl_fnv1a                  (uint64_t    hash,
+                                    const void *data,
+                                    size_t      size);
+
+extern
+int      sl_cache_dir              (char       *dir,
+                                    const char *subdir,
+                                    bool        create);
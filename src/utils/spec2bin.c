@@ -0,0 +1,55 @@
+/* spec2bin.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Converts CSV spectra with a header row and SCAPS spectra (*.spe) to .slspec, which
+ * spectrum_bin_open () maps without parsing. Every column of a CSV file is kept.
+ * Usage: spec2bin input [output]; the output defaults to the input with .slspec appended. */
+
+#include <stdlib.h>
+#include <limits.h>
+
+#include "../spectrum_bin.h"
+
+int
+main (int   argc,
+      char *argv[])
+{
+  char path[PATH_MAX];
+  if (argc < 2 || argc > 3)
+    {
+      fprintf (stderr, "Usage: %s input [output]\n", argv[0]);
+      exit (EXIT_FAILURE);
+    }
+  if (snprintf (path, PATH_MAX, argc == 3 ? "%s" : "%s" SPECTRUM_BIN_SUFFIX, argv[argc - 1]) >= PATH_MAX)
+    {
+      fprintf (stderr, "ERROR: The path %s is too long.\n", argv[argc - 1]);
+      exit (EXIT_FAILURE);
+    }
+  if (spectrum_bin_convert (argv[1], path))
+    exit (EXIT_FAILURE);
+
+  struct spectrum_bin *bin = spectrum_bin_open (path);
+  if (!bin)
+    exit (EXIT_FAILURE);
+  printf ("INFO: Wrote %s: %zu rows of %u columns, %s and %s.\n", path, bin->num_rows, bin->num_columns,
+          bin->wavelength_unit, bin->intensity_unit);
+  spectrum_bin_free (bin);
+  exit (EXIT_SUCCESS);
+}
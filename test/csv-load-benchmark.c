@@ -0,0 +1,241 @@
+/* csv-load-benchmark.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <csv.h>
+
+#include "../src/data_io.h"
+#include "../src/utils.h"
+
+/* The loader read_csv (fp, true, VERTICAL, 1) had before it became one pass: the header is
+ * parsed by read_csv_fields (), the file is rewound and parsed again into one row-major
+ * buffer, which is transposed in place and copied into two arrays of the buffer size. */
+struct legacy_body
+{
+  double       *data;
+  unsigned int  size;
+  unsigned int  buffer_size;
+  unsigned int  num_rows;
+  unsigned int  num_cols;
+};
+
+static void
+legacy_cell (void   *s,
+             size_t  len,
+             void   *data)
+{
+  struct legacy_body *body = (struct legacy_body *)data;
+  if (!body->num_rows)
+    {
+      body->num_cols++;
+      return;
+    }
+  if (body->size + 1 >= body->buffer_size)
+    {
+      body->buffer_size = body->data ? 2 * body->buffer_size : body->num_cols * 1024;
+      body->data = body->data ? (double *)realloc (body->data, sizeof (double) * body->buffer_size)
+                              : (double *)calloc (body->buffer_size, sizeof (double));
+    }
+  body->data[body->size++] = strtod ((const char *)s, NULL);
+}
+
+static void
+legacy_row (int   c,
+            void *data)
+{
+  ((struct legacy_body *)data)->num_rows++;
+}
+
+static struct csv_data *
+legacy_read_csv (FILE *fp)
+{
+  char buf[4096];
+  size_t bytes_read;
+  struct csv_parser p;
+  struct legacy_body body = {0};
+  struct csv_data *spectrum = (struct csv_data *)calloc (1, sizeof (struct csv_data));
+  int length;
+
+  spectrum->fields = read_csv_fields (fp, &length);
+  csv_init (&p, CSV_STRICT | CSV_STRICT_FINI | CSV_APPEND_NULL);
+  rewind (fp);
+  do
+    {
+      bytes_read = fread (buf, 1, sizeof (buf), fp);
+      csv_parse (&p, buf, bytes_read, legacy_cell, legacy_row, &body);
+    } while (!feof (fp));
+  csv_fini (&p, legacy_cell, legacy_row, &body);
+  csv_free (&p);
+
+  spectrum->num_fields = body.num_cols;
+  spectrum->num_datarows = body.size / body.num_cols;
+  matrix_transpose (body.data, spectrum->num_fields, spectrum->num_datarows);
+  spectrum->wavelengths = (double *)calloc (body.buffer_size, sizeof (double));
+  spectrum->intensities = (double *)calloc (body.buffer_size, sizeof (double));
+  memcpy (spectrum->wavelengths, body.data, spectrum->num_datarows * sizeof (double));
+  memcpy (spectrum->intensities, body.data + spectrum->num_datarows, spectrum->num_datarows * sizeof (double));
+  return spectrum;  // body.data leaked as it was
+}
+
+/* read_csv_mmap () on n_threads threads */
+static struct csv_data *
+load_columns (const char   *path,
+              unsigned int  n_threads)
+{
+  struct csv_columns table;
+  if (read_csv_columns (path, true, 2, n_threads, &table))
+    return NULL;
+  struct csv_data *spectrum = (struct csv_data *)calloc (1, sizeof (struct csv_data));
+  spectrum->fields = table.fields;
+  spectrum->wavelengths = table.columns[0];
+  spectrum->intensities = table.columns[1];
+  spectrum->num_fields = table.num_fields;
+  spectrum->num_datarows = table.num_rows;
+  free (table.columns);
+  return spectrum;
+}
+
+static struct csv_data *
+load (int           method,
+      const char   *path,
+      unsigned int  n_threads)
+{
+  if (method >= 2)
+    return load_columns (path, method == 2 ? 1 : n_threads);
+  FILE *fp = fopen (path, "r");
+  if (!fp)
+    return NULL;
+  struct csv_data *spectrum = method == 0 ? legacy_read_csv (fp) : (struct csv_data *)read_csv (fp, true, VERTICAL, 1);
+  fclose (fp);
+  return spectrum;
+}
+
+/* A synthetic vertical spectrum: wavelength, intensity and a third column that is
+ * checked but not kept, like the extra columns of astmg173.xls */
+static void
+write_spectrum (const char *path,
+                size_t      num_rows)
+{
+  FILE *fp = fopen (path, "w");
+  if (!fp)
+    {
+      perror (path);
+      exit (EXIT_FAILURE);
+    }
+  fprintf (fp, "Wvlgth nm,Global tilt  W*m-2*nm-1,Direct W*m-2*nm-1\n");
+  for (size_t i = 0; i < num_rows; i++)
+    fprintf (fp, "%.4lf,%.6E,%.5lf\n", 280 + i * 0.01, 1.5 * (i % 977) / 977, 0.001 * (i % 313));
+  fclose (fp);
+}
+
+/* Loads the file in a child process each, so that ru_maxrss is the peak of that loader
+ * alone, and checks the first and last data against the one-pass read_csv (). With more
+ * than one repeat the peak also holds what malloc () keeps of the loads before.
+ * Usage: csv-load-benchmark [rows] [repeats] [threads], 0 threads for one per CPU */
+int
+main (int   argc,
+      char *argv[])
+{
+  const size_t num_rows = argc > 1 ? strtoul (argv[1], NULL, 10) : 2000000;
+  const int repeats = argc > 2 ? atoi (argv[2]) : 1;
+  const unsigned int n_threads = argc > 3 ? strtoul (argv[3], NULL, 10) : 0;
+  const char *names[] = { "rewind + transpose", "read_csv one pass", "mmap, 1 thread", "mmap, threads" };
+  char path[] = "/tmp/csv-load-benchmarkXXXXXX";
+  double reference[5] = {0};
+  int status = EXIT_SUCCESS;
+
+  int fd = mkstemp (path);
+  if (fd < 0)
+    {
+      perror ("mkstemp");
+      exit (EXIT_FAILURE);
+    }
+  close (fd);
+  write_spectrum (path, num_rows);
+  printf ("%zu rows, 2 of 3 columns kept: %.1lf MiB of doubles\n", num_rows, 2.0 * num_rows * sizeof (double) / (1 << 20));
+
+  for (int m = 0; m < 4; m++)
+    {
+      int pipe_fd[2];
+      if (pipe (pipe_fd))
+        exit (EXIT_FAILURE);
+      pid_t pid = fork ();
+      if (pid == 0)
+        {
+          struct timespec t_start, t_end;
+          double seconds = 0, check[4] = {0};
+          for (int r = 0; r < repeats; r++)
+            {
+              clock_gettime (CLOCK_MONOTONIC, &t_start);
+              struct csv_data *spectrum = load (m, path, n_threads);
+              clock_gettime (CLOCK_MONOTONIC, &t_end);
+              seconds += (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) * 1E-9;
+              if (!spectrum || spectrum->num_datarows != num_rows)
+                _exit (EXIT_FAILURE);
+              check[0] = spectrum->wavelengths[0];
+              check[1] = spectrum->intensities[0];
+              check[2] = spectrum->wavelengths[num_rows - 1];
+              check[3] = spectrum->intensities[num_rows - 1];
+              /* Keep only the last load alive, as an application replacing its spectrum */
+              if (r + 1 < repeats)
+                {
+                  for (unsigned int i = 0; spectrum->fields && i < spectrum->num_fields; i++)
+                    free (spectrum->fields[i]);
+                  free (spectrum->fields);
+                  free (spectrum->wavelengths);
+                  free (spectrum->intensities);
+                  free (spectrum);
+                }
+            }
+          double report[5] = { seconds / repeats, check[0], check[1], check[2], check[3] };
+          if (write (pipe_fd[1], report, sizeof (report)) != sizeof (report))
+            _exit (EXIT_FAILURE);
+          _exit (EXIT_SUCCESS);
+        }
+      close (pipe_fd[1]);
+      double report[5];
+      struct rusage usage;
+      int child_status;
+      const bool received = read (pipe_fd[0], report, sizeof (report)) == sizeof (report);
+      close (pipe_fd[0]);
+      wait4 (pid, &child_status, 0, &usage);
+      if (!received || !WIFEXITED (child_status) || WEXITSTATUS (child_status) != EXIT_SUCCESS)
+        {
+          fprintf (stderr, "ERROR: %s failed to load %s.\n", names[m], path);
+          status = EXIT_FAILURE;
+          continue;
+        }
+      if (m == 1)
+        memcpy (reference, report, sizeof (report));
+      else if (m >= 2 && memcmp (reference + 1, report + 1, 4 * sizeof (double)))
+        {
+          fprintf (stderr, "ERROR: %s and read_csv () disagree.\n", names[m]);
+          status = EXIT_FAILURE;
+        }
+      printf ("  %-20s %8.3lf s  peak RSS %8.1lf MiB\n", names[m], report[0], usage.ru_maxrss / 1024.0);
+    }
+  unlink (path);
+  exit (status);
+}
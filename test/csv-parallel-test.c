@@ -0,0 +1,136 @@
+/* csv-parallel-test.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/data_io.h"
+
+/* Above CSV_MMAP_PARALLEL_SIZE of csv_mmap.c, so that read_csv_columns () splits the file */
+#define TEST_FILE_SIZE (40 << 20)  /* bytes */
+
+/* CRLF, LF and bare CR line ends, quoted cells, some of them at the start of a line,
+ * blank lines and blank-padded cells, so that the splits of the parallel parse land
+ * between and inside all of them */
+static size_t
+write_spectrum (const char *path)
+{
+  FILE *fp = fopen (path, "wb");
+  size_t num_rows = 0;
+  if (!fp)
+    {
+      perror (path);
+      exit (EXIT_FAILURE);
+    }
+  fprintf (fp, "\"Wavelength, nm\",\"Intensity \"\"global\"\"\",Direct\r\n");
+  srand (173);
+  while (ftell (fp) < TEST_FILE_SIZE)
+    {
+      const int r = rand () % 100;
+      const char *line_end = r < 60 ? "\r\n" : r < 90 ? "\n" : "\r";
+      const double wavelength = 280 + num_rows * 0.01, intensity = rand () / (double)RAND_MAX;
+      if (r % 7 == 0)
+        fprintf (fp, "\"%.4lf\", %.6E ,%d%s", wavelength, intensity, r, line_end);
+      else if (r % 5 == 0)
+        fprintf (fp, "%.4lf,\"%.6E\",\"%d\"%s", wavelength, intensity, r, line_end);
+      else
+        fprintf (fp, "%.4lf,%.6E,%d%s", wavelength, intensity, r, line_end);
+      if (r % 11 == 0)
+        fputs (r % 2 ? "\r\n" : "\n", fp);
+      num_rows++;
+    }
+  fclose (fp);
+  return num_rows;
+}
+
+static int
+compare (const struct csv_columns *serial,
+         const struct csv_columns *parallel,
+         unsigned int              n_threads)
+{
+  if (parallel->num_rows != serial->num_rows || parallel->num_kept != serial->num_kept)
+    {
+      fprintf (stderr, "ERROR: %u threads read %zu rows of %u columns, 1 thread %zu of %u.\n", n_threads,
+               parallel->num_rows, parallel->num_kept, serial->num_rows, serial->num_kept);
+      return EXIT_FAILURE;
+    }
+  for (unsigned int i = 0; i < serial->num_fields; i++)
+    if (strcmp (parallel->fields[i], serial->fields[i]))
+      {
+        fprintf (stderr, "ERROR: %u threads read field %u as %s.\n", n_threads, i, parallel->fields[i]);
+        return EXIT_FAILURE;
+      }
+  for (unsigned int i = 0; i < serial->num_kept; i++)
+    for (size_t row = 0; row < serial->num_rows; row++)
+      if (memcmp (&parallel->columns[i][row], &serial->columns[i][row], sizeof (double)))
+        {
+          fprintf (stderr, "ERROR: %u threads read %.17g at row %zu of column %u, 1 thread %.17g.\n", n_threads,
+                   parallel->columns[i][row], row, i, serial->columns[i][row]);
+          return EXIT_FAILURE;
+        }
+  return EXIT_SUCCESS;
+}
+
+/* Parses the same file on one thread and on several and checks every row. 0 threads is one
+ * per CPU, which is only a parallel parse on a machine with more than one; 4 always is.
+ * Usage: csv-parallel-test */
+int
+main (int   argc,
+      char *argv[])
+{
+  const unsigned int n_threads[] = { 0, 4, 13 };
+  char path[] = "/tmp/csv-parallel-testXXXXXX";
+  struct csv_columns serial;
+  int status = EXIT_SUCCESS;
+
+  int fd = mkstemp (path);
+  if (fd < 0)
+    {
+      perror ("mkstemp");
+      exit (EXIT_FAILURE);
+    }
+  close (fd);
+  const size_t num_rows = write_spectrum (path);
+  if (read_csv_columns (path, true, 0, 1, &serial) || serial.num_rows != num_rows || serial.num_fields != 3)
+    {
+      fprintf (stderr, "ERROR: 1 thread did not read the %zu rows of 3 columns written.\n", num_rows);
+      unlink (path);
+      exit (EXIT_FAILURE);
+    }
+  for (size_t t = 0; t < sizeof (n_threads) / sizeof (n_threads[0]); t++)
+    {
+      struct csv_columns parallel;
+      if (read_csv_columns (path, true, 0, n_threads[t], &parallel))
+        {
+          fprintf (stderr, "ERROR: %u threads failed to read %s.\n", n_threads[t], path);
+          status = EXIT_FAILURE;
+          continue;
+        }
+      if (compare (&serial, &parallel, n_threads[t]))
+        status = EXIT_FAILURE;
+      else
+        printf ("%u threads: %zu rows match\n", n_threads[t], parallel.num_rows);
+      csv_columns_clear (&parallel);
+    }
+  csv_columns_clear (&serial);
+  unlink (path);
+  exit (status);
+}
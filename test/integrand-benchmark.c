@@ -0,0 +1,197 @@
+/* integrand-benchmark.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_spline.h>
+#include <gsl/gsl_integration.h>
+#include <gsl/gsl_sf_exp.h>
+
+#include "../src/sqlimit.h"
+#include "../src/sl_kernels.h"
+
+struct spline_params
+{
+  gsl_spline       *spline;
+  gsl_interp_accel *acc;
+};
+
+/* The callback integrands of sqlimit.c, as they are there */
+static double
+s_photons_per_tea (double  Ephoton,  /* J */
+                   void   *params)
+{
+  double lambda = hPlanck * c0 / Ephoton;  /* m */
+  gsl_spline *spline = ((struct spline_params *)params)->spline;
+  gsl_interp_accel *acc = ((struct spline_params *)params)->acc;
+  return gsl_spline_eval (spline, lambda * 1E9, acc) * 1E9 / gsl_pow_3 (Ephoton) * hPlanck * c0;
+}
+
+static double
+RR0_integrand (double  E,  /* J */
+               void   *params)
+{
+  const double temperature = *(double *)params;  /* K */
+  return E * E  / (gsl_sf_exp (E / (kB * temperature)) - 1);
+}
+
+static inline double
+callback_kernel (const gsl_function *F,
+                 double              x)
+{
+  return GSL_FN_EVAL (F, x);
+}
+
+/* The native algorithm with the integrand behind gsl_function, which isolates the cost
+ * of the indirect call, the void * casts and the constants loaded from consts.c */
+SL_DEFINE_ADAPTIVE (callback_adaptive, const gsl_function *, callback_kernel)
+
+static double
+seconds_since (const struct timespec *t_start)
+{
+  struct timespec t_end;
+  clock_gettime (CLOCK_MONOTONIC, &t_end);
+  return (t_end.tv_sec - t_start->tv_sec) + (t_end.tv_nsec - t_start->tv_nsec) * 1E-9;
+}
+
+/* Photon flux above every bandgap of a sweep and RR0 at every bandgap, by QAGS over the
+ * gsl_function callbacks, by the native adaptive algorithm over the same callbacks and by
+ * the native algorithm with the kernels of sl_kernels.h inlined.
+ * Usage: integrand-benchmark [spectrum.csv] [repeats]; the default spectrum is
+ * spectra/astmg173.csv relative to the working directory. */
+int
+main (int   argc,
+      char *argv[])
+{
+  const char *path = argc > 1 ? argv[1] : "spectra/astmg173.csv";
+  const int repeats = argc > 2 ? atoi (argv[2]) : 20;
+  const size_t length = 200, iter_lim = 50;
+  double temperature = Tcell;
+  int status = EXIT_SUCCESS;
+
+  FILE *fp = fopen (path, "r");
+  if (!fp)
+    {
+      perror (path);
+      exit (EXIT_FAILURE);
+    }
+  struct csv_data *spectrum = read_csv (fp, true, true, 1);
+  fclose (fp);
+
+  gsl_spline *spline = gsl_spline_alloc (gsl_interp_linear, spectrum->num_datarows);
+  gsl_spline_init (spline, spectrum->wavelengths, spectrum->intensities, spectrum->num_datarows);
+  struct spline_params spline_params = { spline, gsl_interp_accel_alloc () };
+  struct sl_linear_cursor cursor;
+  sl_linear_cursor_bind (&cursor, spline->x, spline->y, spline->size);
+  gsl_integration_workspace *int_ws = gsl_integration_workspace_alloc (iter_lim);
+  struct quad_rule *rule = quad_rule_alloc (QUAD_RULE_GAUSS_LEGENDRE, 8);
+  gsl_function F_s = { &s_photons_per_tea, &spline_params };
+  gsl_function F_RR0 = { &RR0_integrand, &temperature };
+  gsl_set_error_handler_off ();
+
+  const double E_min = hPlanck * c0 / (spectrum->wavelengths[spectrum->num_datarows - 1] * 1E-9);  /* J */
+  const double E_max = hPlanck * c0 / (spectrum->wavelengths[0] * 1E-9);  /* J */
+  double *bandgap = linspace (E_min + 0.01 * eV, E_max - 0.01 * eV, length);
+  double *photons[3], *rr0[3];
+  double photon_seconds[3] = {0}, rr0_seconds[3] = {0};
+  const char *names[] = { "QAGS, callback", "native, callback", "native, inlined" };
+  for (int m = 0; m < 3; m++)
+    {
+      photons[m] = (double *)calloc (length, sizeof (double));
+      rr0[m] = (double *)calloc (length, sizeof (double));
+    }
+
+  for (int r = 0; r < repeats; r++)
+    for (int m = 0; m < 3; m++)
+      {
+        struct timespec t_start;
+        double error;
+        clock_gettime (CLOCK_MONOTONIC, &t_start);
+        for (size_t i = 0; i < length; i++)
+          {
+            if (m == 0)
+              gsl_integration_qags (&F_s, bandgap[i], E_max, 1.49E-08, 1.49E-08, iter_lim, int_ws, &photons[m][i], &error);
+            else if (m == 1)
+              photons[m][i] = callback_adaptive (&F_s, rule, bandgap[i], E_max, 1.49E-08, 1.49E-08, NULL);
+            else
+              photons[m][i] = sl_native_photons (&cursor, rule, bandgap[i], E_max, 1.49E-08, 1.49E-08, NULL);
+          }
+        photon_seconds[m] += seconds_since (&t_start);
+
+        clock_gettime (CLOCK_MONOTONIC, &t_start);
+        for (size_t i = 0; i < length; i++)
+          {
+            if (m == 0)
+              gsl_integration_qags (&F_RR0, bandgap[i], E_max, 1.49E-08, 1.49E-08, iter_lim, int_ws, &rr0[m][i], &error);
+            else if (m == 1)
+              rr0[m][i] = callback_adaptive (&F_RR0, rule, bandgap[i], E_max, 1.49E-08, 1.49E-08, NULL);
+            else
+              rr0[m][i] = sl_native_rr0 (1 / (SL_KB * temperature), rule, bandgap[i], E_max, 1.49E-08, 1.49E-08, NULL);
+          }
+        rr0_seconds[m] += seconds_since (&t_start);
+      }
+
+  printf ("%s (%u points), %zu bandgaps, %d repeats\n", path, spectrum->num_datarows, length, repeats);
+  for (int m = 0; m < 3; m++)
+    {
+      double photon_diff = 0, rr0_diff = 0;
+      for (size_t i = 0; i < length; i++)
+        {
+          photon_diff = GSL_MAX (photon_diff, fabs (photons[m][i] / photons[0][i] - 1));
+          rr0_diff = GSL_MAX (rr0_diff, fabs (rr0[m][i] / rr0[0][i] - 1));
+        }
+      printf ("  %-18s photons %10.3lf us  RR0 %10.3lf us per integral  max relative difference vs QAGS %.3g, %.3g\n", names[m],
+              photon_seconds[m] / (repeats * length) * 1E6, rr0_seconds[m] / (repeats * length) * 1E6, photon_diff, rr0_diff);
+      /* Both adaptive methods give up on the kinks of a measured spectrum at their interval
+       * limits, so only the smooth RR0 integrand has to agree to the tolerance */
+      if (rr0_diff > 1E-7)
+        status = EXIT_FAILURE;
+    }
+
+  /* Same algorithm and nodes: only the folding of the constants differs, which may at most
+   * tip a subdivision one way or the other within the tolerance */
+  for (size_t i = 0; i < length; i++)
+    if (fabs (photons[2][i] / photons[1][i] - 1) > 1E-9 || fabs (rr0[2][i] / rr0[1][i] - 1) > 1E-9)
+      {
+        fprintf (stderr, "ERROR: The inlined kernels differ from the callbacks at %lf eV.\n", bandgap[i] / eV);
+        status = EXIT_FAILURE;
+        break;
+      }
+  printf ("Inlined speed-up: photons %.2lfx, RR0 %.2lfx over the callbacks; %.2lfx, %.2lfx over QAGS\n",
+          photon_seconds[1] / photon_seconds[2], rr0_seconds[1] / rr0_seconds[2],
+          photon_seconds[0] / photon_seconds[2], rr0_seconds[0] / rr0_seconds[2]);
+
+  for (int m = 0; m < 3; m++)
+    {
+      free (photons[m]);
+      free (rr0[m]);
+    }
+  free (bandgap);
+  quad_rule_free (rule);
+  gsl_integration_workspace_free (int_ws);
+  gsl_interp_accel_free (spline_params.acc);
+  gsl_spline_free (spline);
+  free (spectrum->wavelengths);
+  free (spectrum->intensities);
+  free (spectrum);
+  exit (status);
+}
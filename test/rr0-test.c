@@ -0,0 +1,62 @@
+/* rr0-test.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "../src/sqlimit.h"
+
+/* Compare the Bose-Einstein series RR0 with the QAGS integral of RR0_integrand
+ * over the bandgaps of a typical sweep (E_max of the 280 nm end of ASTM G173). */
+int
+main (int   argc,
+      char *argv[])
+{
+  const double E_max = hPlanck * c0 / 280E-9;  /* J */
+  const size_t length = 200;
+  double *bandgap = linspace (0.3 * eV, E_max - 0.01 * eV, length);
+  double max_rel_err = 0;
+  clock_t t_series, t_qags;
+
+  for (size_t i = 0; i < length; i++)
+    {
+      double series = sqlimit_RR0 (bandgap[i], E_max, SQLIMIT_QUAD_TABLE);
+      double qags = sqlimit_RR0 (bandgap[i], E_max, SQLIMIT_QUAD_QAGS);
+      double rel_err = fabs (series / qags - 1);
+      if (rel_err > max_rel_err)
+        max_rel_err = rel_err;
+      printf ("%lf eV %.17g %.17g %.3g\n", bandgap[i] / eV, series, qags, rel_err);
+    }
+
+  t_series = clock ();
+  for (size_t i = 0; i < length; i++)
+    sqlimit_RR0 (bandgap[i], E_max, SQLIMIT_QUAD_TABLE);
+  t_series = clock () - t_series;
+  t_qags = clock ();
+  for (size_t i = 0; i < length; i++)
+    sqlimit_RR0 (bandgap[i], E_max, SQLIMIT_QUAD_QAGS);
+  t_qags = clock () - t_qags;
+
+  printf ("Max relative difference %.3g; series %lf s, QAGS %lf s for %zu bandgaps\n", max_rel_err, (double)t_series / CLOCKS_PER_SEC, (double)t_qags / CLOCKS_PER_SEC, length);
+  free (bandgap);
+  /* QAGS is asked for epsrel = 1.49E-08 */
+  exit (max_rel_err < 1E-7 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,132 @@
+/* sl-strtod-test.c
+ *
+ * Copyright 2023 Yihua Liu <yihuajack@live.cn>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define _GNU_SOURCE
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/sl_strtod.h"
+
+static locale_t c_locale;
+
+/* sl_strtod () has to give the same bits and stop at the same character as strtod_l () in
+ * the C locale. The case is copied in front of a digit outside [str, end), which must not
+ * be read. */
+static int
+check (const char *s)
+{
+  char buf[128];
+  const size_t len = strlen (s);
+  const char *end, *expected_end;
+
+  memcpy (buf, s, len);
+  buf[len] = '7';
+  buf[len + 1] = '\0';
+  const double value = sl_strtod (buf, buf + len, &end);
+  const double expected = strtod_l (s, (char **)&expected_end, c_locale);
+  if (end - buf != expected_end - s
+      || (isnan (expected) ? !isnan (value) || signbit (value) != signbit (expected)
+                           : memcmp (&value, &expected, sizeof (double))))
+    {
+      fprintf (stderr, "ERROR: \"%s\" read as %.17g using %td characters, strtod_l () %.17g using %td.\n",
+               s, value, end - buf, expected, expected_end - s);
+      return 1;
+    }
+  return 0;
+}
+
+/* Usage: sl-strtod-test [random cases] */
+int
+main (int   argc,
+      char *argv[])
+{
+  const char *cases[] = {
+    /* The exact path: integers up to 2^53, powers of ten up to 1E22, and exponents
+     * shifted into the integer while it stays below 2^53 */
+    "9007199254740991", "9007199254740992", "9007199254740993", "-9007199254740993",
+    "1E22", "1E23", "1e-22", "1e-23", "4.35e22", "9007199254740991e22", "9007199254740993e-22",
+    "1.5e25", "1.5E37", "1.5e38", "15e36", "123456789012345e22", "1234567890123456e22",
+    "0.000001e-16", "1.7976931348623157e308",
+    /* More than SL_STRTOD_MAX_DIGITS digits, some of them halfway cases */
+    "12345678901234567890", "123456789012345678901234567890", "0.1000000000000000055511151231257827",
+    "9007199254740993.0000000000000000001", "9007199254740992.9999999999999999999",
+    "1.00000000000000011102230246251565404236316680908203125",
+    "1.00000000000000011102230246251565404236316680908203124",
+    "00000000000000000000000000001.5", "0.00000000000000000000000000001",
+    /* Subnormals, underflow and overflow */
+    "4.9406564584124654e-324", "2.4703282292062327e-324", "2.4703282292062328e-324",
+    "2.2250738585072011e-308", "2.2250738585072014e-308", "1e-400", "-1e-400", "1e400", "-1e400",
+    /* inf and nan */
+    "inf", "-inf", "+INF", "Infinity", "infinit", "nan", "-nan", "NaN", "nan(123)", "nan(abc_1)", "nan(", "nanx",
+    /* Partial numbers */
+    "1e", "1e+", "1e-", "-1.5E", "1.e5", ".5", "5.", "-", "+", ".", "-.", "-.e1", "e1", "", "x",
+    "1,5", "1.5;", "1.5 ", "-0", "-0.0e10", "+7",
+  };
+  const long n_random = argc > 1 ? strtol (argv[1], NULL, 10) : 1000000;
+  int n_errors = 0;
+
+  c_locale = newlocale (LC_ALL_MASK, "C", (locale_t)0);
+  for (size_t i = 0; i < sizeof (cases) / sizeof (cases[0]); i++)
+    n_errors += check (cases[i]);
+
+  /* Leading blanks are not skipped and hexadecimal is not read, unlike strtod () */
+  const char *end;
+  const char *blank = " 1.5", *hex = "0x10";
+  if (sl_strtod (blank, blank + strlen (blank), &end) != 0 || end != blank)
+    {
+      fprintf (stderr, "ERROR: \"%s\" was read.\n", blank);
+      n_errors++;
+    }
+  if (sl_strtod (hex, hex + strlen (hex), &end) != 0 || end != hex + 1)
+    {
+      fprintf (stderr, "ERROR: \"%s\" was read past its 0.\n", hex);
+      n_errors++;
+    }
+
+  /* Random mantissas of 1 to 25 digits with a random point and exponent, to cover both the
+   * exact and the slow path around every boundary */
+  srand (173);
+  for (long i = 0; i < n_random; i++)
+    {
+      char s[64];
+      int n = 0;
+      const int n_digits = 1 + rand () % 25, point = rand () % (n_digits + 1);
+      if (rand () % 2)
+        s[n++] = '-';
+      for (int d = 0; d < n_digits; d++)
+        {
+          if (d == point)
+            s[n++] = '.';
+          s[n++] = '0' + rand () % 10;
+        }
+      if (rand () % 4)
+        n += sprintf (s + n, "e%d", rand () % 700 - 350);
+      s[n] = '\0';
+      n_errors += check (s);
+    }
+
+  printf ("%d of %zu cases and %ld random ones differ from strtod_l ()\n", n_errors,
+          sizeof (cases) / sizeof (cases[0]) + 2, n_random);
+  freelocale (c_locale);
+  exit (n_errors ? EXIT_FAILURE : EXIT_SUCCESS);
+}
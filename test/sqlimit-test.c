@@ -71,6 +71,22 @@ main (int   argc,
   for (size_t i = 0; i < eff_bg_data.length; i++)
     free (eff_bg_data.efficiency[i]);
 
+  free (eff_bg_data.efficiency);
+#elif defined TEST_POLY_POOL  // the spectra of TEST_POLY swept on one pool worker per CPU
+  fp = fopen ("/home/ayka-tsuzuki/gnome-semilab/test/spectra/poly_spectrum.csv", "r");
+  struct csv_data_2d *spectrum = read_csv (fp, false, false, 2);
+  struct sqlimit_options options = { .n_threads = 0 };
+  struct eff_bg_2d eff_bg_data = sqlimit_main_2d_full (spectrum, HORIZONTAL, &options);
+  fclose (fp);
+  if (!eff_bg_data.efficiency)
+    exit (EXIT_FAILURE);
+  for (size_t i = 0; i < spectrum->num_datarows; i++)
+    {
+      free (spectrum->intensities[i]);
+      free (eff_bg_data.efficiency[i]);
+    }
+
+  free (eff_bg_data.bandgap);
   free (eff_bg_data.efficiency);
 #elif defined TEST_SPE
   fp = fopen ("/home/ayka-tsuzuki/gnome-semilab/test/spectra/AM1.5G ed2 1 sun.spe", "r");